@@ -1,13 +1,19 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <signal.h>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 #include <unordered_set>
+#include <unordered_map>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <experimental/optional>
 #include <boost/program_options.hpp>
 
@@ -30,6 +36,7 @@
 #include <IO/WriteBufferFromFileDescriptor.h>
 #include <IO/WriteBufferFromFile.h>
 #include <IO/WriteBufferFromOStream.h>
+#include <IO/WriteBufferFromString.h>
 #include <IO/ReadBufferFromMemory.h>
 #include <IO/ReadHelpers.h>
 #include <IO/WriteHelpers.h>
@@ -42,10 +49,18 @@
 #include <Parsers/ASTQueryWithOutput.h>
 #include <Parsers/ASTLiteral.h>
 #include <Parsers/ASTIdentifier.h>
+#include <Parsers/ASTFunction.h>
+#include <Parsers/ASTExpressionList.h>
+#include <Parsers/ExpressionListParsers.h>
 #include <Parsers/formatAST.h>
 #include <Parsers/parseQuery.h>
 #include <Interpreters/Context.h>
+#include <Interpreters/ExpressionAnalyzer.h>
+#include <Interpreters/ExpressionActions.h>
+#include <Common/SipHash.h>
 #include <Client/Connection.h>
+#include <Columns/ColumnNullable.h>
+#include <Columns/ColumnString.h>
 #include "InterruptListener.h"
 #include <Functions/registerFunctions.h>
 #include <AggregateFunctions/registerAggregateFunctions.h>
@@ -81,6 +96,17 @@ extern const int CANNOT_APPEND_HISTORY;
 extern const int UNKNOWN_PACKET_FROM_SERVER;
 extern const int UNEXPECTED_PACKET_FROM_SERVER;
 extern const int CLIENT_OUTPUT_FORMAT_SPECIFIED;
+extern const int CANNOT_PIPE;
+extern const int QUERY_WAS_CANCELLED;
+}
+
+/// Set by ch_set_interrupt_check, tells whether the backend has an interrupt to
+/// service. It only reads flags of the backend and must not throw or jump.
+static int (*interrupt_check)(void) = nullptr;
+
+static bool interruptPending()
+{
+    return interrupt_check && interrupt_check();
 }
 
 class Client : public Poco::Util::Application
@@ -92,7 +118,16 @@ class Client : public Poco::Util::Application
         static Context context_instance = Context::createGlobal();
         context = &context_instance;
     }
-    std::vector<Block> *blocks;
+
+    const Settings &getSettings() const
+    {
+        return context->getSettingsRef();
+    }
+
+    const Context &getContext() const
+    {
+        return *context;
+    }
 
   private:
     using StringSet = std::unordered_set<String>;
@@ -316,11 +351,6 @@ class Client : public Poco::Util::Application
         UInt16 port = config().getInt("port", DBMS_DEFAULT_PORT);
         String default_database = config().getString("database", "");
         String user = config().getString("user", "");
-        String password = config().getString("password", "");
-
-        Protocol::Compression::Enum compression = config().getBool("compression", true)
-                                                      ? Protocol::Compression::Enable
-                                                      : Protocol::Compression::Disable;
 
         if (is_interactive)
             std::cout << "Connecting to "
@@ -329,10 +359,7 @@ class Client : public Poco::Util::Application
                       << (!user.empty() ? " as user " + user : "")
                       << "." << std::endl;
 
-        connection = std::make_unique<Connection>(host, port, default_database, user, password, "client", compression,
-                                                  Poco::Timespan(config().getInt("connect_timeout", DBMS_DEFAULT_CONNECT_TIMEOUT_SEC), 0),
-                                                  Poco::Timespan(config().getInt("receive_timeout", DBMS_DEFAULT_RECEIVE_TIMEOUT_SEC), 0),
-                                                  Poco::Timespan(config().getInt("send_timeout", DBMS_DEFAULT_SEND_TIMEOUT_SEC), 0));
+        connection = createConnection();
 
         if (is_interactive)
         {
@@ -352,6 +379,73 @@ class Client : public Poco::Util::Application
         }
     }
 
+    /// Parameters not given in opts are taken from the configuration.
+    std::unique_ptr<Connection> createConnection(const CHConnOptions *opts = nullptr)
+    {
+        CHConnOptions none{};
+        if (!opts)
+        {
+            none.compression = -1;
+            opts = &none;
+        }
+
+        String host = opts->host ? opts->host : config().getString("host", "localhost");
+        UInt16 port = opts->port ? opts->port : config().getInt("port", DBMS_DEFAULT_PORT);
+        String default_database = opts->database ? opts->database : config().getString("database", "");
+        String user = opts->user ? opts->user : config().getString("user", "");
+        String password = opts->password ? opts->password : config().getString("password", "");
+
+        bool compress = opts->compression >= 0 ? opts->compression != 0 : config().getBool("compression", true);
+        Protocol::Compression::Enum compression = compress ? Protocol::Compression::Enable : Protocol::Compression::Disable;
+
+        int connect_timeout = opts->connect_timeout ? opts->connect_timeout : config().getInt("connect_timeout", DBMS_DEFAULT_CONNECT_TIMEOUT_SEC);
+        int receive_timeout = opts->receive_timeout ? opts->receive_timeout : config().getInt("receive_timeout", DBMS_DEFAULT_RECEIVE_TIMEOUT_SEC);
+        int send_timeout = opts->send_timeout ? opts->send_timeout : config().getInt("send_timeout", DBMS_DEFAULT_SEND_TIMEOUT_SEC);
+
+        return std::make_unique<Connection>(host, port, default_database, user, password, "client", compression,
+                                            Poco::Timespan(connect_timeout, 0),
+                                            Poco::Timespan(receive_timeout, 0),
+                                            Poco::Timespan(send_timeout, 0));
+    }
+
+    /// Switch DateLUT to the time zone of the server, once per process.
+    void useServerTimezone(Connection &conn)
+    {
+        static bool done = false;
+        if (done)
+            return;
+        done = true;
+
+        /// Initialize DateLUT here to avoid counting time spent here as query execution time.
+        DateLUT::instance();
+        if (!context->getSettingsRef().use_client_time_zone)
+        {
+            const auto &time_zone = conn.getServerTimezone();
+            if (!time_zone.empty())
+            {
+                try
+                {
+                    DateLUT::setDefaultTimezone(time_zone);
+                }
+                catch (...)
+                {
+                    std::cerr << "Warning: could not switch to server time zone: " << time_zone
+                              << ", reason: " << getCurrentExceptionMessage(/* with_stacktrace = */ false) << std::endl
+                              << "Proceeding with local time zone."
+                              << std::endl
+                              << std::endl;
+                }
+            }
+            else
+            {
+                std::cerr << "Warning: could not determine server time zone. "
+                          << "Proceeding with local time zone."
+                          << std::endl
+                          << std::endl;
+            }
+        }
+    }
+
     static bool isWhitespace(char c)
     {
         return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
@@ -918,11 +1012,6 @@ class Client : public Poco::Util::Application
         if (!block)
             return;
 
-        if (blocks)
-        {
-            blocks->emplace_back(block);
-        }
-
         processed_rows += block.rows();
         initBlockOutputStream(block);
 
@@ -1263,8 +1352,6 @@ class Client : public Poco::Util::Application
     void initWorker(char *sql)
     {
         config().setString("query", sql);
-        registerFunctions();
-        registerAggregateFunctions();
 
         /// Batch mode is enabled if one of the following is true:
         /// - -e (--query) command line option is present.
@@ -1297,80 +1384,674 @@ class Client : public Poco::Util::Application
             need_render_progress = config().getBool("progress", false);
             echo_queries = config().getBool("echo", false);
         }
+    }
 
-        connect();
+    /// Everything that does not depend on a query, done once when the module is loaded.
+    /// With shared_preload_libraries this happens in the postmaster,
+    /// and the backends inherit the context and function registries when they are forked.
+    void initProcess(int argc, char **argv)
+    {
+        initStatic(argc, argv);
+        initialize(*this);
 
-        /// Initialize DateLUT here to avoid counting time spent here as query execution time.
+        is_interactive = false;
+        need_render_progress = false;
+
+        registerFunctions();
+        registerAggregateFunctions();
         DateLUT::instance();
-        if (!context->getSettingsRef().use_client_time_zone)
+    }
+
+    /// Connection for queries streamed by the foreign data wrapper, kept in its connection cache.
+    std::unique_ptr<Connection> openConnection(const CHConnOptions *opts)
+    {
+        auto conn = createConnection(opts);
+        conn->forceConnected();
+        useServerTimezone(*conn);
+        return conn;
+    }
+
+    /// Run the query with the client's own connection, the way clickhouse-client does.
+    void runQuery()
+    {
+        connect();
+        useServerTimezone(*connection);
+        run();
+    }
+};
+}
+
+namespace DB
+{
+
+/// Result of a query that is read block by block on demand.
+/// The connection is borrowed from the connection cache of the foreign data wrapper
+/// and is busy until the stream is finished or cancelled.
+/// Only the block that is currently being converted to tuples is kept.
+class CHQueryStream
+{
+  public:
+    explicit CHQueryStream(Connection &connection_) : connection(&connection_) {}
+
+    ~CHQueryStream()
+    {
+        stopFetch();
+        if (fetcher.joinable())
         {
-            const auto &time_zone = connection->getServerTimezone();
-            if (!time_zone.empty())
             {
-                try
-                {
-                    DateLUT::setDefaultTimezone(time_zone);
-                }
-                catch (...)
-                {
-                    std::cerr << "Warning: could not switch to server time zone: " << time_zone
-                              << ", reason: " << getCurrentExceptionMessage(/* with_stacktrace = */ false) << std::endl
-                              << "Proceeding with local time zone."
-                              << std::endl
-                              << std::endl;
-                }
+                std::lock_guard<std::mutex> lock(fetch_mutex);
+                fetch_exit = true;
             }
-            else
+            fetch_cond.notify_all();
+            fetcher.join();
+        }
+        if (notify[0] >= 0)
+        {
+            ::close(notify[0]);
+            ::close(notify[1]);
+        }
+    }
+
+    void sendQuery(const String &query, const Settings &settings)
+    {
+        connection->sendQuery(query, "", QueryProcessingStage::Complete, &settings, nullptr, true);
+    }
+
+    /// Receive packets until the next non-empty block of data arrives.
+    /// The previous block is released before waiting for the next one.
+    /// Returns false when the server has sent the whole result. An interrupt
+    /// of the backend cancels the query and throws QUERY_WAS_CANCELLED, the
+    /// caller then services the interrupt.
+    bool nextBlock()
+    {
+        if (fetch_pending)
+            return finishFetch();
+
+        block = Block();
+        switch (receiveBlock(interruptPending))
+        {
+        case Fetch::Block:
+            return true;
+        case Fetch::Stopped:
+            throwCancelled();
+        default:
+            return false;
+        }
+    }
+
+    /// Receive the next block in the fetch thread of the stream, for a scan that
+    /// waits on several connections at once. The returned descriptor becomes readable
+    /// when the block has arrived, nextBlock then takes it without waiting.
+    /// The thread is started by the first call and waits between blocks.
+    int startFetch()
+    {
+        if (notify[0] < 0)
+        {
+            if (::pipe(notify) != 0)
+                throwFromErrno("Cannot create pipe", ErrorCodes::CANNOT_PIPE);
+            for (int fd : notify)
+                ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+            ::fcntl(notify[0], F_SETFL, O_NONBLOCK);
+        }
+
+        if (!fetcher.joinable())
+            fetcher = std::thread([this] { fetchLoop(); });
+
+        if (!fetch_pending)
+        {
+            block = Block();
+            fetch_done = false;
+            fetch_pending = true;
             {
-                std::cerr << "Warning: could not determine server time zone. "
-                          << "Proceeding with local time zone."
-                          << std::endl
-                          << std::endl;
+                std::lock_guard<std::mutex> lock(fetch_mutex);
+                fetch_requested = true;
+            }
+            fetch_cond.notify_all();
+        }
+
+        return notify[0];
+    }
+
+    /// Whether nextBlock returns without waiting for the server.
+    bool fetchReady() const
+    {
+        return fetch_pending ? fetch_done.load() : finished;
+    }
+
+    /// The scan is stopped before the end of the result (e.g. LIMIT on the PostgreSQL side).
+    /// Ask the server to cancel the query and drain the remaining packets.
+    void cancel()
+    {
+        stopFetch();
+
+        if (finished)
+            return;
+
+        connection->sendCancel();
+        while (!finished)
+        {
+            Connection::Packet packet = connection->receivePacket();
+            if (packet.type == Protocol::Server::Exception || packet.type == Protocol::Server::EndOfStream)
+                finished = true;
+        }
+    }
+
+    const Block &currentBlock() const { return block; }
+
+    /// Rows the server reported written so far, by an INSERT ... SELECT.
+    size_t writtenRows() const { return written_rows; }
+
+    /// Text form of a value, for the types that are not read from the column memory.
+    /// The result is valid until the next call.
+    const char *formatValue(size_t col, size_t row)
+    {
+        const auto &column = block.getByPosition(col);
+
+        text.clear();
+        {
+            WriteBufferFromString out(text);
+            column.type->serializeText(*column.column, row, out);
+        }
+        return text.c_str();
+    }
+
+  private:
+    Connection *connection;
+    Block block;
+    bool finished = false;
+    size_t written_rows = 0;
+    String text;
+
+    /// The server is polled in slices this long, so that an interrupt or a
+    /// stopped fetch is noticed while it is still computing the result.
+    static constexpr size_t poll_interval_us = 100000;
+
+    enum class Fetch
+    {
+        Block,
+        End,
+        Stopped
+    };
+
+    /// block being received by startFetch
+    std::thread fetcher;
+    std::mutex fetch_mutex;
+    std::condition_variable fetch_cond;
+    bool fetch_requested = false;   /// under fetch_mutex, until the thread has received
+    bool fetch_exit = false;        /// under fetch_mutex
+    bool fetch_pending = false;     /// started and not yet taken by nextBlock
+    std::atomic<bool> fetch_done{false};
+    std::atomic<bool> fetch_stop{false};
+    Fetch fetched = Fetch::End;
+    std::exception_ptr fetch_error;
+    int notify[2] = {-1, -1};
+
+    [[noreturn]] void throwCancelled()
+    {
+        cancel();
+        throw Exception("Query was cancelled", ErrorCodes::QUERY_WAS_CANCELLED);
+    }
+
+    /// Wait for the block of startFetch, servicing interrupts as nextBlock does.
+    bool finishFetch()
+    {
+        while (!fetch_done)
+        {
+            struct pollfd pfd = {notify[0], POLLIN, 0};
+
+            ::poll(&pfd, 1, poll_interval_us / 1000);
+            if (!fetch_done && interruptPending())
+                throwCancelled();
+        }
+
+        fetch_pending = false;
+        drainNotify();
+
+        if (fetch_error)
+        {
+            auto error = fetch_error;
+            fetch_error = nullptr;
+            std::rethrow_exception(error);
+        }
+        return fetched == Fetch::Block;
+    }
+
+    /// Make the fetch thread give up at its next poll of the server, and wait until
+    /// it is idle again. A packet it is in the middle of receiving is read to its end.
+    void stopFetch()
+    {
+        if (!fetch_pending)
+            return;
+
+        fetch_stop = true;
+        {
+            std::unique_lock<std::mutex> lock(fetch_mutex);
+            fetch_cond.wait(lock, [this] { return !fetch_requested; });
+        }
+        fetch_stop = false;
+        fetch_pending = false;
+        fetch_error = nullptr;
+        drainNotify();
+    }
+
+    /// Body of the fetch thread: receive one block per startFetch.
+    void fetchLoop()
+    {
+        /// Signals of the backend are handled by its own thread.
+        sigset_t signals;
+        sigfillset(&signals);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(fetch_mutex);
+                fetch_cond.wait(lock, [this] { return fetch_requested || fetch_exit; });
+                if (fetch_exit)
+                    return;
+            }
+
+            try
+            {
+                fetched = receiveBlock([this] { return fetch_stop.load(); });
+            }
+            catch (...)
+            {
+                fetch_error = std::current_exception();
+            }
+
+            /// Written before the fetch is marked done, so that whoever takes the
+            /// block also drains the byte and the pipe is empty for the next one.
+            char c = 0;
+            while (::write(notify[1], &c, 1) < 0 && errno == EINTR)
+                ;
+
+            {
+                std::lock_guard<std::mutex> lock(fetch_mutex);
+                fetch_requested = false;
+                fetch_done = true;
+            }
+            fetch_cond.notify_all();
+        }
+    }
+
+    void drainNotify()
+    {
+        char c;
+        while (::read(notify[0], &c, 1) > 0)
+            ;
+    }
+
+    /// Receive packets until the next non-empty block of data arrives, or until stop
+    /// says to give up while the server has sent nothing.
+    template <typename Stop>
+    Fetch receiveBlock(Stop &&stop)
+    {
+        while (!finished)
+        {
+            if (!connection->poll(poll_interval_us))
+            {
+                if (stop())
+                    return Fetch::Stopped;
+                continue;
+            }
+
+            Connection::Packet packet = connection->receivePacket();
+
+            switch (packet.type)
+            {
+            case Protocol::Server::Data:
+                /// The header block contains zero rows and is only a description of the structure.
+                if (packet.block.rows() == 0)
+                    continue;
+                block = std::move(packet.block);
+                return Fetch::Block;
+
+            case Protocol::Server::Progress:
+                written_rows += packet.progress.write_rows;
+                continue;
+
+            case Protocol::Server::ProfileInfo:
+            case Protocol::Server::Totals:
+            case Protocol::Server::Extremes:
+                continue;
+
+            case Protocol::Server::Exception:
+                finished = true;
+                packet.exception->rethrow();
+                return Fetch::End;
+
+            case Protocol::Server::EndOfStream:
+                finished = true;
+                return Fetch::End;
+
+            default:
+                throw Exception("Unknown packet from server", ErrorCodes::UNKNOWN_PACKET_FROM_SERVER);
+            }
+        }
+
+        return Fetch::End;
+    }
+};
+
+/// INSERT whose data is built here column by column and sent in blocks of the native protocol.
+/// The connection is borrowed from the connection cache and is busy until the INSERT is finished.
+class CHInsertStream
+{
+  public:
+    explicit CHInsertStream(Connection &connection_) : connection(&connection_) {}
+
+    /// The server answers an INSERT with an empty block of the structure of the inserted columns.
+    void sendQuery(const String &query, const Settings &settings)
+    {
+        connection->sendQuery(query, "", QueryProcessingStage::Complete, &settings, nullptr, true);
+
+        Connection::Packet packet = connection->receivePacket();
+        switch (packet.type)
+        {
+        case Protocol::Server::Data:
+            sample = packet.block.cloneEmpty();
+            block = sample.cloneEmpty();
+            return;
+
+        case Protocol::Server::Exception:
+            finished = true;
+            packet.exception->rethrow();
+            return;
+
+        default:
+            throw NetException("Unexpected packet from server (expected Data, got " + String(Protocol::Server::toString(packet.type)) + ")", ErrorCodes::UNEXPECTED_PACKET_FROM_SERVER);
+        }
+    }
+
+    const Block &sampleBlock() const { return sample; }
+
+    /// Rows are grouped by the partition key of the table before a block is sent, so that
+    /// each block sent holds one partition. ClickHouse would split a mixed block itself,
+    /// but counts its partitions against max_partitions_per_insert_block.
+    void setPartitionKey(const Context &context, const String &expr)
+    {
+        ParserExpressionWithOptionalAlias parser(false);
+        ASTPtr ast = parseQuery(parser, expr.data(), expr.data() + expr.size(), "partition key");
+
+        ASTPtr list;
+        const auto *func = typeid_cast<const ASTFunction *>(ast.get());
+        if (func && func->name == "tuple")
+            list = func->arguments->clone();
+        else
+        {
+            list = std::make_shared<ASTExpressionList>();
+            list->children.push_back(ast);
+        }
+
+        /// tuple() is a table without partitions
+        if (list->children.empty())
+            return;
+
+        partition_expr = ExpressionAnalyzer(list, context, nullptr, sample.getNamesAndTypesList()).getActions(false);
+        for (const auto &child : list->children)
+            partition_columns.push_back(child->getColumnName());
+    }
+
+    IColumn &column(size_t col) { return *block.getByPosition(col).column; }
+
+    /// Parse a value from its text form, as ClickHouse reads it from TabSeparated data.
+    void insertText(size_t col, const char *text)
+    {
+        auto &elem = block.getByPosition(col);
+        ReadBufferFromMemory in(text, strlen(text));
+        elem.type->deserializeTextEscaped(*elem.column, in);
+        if (!in.eof())
+            throw Exception("Cannot parse \"" + String(text) + "\" as " + elem.type->getName(), ErrorCodes::BAD_ARGUMENTS);
+    }
+
+    /// Send the rows built so far and start a new block.
+    void flush()
+    {
+        if (block.rows() == 0)
+            return;
+        if (partition_expr)
+            sendByPartition();
+        else
+            connection->sendData(block);
+        block = sample.cloneEmpty();
+    }
+
+    /// An empty block ends the data, then the server reports the end of the query or an exception.
+    void finish()
+    {
+        flush();
+        connection->sendData(Block());
+
+        while (!finished)
+        {
+            Connection::Packet packet = connection->receivePacket();
+
+            switch (packet.type)
+            {
+            case Protocol::Server::Progress:
+            case Protocol::Server::ProfileInfo:
+                continue;
+
+            case Protocol::Server::Exception:
+                finished = true;
+                packet.exception->rethrow();
+                return;
+
+            case Protocol::Server::EndOfStream:
+                finished = true;
+                return;
+
+            default:
+                throw Exception("Unknown packet from server", ErrorCodes::UNKNOWN_PACKET_FROM_SERVER);
             }
         }
     }
+
+  private:
+    Connection *connection;
+    Block sample;
+    Block block;
+    bool finished = false;
+
+    ExpressionActionsPtr partition_expr;
+    Names partition_columns;
+
+    /// Scatter the block into one block per value of the partition key, keeping the order
+    /// of the rows. Keys are told apart by their hash; two partitions that collide only share
+    /// a block, which ClickHouse then splits.
+    void sendByPartition()
+    {
+        Block keys = block;
+        partition_expr->execute(keys);
+
+        ColumnRawPtrs key_columns;
+        for (const auto &name : partition_columns)
+            key_columns.push_back(keys.getByName(name).column.get());
+
+        size_t rows = block.rows();
+        IColumn::Selector selector(rows);
+        std::unordered_map<UInt64, size_t> partitions;
+        for (size_t row = 0; row < rows; ++row)
+        {
+            SipHash hash;
+            for (const auto *column : key_columns)
+                column->updateHashWithValue(row, hash);
+            selector[row] = partitions.emplace(hash.get64(), partitions.size()).first->second;
+        }
+
+        if (partitions.size() == 1)
+        {
+            connection->sendData(block);
+            return;
+        }
+
+        std::vector<Block> parts(partitions.size(), block.cloneEmpty());
+        for (size_t col = 0; col < block.columns(); ++col)
+        {
+            auto scattered = block.getByPosition(col).column->scatter(partitions.size(), selector);
+            for (size_t i = 0; i < parts.size(); ++i)
+                parts[i].getByPosition(col).column = std::move(scattered[i]);
+        }
+
+        for (auto &part : parts)
+            connection->sendData(part);
+    }
 };
+
+static bool startsWith(const String &s, const char *prefix)
+{
+    return s.compare(0, strlen(prefix), prefix) == 0;
 }
 
-std::vector<DB::Block> *mainEntryClickHouseClient(int argc, char **argv, char *sql)
+/// Parse the arguments of a type name like "Decimal(18, 4)".
+static std::vector<UInt64> typeArguments(const String &name)
 {
-    static bool firstRun = false;
-    static DB::Client client;
-    client.blocks = new std::vector<DB::Block>{};
+    std::vector<UInt64> args;
+    size_t pos = name.find('(');
+    while (pos != String::npos && pos + 1 < name.size())
+    {
+        args.push_back(std::strtoull(name.data() + pos + 1, nullptr, 10));
+        pos = name.find(',', pos + 1);
+    }
+    return args;
+}
 
-    try
+/// Decide how the values of a column are read, once per query.
+static void describeColumn(const IDataType &type, CHColumn &out)
+{
+    String name = type.getName();
+
+    out.kind = CH_UNSUPPORTED;
+    out.nullable = false;
+    out.scale = 0;
+    out.width = 0;
+
+    if (startsWith(name, "Nullable("))
+    {
+        out.nullable = true;
+        name = name.substr(strlen("Nullable("), name.size() - strlen("Nullable(") - 1);
+    }
+
+    static const std::unordered_map<String, CHColumnKind> simple_kinds = {
+        {"Int8", CH_INT8}, {"Int16", CH_INT16}, {"Int32", CH_INT32}, {"Int64", CH_INT64},
+        {"UInt8", CH_UINT8}, {"UInt16", CH_UINT16}, {"UInt32", CH_UINT32}, {"UInt64", CH_UINT64},
+        {"Float32", CH_FLOAT32}, {"Float64", CH_FLOAT64},
+        {"Date", CH_DATE}, {"DateTime", CH_DATETIME}, {"String", CH_STRING}, {"UUID", CH_UUID}};
+
+    auto it = simple_kinds.find(name);
+    if (it != simple_kinds.end())
+        out.kind = it->second;
+    else if (startsWith(name, "DateTime("))
+        out.kind = CH_DATETIME;
+    else if (startsWith(name, "DateTime64("))
+    {
+        out.kind = CH_DATETIME64;
+        out.scale = typeArguments(name).at(0);
+    }
+    else if (startsWith(name, "FixedString("))
+    {
+        out.kind = CH_FIXED_STRING;
+        out.width = typeArguments(name).at(0);
+    }
+    else if (startsWith(name, "Decimal"))
     {
-        if (!firstRun)
+        /// Decimal(P, S) is stored in the smallest integer that fits P digits.
+        auto args = typeArguments(name);
+        if (args.size() == 2)
         {
-            firstRun = false;
-            client.initStatic(argc, argv);
+            UInt64 precision = args[0];
+            out.scale = args[1];
+            out.kind = precision <= 9 ? CH_DECIMAL32 : precision <= 18 ? CH_DECIMAL64 : CH_DECIMAL128;
         }
-        client.initWorker(sql);
     }
-    catch (const boost::program_options::error &e)
+}
+
+/// Point the column description at the memory of the current block.
+static void exposeColumn(const IColumn &column, CHColumn &out)
+{
+    const IColumn *values = &column;
+
+    out.nullmap = nullptr;
+    out.data = nullptr;
+    out.offsets = nullptr;
+
+    if (out.nullable)
     {
-        std::cerr << "Bad arguments: " << e.what() << std::endl;
-        return nullptr;
+        const auto &nullable = typeid_cast<const ColumnNullable &>(column);
+        out.nullmap = &nullable.getNullMap()[0];
+        values = nullable.getNestedColumn().get();
     }
 
-    client.run();
-    return client.blocks;
+    if (out.kind == CH_UNSUPPORTED)
+        return;
+
+    out.data = values->getDataAt(0).data;
+    if (out.kind == CH_STRING)
+        out.offsets = (const uint64_t *)&typeid_cast<const ColumnString &>(*values).getOffsets()[0];
 }
 
-extern "C" void ExecuteCHQuery(char *cstrQuery)
+}
+
+/// Message of the last exception caught at the C boundary, reported by the caller with ereport.
+static std::string last_error;
+
+static int saveLastError()
+{
+    last_error = DB::getCurrentExceptionMessage(false);
+    return -1;
+}
+
+extern "C" const char *ch_last_error(void)
+{
+    return last_error.c_str();
+}
+
+/// The only client of the process, initialized by ch_init.
+static DB::Client &getClient()
+{
+    static DB::Client client;
+    return client;
+}
+
+/// Called from _PG_init. Returns -1 on error.
+extern "C" int ch_init(void)
 {
+    static bool initialized = false;
+    if (initialized)
+        return 0;
+
     try
     {
-        {
-            std::vector<std::string> arguments = {"", "--query", cstrQuery};
+        std::vector<std::string> arguments = {""};
 
-            std::vector<char *> argv;
-            for (const auto &arg : arguments)
-                argv.push_back((char *)arg.data());
-            argv.push_back(nullptr);
+        std::vector<char *> argv;
+        for (const auto &arg : arguments)
+            argv.push_back((char *)arg.data());
+        argv.push_back(nullptr);
 
-            mainEntryClickHouseClient(argv.size() - 1, argv.data(), cstrQuery);
-        }
+        getClient().initProcess(argv.size() - 1, argv.data());
+        initialized = true;
+        return 0;
+    }
+    catch (...)
+    {
+        return saveLastError();
+    }
+}
+
+DB::Client *mainEntryClickHouseClient(char *sql)
+{
+    DB::Client &client = getClient();
+    client.initWorker(sql);
+    return &client;
+}
+
+extern "C" void ExecuteCHQuery(char *cstrQuery)
+{
+    try
+    {
+        mainEntryClickHouseClient(cstrQuery)->runQuery();
     }
     catch (const Poco::Exception &e)
     {
@@ -1381,90 +2062,386 @@ extern "C" void ExecuteCHQuery(char *cstrQuery)
     }
 }
 
-extern "C" void begin_ch_query(CHReadCtx *ctx)
+static std::string trimSpaces(const std::string &str)
 {
+    size_t begin = str.find_first_not_of(" \t\n");
+    if (begin == std::string::npos)
+        return "";
+    return str.substr(begin, str.find_last_not_of(" \t\n") - begin + 1);
+}
+
+/// Apply a comma separated list of name=value pairs, throws on an unknown setting or a bad value.
+static void applySettings(DB::Settings &settings, const char *list)
+{
+    if (!list)
+        return;
+
+    std::string str(list);
+    size_t pos = 0;
+    while (pos <= str.size())
     {
-        std::vector<std::string> arguments = {"", "--query", ctx->sql};//, "--host", "olapdb-test02f.mail.yandex.net", "--user", "reader", "--password", ctx->password};
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos)
+            end = str.size();
 
-        std::vector<char *> argv;
-        for (const auto &arg : arguments)
-            argv.push_back((char *)arg.data());
-        argv.push_back(nullptr);
+        std::string item = trimSpaces(str.substr(pos, end - pos));
+        if (!item.empty())
+        {
+            size_t eq = item.find('=');
+            if (eq == std::string::npos)
+                throw DB::Exception("Setting " + item + " has no value", DB::ErrorCodes::BAD_ARGUMENTS);
+            settings.set(trimSpaces(item.substr(0, eq)), trimSpaces(item.substr(eq + 1)));
+        }
+        pos = end + 1;
+    }
+}
 
-        auto blocks = mainEntryClickHouseClient(argv.size() - 1, argv.data(), ctx->sql);
-        ctx->blocks = (void *)blocks;
-        ctx->blockRows = (*blocks)[0].rows();
-        std::stringstream *str_stream = new std::stringstream{};
-        ctx->streamPtr = (void *)str_stream;
-        ctx->writeBufferPtr = (void *)new DB::WriteBufferFromOStream(*str_stream);
+/// Check a list of settings as begin_ch_query applies it. Returns -1 on error.
+extern "C" int ch_check_settings(const char *settings)
+{
+    try
+    {
+        DB::Settings check;
+        applySettings(check, settings);
+        return 0;
     }
+    catch (...)
+    {
+        return saveLastError();
+    }
+}
+
+/// Settings of the client with the lists of a query applied in order.
+static DB::Settings querySettings(const char *const *lists, uint64_t max_block_size)
+{
+    DB::Settings settings = getClient().getSettings();
+    if (max_block_size)
+        settings.max_block_size = max_block_size;
+    for (size_t i = 0; i < CH_SETTINGS_LISTS; i++)
+        applySettings(settings, lists[i]);
+    return settings;
 }
 
-extern "C" void end_ch_query(CHReadCtx *ctx)
+extern "C" int begin_ch_query(CHReadCtx *ctx)
 {
+    try
+    {
+        auto stream = std::make_unique<DB::CHQueryStream>(*(DB::Connection *)ctx->conn);
+        stream->sendQuery(ctx->sql, querySettings(ctx->settings, ctx->maxBlockSize));
 
-    //std::cout<<"end call"<< ctx->currentRow <<std::endl;
-    auto blcs = (std::vector<DB::Block> *)ctx->blocks;
-    delete blcs;
+        ctx->stream = (void *)stream.release();
+        ctx->currentBlock = 0;
+        ctx->blockRows = 0;
+        ctx->currentRow = 0;
+        ctx->writtenRows = 0;
+        return 0;
+    }
+    catch (...)
+    {
+        return saveLastError();
+    }
 }
 
-extern "C" int read_ch_query(CHReadCtx *ctx)
+/// Safe to call several times: on normal completion and again from the error cleanup.
+/// Returns -1 if the connection lost sync with the server and must not be reused.
+extern "C" int end_ch_query(CHReadCtx *ctx)
+{
+    auto stream = (DB::CHQueryStream *)ctx->stream;
+    int res = 0;
+
+    if (stream)
+    {
+        try
+        {
+            stream->cancel();
+        }
+        catch (...)
+        {
+            res = saveLastError();
+        }
+        delete stream;
+        ctx->stream = nullptr;
+    }
+
+    return res;
+}
+
+/// Open a connection for the connection cache of the foreign data wrapper, NULL on error.
+extern "C" void *ch_connect(const CHConnOptions *opts)
+{
+    try
+    {
+        return (void *)getClient().openConnection(opts).release();
+    }
+    catch (...)
+    {
+        saveLastError();
+        return nullptr;
+    }
+}
+
+extern "C" void ch_disconnect(void *conn)
 {
-    //std::cout<<"read call"<< ctx->currentRow <<std::endl;
-    std::vector<DB::Block> &blcs = *((std::vector<DB::Block> *)ctx->blocks);
+    auto connection = (DB::Connection *)conn;
+
+    try
+    {
+        connection->disconnect();
+    }
+    catch (...)
+    {
+        /// Nothing to do about a broken socket.
+    }
+    delete connection;
+}
 
-    //todo: make block advancement repliable to zero length blocks
-    if (ctx->currentBlock >= blcs.size())
+/// Health check of an idle cached connection. Returns 1 if the server answered.
+extern "C" int ch_ping(void *conn)
+{
+    try
+    {
+        return ((DB::Connection *)conn)->ping() ? 1 : 0;
+    }
+    catch (...)
+    {
+        saveLastError();
         return 0;
+    }
+}
+
+/// Move to the next row, ctx->currentRow and ctx->columns then describe it.
+/// Returns 1 if a row was read, 0 at the end of the result and -1 on error.
+extern "C" int read_ch_query(CHReadCtx *ctx)
+{
+    auto &stream = *((DB::CHQueryStream *)ctx->stream);
 
-    while (ctx->currentRow >= ctx->blockRows)
+    try
     {
-        //std::cout<<"next block"<<std::endl;
-        ++(ctx->currentBlock);
-        ctx->currentRow = 0;
+        if (ctx->blockRows > 0)
+            ++(ctx->currentRow);
 
-        if (ctx->currentBlock >= blcs.size())
-            return 0;
-        ctx->blockRows = blcs[ctx->currentBlock].rows();
+        /// Blocks are pulled from the connection only when the previous one is exhausted.
+        while (ctx->currentRow >= ctx->blockRows)
+        {
+            if (!stream.nextBlock())
+            {
+                ctx->writtenRows = stream.writtenRows();
+                return 0;
+            }
+
+            const DB::Block &block = stream.currentBlock();
+            if (block.columns() < ctx->natts)
+                throw DB::Exception("Query returned " + DB::toString(block.columns()) + " columns, expected "
+                                    + DB::toString(ctx->natts), DB::ErrorCodes::BAD_ARGUMENTS);
+
+            for (size_t j = 0; j < ctx->natts; ++j)
+            {
+                const auto &col = block.getByPosition(j);
+                if (ctx->currentBlock == 0)
+                    DB::describeColumn(*col.type, ctx->columns[j]);
+                DB::exposeColumn(*col.column, ctx->columns[j]);
+            }
+
+            ++(ctx->currentBlock);
+            ctx->currentRow = 0;
+            ctx->blockRows = block.rows();
+        }
+    }
+    catch (...)
+    {
+        return saveLastError();
     }
 
-    //snprintf(ctx->tupleValues[0], 16, "%d", ctx->currentRow);
+    return 1;
+}
+
+/// Text of the value in the current row, NULL on error.
+extern "C" const char *ch_column_text(CHReadCtx *ctx, size_t col)
+{
+    auto &stream = *((DB::CHQueryStream *)ctx->stream);
 
-    std::stringstream &str_stream = *((std::stringstream *)ctx->streamPtr);
-    str_stream.seekg(0);
-    str_stream.seekp(0);
-    DB::WriteBufferFromOStream &out_buf = *((DB::WriteBufferFromOStream *)ctx->writeBufferPtr);
+    try
+    {
+        return stream.formatValue(col, ctx->currentRow);
+    }
+    catch (...)
+    {
+        saveLastError();
+        return nullptr;
+    }
+}
+
+/// Register the check of pending interrupts of the backend. Waits for the server
+/// call it every poll interval and cancel the query when it returns non-zero.
+extern "C" void ch_set_interrupt_check(int (*check)(void))
+{
+    interrupt_check = check;
+}
+
+/// Whether read_ch_query returns the next row without waiting for the server.
+extern "C" int ch_query_ready(CHReadCtx *ctx)
+{
+    auto &stream = *((DB::CHQueryStream *)ctx->stream);
+
+    if (ctx->blockRows > 0 && ctx->currentRow + 1 < ctx->blockRows)
+        return 1;
+    return stream.fetchReady() ? 1 : 0;
+}
+
+/// Start receiving the next block of the result in the background, once the
+/// rows of the current one are read. Returns a descriptor that becomes readable
+/// when ch_query_ready says so, -1 on error.
+extern "C" int ch_query_prefetch(CHReadCtx *ctx)
+{
+    try
+    {
+        return ((DB::CHQueryStream *)ctx->stream)->startFetch();
+    }
+    catch (...)
+    {
+        return saveLastError();
+    }
+}
 
-    for (size_t j = 0; j < ctx->natts; ++j)
+/// Send the INSERT and learn the structure of its columns. Returns -1 on error,
+/// the connection must not be reused then.
+extern "C" int begin_ch_insert(CHInsertCtx *ctx)
+{
+    try
     {
-        auto &col =
-            blcs[ctx->currentBlock].getByPosition(j);
+        auto stream = std::make_unique<DB::CHInsertStream>(*(DB::Connection *)ctx->conn);
+        stream->sendQuery(ctx->sql, querySettings(ctx->settings, 0));
+
+        const DB::Block &sample = stream->sampleBlock();
+        if (sample.columns() != ctx->natts)
+            throw DB::Exception("ClickHouse expects " + DB::toString(sample.columns()) + " columns, "
+                                + DB::toString(ctx->natts) + " are inserted", DB::ErrorCodes::BAD_ARGUMENTS);
+        for (size_t i = 0; i < ctx->natts; i++)
+            DB::describeColumn(*sample.getByPosition(i).type, ctx->columns[i]);
+
+        /// Grouping by partition only saves the server work, a key that cannot be
+        /// computed from the inserted columns (e.g. of a MATERIALIZED column) is dropped:
+        /// partitionKey is set to NULL and ch_last_error() tells why.
+        if (ctx->partitionKey && *ctx->partitionKey)
+        {
+            try
+            {
+                stream->setPartitionKey(getClient().getContext(), ctx->partitionKey);
+            }
+            catch (...)
+            {
+                saveLastError();
+                ctx->partitionKey = nullptr;
+            }
+        }
 
-        ctx->tupleValues[j] = out_buf.position();
-        //std::cout<<"serilalize begin: currentRow "<< ctx->currentRow << " block rows "<< blcs[ctx->currentBlock].rows() << std::endl;
-        col.type.get()->serializeTextEscaped(*col.column.get(), ctx->currentRow, out_buf);
-        //std::cout<<"serialize end" << std::endl;
+        ctx->stream = (void *)stream.release();
+        ctx->blockRows = 0;
+        ctx->blockBytes = 0;
+        return 0;
+    }
+    catch (...)
+    {
+        return saveLastError();
+    }
+}
 
-        if(ctx->tupleValues[j] == out_buf.position())
-            out_buf.write((char*)"null", 5);
+/// Append a value in the memory layout of the column kind: the number itself,
+/// or the characters of a String or FixedString.
+extern "C" int ch_insert_value(CHInsertCtx *ctx, size_t col, const void *data, size_t len)
+{
+    try
+    {
+        DB::IColumn &column = ((DB::CHInsertStream *)ctx->stream)->column(col);
 
+        if (ctx->columns[col].nullable)
+        {
+            auto &nullable = typeid_cast<DB::ColumnNullable &>(column);
+            nullable.getNestedColumn()->insertData((const char *)data, len);
+            nullable.getNullMap().push_back(0);
+        }
+        else
+            column.insertData((const char *)data, len);
 
-        *out_buf.position() = 0;
-        out_buf.position()++;
+        ctx->blockBytes += len;
+        return 0;
+    }
+    catch (...)
+    {
+        return saveLastError();
+    }
+}
 
+/// Append a value of any type from its text form.
+extern "C" int ch_insert_text(CHInsertCtx *ctx, size_t col, const char *text)
+{
+    try
+    {
+        ((DB::CHInsertStream *)ctx->stream)->insertText(col, text);
+        ctx->blockBytes += strlen(text);
+        return 0;
+    }
+    catch (...)
+    {
+        return saveLastError();
+    }
+}
 
-            //std::cout << ctx->tupleValues[j] << (int)(ctx->tupleValues[j] - ctx->tupleValues[0])<<'|';
-        //out_buf.next();
+/// The default of a Nullable column is NULL.
+extern "C" int ch_insert_null(CHInsertCtx *ctx, size_t col)
+{
+    try
+    {
+        ((DB::CHInsertStream *)ctx->stream)->column(col).insertDefault();
+        ctx->blockBytes += 1;
+        return 0;
+    }
+    catch (...)
+    {
+        return saveLastError();
     }
+}
 
-    //std::cout << std::endl;
-    //ctx->tupleValues[0] = (char*)"0";
+/// Send the block built so far, the server writes it as a part.
+extern "C" int flush_ch_insert(CHInsertCtx *ctx)
+{
+    try
+    {
+        ((DB::CHInsertStream *)ctx->stream)->flush();
+        ctx->blockRows = 0;
+        ctx->blockBytes = 0;
+        return 0;
+    }
+    catch (...)
+    {
+        return saveLastError();
+    }
+}
 
-    //std::cout<<ctx->tupleValues[0] << " str"<<std::endl;
-    //std::cout<< std::hex <<(uint64_t)(ctx->tupleValues[0]) << " ptr"<<std::endl;
+/// Send the rest of the data and wait until the server has written it.
+/// Returns -1 on error, the connection must not be reused then.
+extern "C" int end_ch_insert(CHInsertCtx *ctx)
+{
+    auto stream = (DB::CHInsertStream *)ctx->stream;
+    int res = 0;
 
-    ctx->currentRow++;
-    //std::cout<<"end of read call" << std::endl;
+    try
+    {
+        stream->finish();
+    }
+    catch (...)
+    {
+        res = saveLastError();
+    }
+    delete stream;
+    ctx->stream = nullptr;
+    return res;
+}
 
-    return 1;
+/// Drop an INSERT that failed on the PostgreSQL side. The server has not seen the end
+/// of the data and discards it when the connection, which must not be reused, is closed.
+extern "C" void abort_ch_insert(CHInsertCtx *ctx)
+{
+    delete (DB::CHInsertStream *)ctx->stream;
+    ctx->stream = nullptr;
 }
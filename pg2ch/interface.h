@@ -1,37 +1,193 @@
+#ifndef CLICKHOUSE_FDW_INTERFACE_H
+#define CLICKHOUSE_FDW_INTERFACE_H
 
+#include <stddef.h>
+#include <stdint.h>
 
+/*
+ * Kinds of ClickHouse columns whose values are read directly from the
+ * column memory. Everything else goes through the text representation.
+ */
+typedef enum CHColumnKind
+{
+    CH_UNSUPPORTED = 0,
+    CH_INT8,
+    CH_INT16,
+    CH_INT32,
+    CH_INT64,
+    CH_UINT8,
+    CH_UINT16,
+    CH_UINT32,
+    CH_UINT64,
+    CH_FLOAT32,
+    CH_FLOAT64,
+    CH_DATE,        /* UInt16, days since 1970-01-01 */
+    CH_DATETIME,    /* UInt32, seconds since the epoch */
+    CH_DATETIME64,  /* Int64, ticks of 10^-scale seconds since the epoch */
+    CH_STRING,
+    CH_FIXED_STRING,
+    CH_DECIMAL32,
+    CH_DECIMAL64,
+    CH_DECIMAL128,
+    CH_UUID         /* UInt128, high and low halves of the text form */
+} CHColumnKind;
 
+/*
+ * A column of the current block. The kind is determined once per query from
+ * the first block, the pointers are refreshed for every block.
+ */
+typedef struct CHColumn
+{
+    CHColumnKind kind;
+    bool nullable;
+    int scale;                  /* Decimal, DateTime64 */
+    size_t width;               /* FixedString(N) */
 
+    const void *data;           /* values, characters of String and FixedString */
+    const uint64_t *offsets;    /* String: end of each value including the terminating zero */
+    const uint8_t *nullmap;     /* Nullable: non-zero for NULL */
+} CHColumn;
 
+/*
+ * Connection parameters of a foreign server and user mapping. NULL strings
+ * and zero numbers leave the value of the client configuration.
+ */
+typedef struct CHConnOptions
+{
+    const char *host;
+    int port;
+    const char *database;
+    const char *user;
+    const char *password;
+    int compression;        /* 1 on, 0 off, -1 as configured */
+    int connect_timeout;    /* seconds */
+    int receive_timeout;
+    int send_timeout;
+} CHConnOptions;
+
+/* settings of the server, the foreign table and the session, in this order */
+#define CH_SETTINGS_LISTS 3
 
 typedef struct CHReadCtx{
     char* sql;
-    void* blocks;
-    void* streamPtr;
-    void* writeBufferPtr;
-    char** tupleValues;
+    void* conn;    /* connection from the cache, busy while the query is streamed */
+    void* stream;  /* query being streamed on conn, holds the current block */
+    CHColumn *columns;  /* natts entries, allocated by the caller */
     size_t natts;
 
     uint32_t currentBlock;
     uint32_t blockRows;
-    uint32_t currentRow;
+    uint32_t currentRow;    /* row of the current block returned by the last read */
+    uint64_t writtenRows;   /* rows the server reported written, set at the end of the result */
+    uint64_t maxBlockSize;  /* rows of a block ClickHouse sends, 0 for the default */
+    const char *settings[CH_SETTINGS_LISTS];    /* "name=value,..." lists applied to
+                                                 * the query, later ones win, NULL for none */
     char *password;
 } CHReadCtx;
 
+/*
+ * INSERT sent with the native protocol. Values are appended column by column
+ * to a block that is sent when the caller flushes it, ClickHouse writes a
+ * part for every block it receives.
+ */
+typedef struct CHInsertCtx{
+    char* sql;     /* INSERT INTO t (columns) VALUES, without data */
+    void* conn;    /* connection from the cache, busy until the INSERT ends */
+    void* stream;  /* INSERT in progress on conn, holds the block being built */
+    CHColumn *columns;  /* natts entries, allocated by the caller, only the kinds are set */
+    size_t natts;
+    const char *settings[CH_SETTINGS_LISTS];
+    const char *partitionKey;   /* rows of a block are sent grouped by it, NULL or empty for none;
+                                   begin_ch_insert sets it to NULL if it cannot be used */
+
+    uint64_t blockRows;     /* complete rows of the block, counted by the caller */
+    uint64_t blockBytes;    /* approximate size of the values of the block */
+} CHInsertCtx;
+
 #ifdef INTERFACE_C_LINKAGE
+extern "C" int ch_init(void);
+
+extern "C" void ch_set_interrupt_check(int (*check)(void));
+
 extern "C" void ExecuteCHQuery(char *cstrQuery);
 
-extern "C" void begin_ch_query(CHReadCtx *ctx);
+extern "C" int begin_ch_query(CHReadCtx *ctx);
 
-extern "C" void end_ch_query(CHReadCtx *ctx);
+extern "C" int end_ch_query(CHReadCtx *ctx);
 
 extern "C" int read_ch_query(CHReadCtx *ctx);
+
+extern "C" const char *ch_column_text(CHReadCtx *ctx, size_t col);
+
+extern "C" int ch_query_ready(CHReadCtx *ctx);
+
+extern "C" int ch_query_prefetch(CHReadCtx *ctx);
+
+extern "C" int begin_ch_insert(CHInsertCtx *ctx);
+
+extern "C" int ch_insert_value(CHInsertCtx *ctx, size_t col, const void *data, size_t len);
+
+extern "C" int ch_insert_text(CHInsertCtx *ctx, size_t col, const char *text);
+
+extern "C" int ch_insert_null(CHInsertCtx *ctx, size_t col);
+
+extern "C" int flush_ch_insert(CHInsertCtx *ctx);
+
+extern "C" int end_ch_insert(CHInsertCtx *ctx);
+
+extern "C" void abort_ch_insert(CHInsertCtx *ctx);
+
+extern "C" const char *ch_last_error(void);
+
+extern "C" int ch_check_settings(const char *settings);
+
+extern "C" void *ch_connect(const CHConnOptions *opts);
+
+extern "C" void ch_disconnect(void *conn);
+
+extern "C" int ch_ping(void *conn);
 #else
+extern int ch_init(void);
+
+extern void ch_set_interrupt_check(int (*check)(void));
+
 extern void ExecuteCHQuery(char *cstrQuery);
 
-extern void begin_ch_query(CHReadCtx *ctx);
+extern int begin_ch_query(CHReadCtx *ctx);
 
-extern void end_ch_query(CHReadCtx *ctx);
+extern int end_ch_query(CHReadCtx *ctx);
 
 extern int read_ch_query(CHReadCtx *ctx);
+
+extern const char *ch_column_text(CHReadCtx *ctx, size_t col);
+
+extern int ch_query_ready(CHReadCtx *ctx);
+
+extern int ch_query_prefetch(CHReadCtx *ctx);
+
+extern int begin_ch_insert(CHInsertCtx *ctx);
+
+extern int ch_insert_value(CHInsertCtx *ctx, size_t col, const void *data, size_t len);
+
+extern int ch_insert_text(CHInsertCtx *ctx, size_t col, const char *text);
+
+extern int ch_insert_null(CHInsertCtx *ctx, size_t col);
+
+extern int flush_ch_insert(CHInsertCtx *ctx);
+
+extern int end_ch_insert(CHInsertCtx *ctx);
+
+extern void abort_ch_insert(CHInsertCtx *ctx);
+
+extern const char *ch_last_error(void);
+
+extern int ch_check_settings(const char *settings);
+
+extern void *ch_connect(const CHConnOptions *opts);
+
+extern void ch_disconnect(void *conn);
+
+extern int ch_ping(void *conn);
 #endif
+
+#endif /* CLICKHOUSE_FDW_INTERFACE_H */
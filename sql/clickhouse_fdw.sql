@@ -37,4 +37,8 @@ CREATE OR REPLACE FUNCTION retcomposite(IN integer, IN integer,
 CREATE OR REPLACE FUNCTION ch_execute(text,text)
     RETURNS SETOF record
     AS 'MODULE_PATHNAME', 'ch_execute'
-    LANGUAGE C IMMUTABLE STRICT;
\ No newline at end of file
+    LANGUAGE C IMMUTABLE STRICT;
+CREATE FUNCTION clickhouse_import_stats(regclass)
+    RETURNS void
+    AS 'MODULE_PATHNAME', 'clickhouse_import_stats'
+    LANGUAGE C STRICT;
@@ -16,18 +16,73 @@
 
 #include "postgres.h"
 
+#include "access/htup_details.h"
 #include "access/reloptions.h"
+#include "access/sysattr.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_foreign_server.h"
+#include "catalog/pg_foreign_table.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_type.h"
+#include "catalog/pg_user_mapping.h"
+#include "commands/defrem.h"
+#include "commands/explain.h"
+#include "commands/vacuum.h"
+#if (PG_VERSION_NUM >= 140000)
+#include "executor/execAsync.h"
+#endif
+#include "executor/executor.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/cost.h"
 #include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
 #include "optimizer/planmain.h"
 #include "optimizer/restrictinfo.h"
+#include "optimizer/tlist.h"
+#if (PG_VERSION_NUM >= 140000)
+#include "optimizer/appendinfo.h"
+#endif
+#if (PG_VERSION_NUM >= 120000)
+#include "optimizer/optimizer.h"
+#else
+#include "optimizer/var.h"
+#endif
 #include "funcapi.h"
+#include "miscadmin.h"
+#if PG_VERSION_NUM >= 160000
+#include "parser/parse_relation.h"
+#endif
+#include "parser/parsetree.h"
+#include "port/atomics.h"
+#include "storage/latch.h"
+#if (PG_VERSION_NUM >= 180000)
+#include "storage/waiteventset.h"
+#endif
+#include "utils/acl.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/selfuncs.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
 #include "utils/varlena.h"
-#include "../pg2ch/interface.h"
+#include "clickhouse_fdw.h"
 
 PG_MODULE_MAGIC;
 
+void		_PG_init(void);
+
+static int	chfdw_interrupt_pending(void);
+
 /*
  * SQL functions
  */
@@ -70,6 +125,14 @@ static ForeignScan *clickhouseGetForeignPlan(PlannerInfo *root,
 static FdwPlan *clickhousePlanForeignScan(Oid foreigntableid, PlannerInfo *root, RelOptInfo *baserel);
 #endif
 
+#if (PG_VERSION_NUM >= 110000)
+static void clickhouseGetForeignUpperPaths(PlannerInfo *root,
+							   UpperRelationKind stage,
+							   RelOptInfo *input_rel,
+							   RelOptInfo *output_rel,
+							   void *extra);
+#endif
+
 static void clickhouseBeginForeignScan(ForeignScanState *node,
 						  int eflags);
 
@@ -79,6 +142,41 @@ static void clickhouseReScanForeignScan(ForeignScanState *node);
 
 static void clickhouseEndForeignScan(ForeignScanState *node);
 
+static void clickhouseScanCleanup(void *arg);
+
+#if (PG_VERSION_NUM >= 140000)
+static bool clickhouseIsForeignPathAsyncCapable(ForeignPath *path);
+
+static void clickhouseForeignAsyncRequest(AsyncRequest *areq);
+
+static void clickhouseForeignAsyncConfigureWait(AsyncRequest *areq);
+
+static void clickhouseForeignAsyncNotify(AsyncRequest *areq);
+#endif
+
+#if (PG_VERSION_NUM >= 110000)
+static bool clickhouseIsForeignScanParallelSafe(PlannerInfo *root,
+									RelOptInfo *rel,
+									RangeTblEntry *rte);
+
+static Size clickhouseEstimateDSMForeignScan(ForeignScanState *node,
+								 ParallelContext *pcxt);
+
+static void clickhouseInitializeDSMForeignScan(ForeignScanState *node,
+								   ParallelContext *pcxt,
+								   void *coordinate);
+
+static void clickhouseReInitializeDSMForeignScan(ForeignScanState *node,
+									 ParallelContext *pcxt,
+									 void *coordinate);
+
+static void clickhouseInitializeWorkerForeignScan(ForeignScanState *node,
+									  shm_toc *toc,
+									  void *coordinate);
+#endif
+
+static void estimate_path_cost_size(PlannerInfo *root, RelOptInfo *foreignrel);
+
 #if (PG_VERSION_NUM >= 90300)
 static void clickhouseAddForeignUpdateTargets(Query *parsetree,
 								 RangeTblEntry *target_rte,
@@ -113,6 +211,46 @@ static TupleTableSlot *clickhouseExecForeignDelete(EState *estate,
 static void clickhouseEndForeignModify(EState *estate,
 						  ResultRelInfo *rinfo);
 
+static void clickhouseModifyCleanup(void *arg);
+
+#if (PG_VERSION_NUM >= 90600)
+static bool clickhousePlanDirectModify(PlannerInfo *root,
+						   ModifyTable *plan,
+						   Index resultRelation,
+						   int subplan_index);
+
+static void clickhouseBeginDirectModify(ForeignScanState *node, int eflags);
+
+static TupleTableSlot *clickhouseIterateDirectModify(ForeignScanState *node);
+
+static void clickhouseEndDirectModify(ForeignScanState *node);
+
+static void clickhouseExplainDirectModify(ForeignScanState *node,
+							 struct ExplainState *es);
+#endif
+
+#if (PG_VERSION_NUM >= 140000)
+static TupleTableSlot **clickhouseExecForeignBatchInsert(EState *estate,
+								ResultRelInfo *rinfo,
+								TupleTableSlot **slots,
+								TupleTableSlot **planSlots,
+								int *numSlots);
+
+static int	clickhouseGetForeignModifyBatchSize(ResultRelInfo *rinfo);
+
+static void clickhouseExecForeignTruncate(List *rels,
+							  DropBehavior behavior,
+							  bool restart_seqs);
+#endif
+
+#if (PG_VERSION_NUM >= 110000)
+static void clickhouseBeginForeignInsert(ModifyTableState *mtstate,
+							ResultRelInfo *rinfo);
+
+static void clickhouseEndForeignInsert(EState *estate,
+						  ResultRelInfo *rinfo);
+#endif
+
 static int	clickhouseIsForeignRelUpdatable(Relation rel);
 
 #endif
@@ -159,9 +297,6 @@ static List *clickhouseImportForeignSchema(ImportForeignSchemaStmt *stmt,
 
 /*
  * structures used by the FDW
- *
- * These next structures are not actually used by clickhouse,but something like
- * them will be needed by anything more complicated that does actual work.
  */
 
 /*
@@ -173,15 +308,106 @@ struct clickhouseFdwOption
 	Oid			optcontext;		/* Oid of catalog in which option may appear */
 };
 
+static const struct clickhouseFdwOption valid_options[] =
+{
+	/* connection, the ClickHouse client configuration fills in the rest */
+	{"host", ForeignServerRelationId},
+	{"port", ForeignServerRelationId},
+	{"database", ForeignServerRelationId},
+	{"compression", ForeignServerRelationId},
+	{"connect_timeout", ForeignServerRelationId},
+	{"receive_timeout", ForeignServerRelationId},
+	{"send_timeout", ForeignServerRelationId},
+	{"user", UserMappingRelationId},
+	{"password", UserMappingRelationId},
+
+	/* rows per block ClickHouse sends, fetch_size for scans */
+	{"max_block_size", ForeignServerRelationId},
+	{"max_block_size", ForeignTableRelationId},
+	{"fetch_size", ForeignServerRelationId},
+	{"fetch_size", ForeignTableRelationId},
+
+	/* bytes of a block sent by INSERT, which is also sent at max_block_size rows */
+	{"max_block_bytes", ForeignServerRelationId},
+	{"max_block_bytes", ForeignTableRelationId},
+
+	/* rows the executor hands to a batch insert at once */
+	{"batch_size", ForeignServerRelationId},
+	{"batch_size", ForeignTableRelationId},
+
+	/* ClickHouse settings of the queries, as name=value,... */
+	{"settings", ForeignServerRelationId},
+	{"settings", ForeignTableRelationId},
+
+	/* ask ClickHouse for the size of a table when planning a scan of it */
+	{"use_remote_estimate", ForeignServerRelationId},
+	{"use_remote_estimate", ForeignTableRelationId},
+
+	/* scans of the table run concurrently with others under an Append */
+	{"async_capable", ForeignServerRelationId},
+	{"async_capable", ForeignTableRelationId},
+
+	/* database of the remote table, the current one of the connection if not set */
+	{"database", ForeignTableRelationId},
+
+	/* name of the remote table, that of the foreign table if not set */
+	{"table", ForeignTableRelationId},
+
+	/* sorting key of a MergeTree table, set by IMPORT FOREIGN SCHEMA */
+	{"sorting_key", ForeignTableRelationId},
+
+	{NULL, InvalidOid}
+};
+
 /*
- * The plan state is set up in clickhouseGetForeignRelSize and stashed away in
- * baserel->fdw_private and fetched in clickhouseGetForeignPaths.
+ * The plan state, ClickhouseFdwPlanState, is declared in clickhouse_fdw.h
+ * since the deparser needs it too.
  */
-typedef struct
+
+/* cost of starting a remote query, and of transferring one row from it */
+#define DEFAULT_FDW_STARTUP_COST	100.0
+#define DEFAULT_FDW_TUPLE_COST		0.01
+
+/* additional cost of a remote query that sorts its result */
+#define DEFAULT_FDW_SORT_MULTIPLIER 1.2
+
+#ifndef RINFO_IS_PUSHED_DOWN
+#define RINFO_IS_PUSHED_DOWN(rinfo, joinrelids) ((rinfo)->is_pushed_down)
+#endif
+
+/*
+ * Indexes of the items of the fdw_private list of a ForeignPath. Paths
+ * without one neither limit their result.
+ */
+enum FdwPathPrivateIndex
+{
+	FdwPathPrivateHasLimit,		/* LIMIT and OFFSET of the query are remote */
+	FdwPathPrivateSampled		/* a partial scan splits the table with SAMPLE */
+};
+
+/*
+ * Indexes of the items of the fdw_private list of a ForeignScan node,
+ * set up in clickhouseGetForeignPlan.
+ */
+enum FdwScanPrivateIndex
+{
+	/* SQL statement to execute remotely (as a String node) */
+	FdwScanPrivateSelectSql,
+	/* Integer list of attribute numbers retrieved by the SELECT */
+	FdwScanPrivateRetrievedAttrs,
+	/* SELECTs of the chunks of a parallel scan (String nodes), else NIL */
+	FdwScanPrivateChunkSqls
+};
+
+/*
+ * Shared state of a parallel scan, in the dynamic shared memory of the
+ * query. Every participant claims the next chunk of the table that nobody
+ * has read yet, so chunks of workers that do not start are read by others.
+ */
+typedef struct ChParallelScan
 {
-	char	   *foo;
-	int			bar;
-} ClickhouseFdwPlanState;
+	pg_atomic_uint32 next_chunk;
+} ChParallelScan;
 
 /*
  * The scan state is for maintaining state for a scan, eiher for a
@@ -190,11 +416,27 @@ typedef struct
  * It is set up in clickhouseBeginForeignScan and stashed in node->fdw_state
  * and subsequently used in clickhouseIterateForeignScan,
  * clickhouseEndForeignScan and clickhouseReScanForeignScan.
+ *
+ * Rows are converted straight from the block currently held by the reader,
+ * the remote query is only sent on the first call of IterateForeignScan.
  */
 typedef struct
 {
-	char	   *baz;
-	int			blurfl;
+	CHReadCtx	read;			/* remote query and its current block */
+	UserMapping *user;			/* user mapping the connection is for */
+	ChConnection *conn;			/* busy while the query is streamed */
+	List	   *retrieved_attrs;	/* attnums of the result columns */
+	ChConverter *convs;			/* chosen once the first block arrived */
+	MemoryContext scan_cxt;		/* context living as long as the scan */
+
+	/* parallel scan */
+	List	   *chunk_sqls;		/* queries of the chunks of the table */
+	ChParallelScan *pscan;		/* NULL unless run by parallel participants */
+
+	/* asynchronous scan under an Append */
+	bool		async;			/* rows are returned only once they arrived */
+	bool		eof;			/* the whole result has been returned */
+	int			fetch_fd;		/* readable when the next block is there */
 } ClickhouseFdwScanState;
 
 /*
@@ -207,10 +449,144 @@ typedef struct
  */
 typedef struct
 {
-	char	   *chimp;
-	int			chump;
+	CHInsertCtx insert;			/* remote INSERT and the block being built */
+	UserMapping *user;			/* user mapping the connection is for */
+	ChConnection *conn;			/* busy from the first row to the end */
+	TupleDesc	tupdesc;
+	List	   *target_attrs;	/* attnums of the inserted columns */
+	ChInserter *inserters;		/* chosen once ClickHouse described the
+								 * columns */
+	uint64		block_rows;		/* a block is sent once it has this many
+								 * rows */
+	uint64		block_bytes;	/* or this many bytes */
+	Oid			relid;			/* of the table, for its cached partition key */
+	char	   *partition_sql;	/* query for the partition key of the table */
+	MemoryContext temp_cxt;		/* reset for every row */
+	MemoryContext modify_cxt;	/* context living as long as the
+								 * modification */
 } ClickhouseFdwModifyState;
 
+/*
+ * Indexes of the items of the fdw_private list of a foreign table
+ * modification, set up in clickhousePlanForeignModify. UPDATE and DELETE
+ * have none.
+ */
+enum FdwModifyPrivateIndex
+{
+	/* INSERT statement without its data (as a String node) */
+	FdwModifyPrivateInsertSql,
+	/* Integer list of the attribute numbers of the inserted columns */
+	FdwModifyPrivateTargetAttrs
+};
+
+/*
+ * The direct modify state of an UPDATE or DELETE run as one ClickHouse
+ * mutation, or of an INSERT ... SELECT run by ClickHouse. It is set up in
+ * clickhouseBeginDirectModify and the statement is sent by the first call
+ * of clickhouseIterateDirectModify.
+ */
+typedef struct
+{
+	UserMapping *user;			/* user mapping the mutation is sent as */
+	const char *settings[CH_SETTINGS_LISTS];
+	char	   *sql;			/* ALTER TABLE ... UPDATE or DELETE, or
+								 * INSERT ... SELECT */
+	bool		set_processed;	/* count the rows into es_processed */
+	bool		done;
+} ClickhouseFdwDirectModifyState;
+
+/*
+ * Indexes of the items of the fdw_private list of a ForeignScan node of an
+ * UPDATE, DELETE or INSERT ... SELECT, set up in clickhousePlanDirectModify.
+ */
+enum FdwDirectModifyPrivateIndex
+{
+	/* mutation to execute remotely (as a String node) */
+	FdwDirectModifyPrivateUpdateSql,
+	/* Integer, set if es_processed is to be counted */
+	FdwDirectModifyPrivateSetProcessed,
+	/* qualified name of the table an INSERT writes to, "" otherwise */
+	FdwDirectModifyPrivateTarget
+};
+
+/* size of the blocks of an INSERT without max_block_size and max_block_bytes */
+#define CH_INSERT_BLOCK_ROWS	1048576
+#define CH_INSERT_BLOCK_BYTES	(64 * 1024 * 1024)
+
+/* slots of a batch insert without batch_size */
+#define CH_INSERT_BATCH_SIZE	1000
+
+/* GUC: ClickHouse settings of the queries of the session */
+static char *chfdw_settings = NULL;
+
+static bool
+chfdw_check_settings(char **newval, void **extra, GucSource source)
+{
+	if (*newval != NULL && ch_check_settings(*newval) < 0)
+	{
+		GUC_check_errdetail("%s", ch_last_error());
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+	DefineCustomIntVariable("clickhouse_fdw.idle_timeout",
+							"Time an unused ClickHouse connection is kept open.",
+							"Zero keeps idle connections for the life of the backend.",
+							&chfdw_idle_timeout,
+							300,
+							0,
+							INT_MAX / 1000,
+							PGC_USERSET,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomStringVariable("clickhouse_fdw.settings",
+							   "ClickHouse settings sent with every remote query.",
+							   "A comma separated list of name=value pairs. They "
+							   "override the settings option of foreign servers "
+							   "and tables.",
+							   &chfdw_settings,
+							   "",
+							   PGC_USERSET,
+							   0,
+							   chfdw_check_settings,
+							   NULL,
+							   NULL);
+
+	/*
+	 * Set up the ClickHouse client runtime (settings, function registries,
+	 * time zone tables) once per process. Loaded through
+	 * shared_preload_libraries this runs in the postmaster, and backends
+	 * share the result copy-on-write instead of each building their own.
+	 */
+	if (ch_init() < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("could not initialize the ClickHouse client"),
+				 errdetail_internal("%s", ch_last_error())));
+
+	ch_set_interrupt_check(chfdw_interrupt_pending);
+}
+
+/*
+ * Whether the backend has an interrupt to service. The ClickHouse client
+ * calls this while it waits for the server, and cancels the remote query if
+ * so; the caller then runs CHECK_FOR_INTERRUPTS.
+ */
+static int
+chfdw_interrupt_pending(void)
+{
+	return InterruptPending ? 1 : 0;
+}
 
 Datum
 clickhouse_fdw_handler(PG_FUNCTION_ARGS)
@@ -243,6 +619,23 @@ clickhouse_fdw_handler(PG_FUNCTION_ARGS)
 	fdwroutine->ReScanForeignScan = clickhouseReScanForeignScan; /* S */
 	fdwroutine->EndForeignScan = clickhouseEndForeignScan;		/* S U D */
 
+#if (PG_VERSION_NUM >= 110000)
+	/* support for parallel scans */
+	fdwroutine->IsForeignScanParallelSafe = clickhouseIsForeignScanParallelSafe;
+	fdwroutine->EstimateDSMForeignScan = clickhouseEstimateDSMForeignScan;
+	fdwroutine->InitializeDSMForeignScan = clickhouseInitializeDSMForeignScan;
+	fdwroutine->ReInitializeDSMForeignScan = clickhouseReInitializeDSMForeignScan;
+	fdwroutine->InitializeWorkerForeignScan = clickhouseInitializeWorkerForeignScan;
+#endif
+
+#if (PG_VERSION_NUM >= 140000)
+	/* support for asynchronous execution */
+	fdwroutine->IsForeignPathAsyncCapable = clickhouseIsForeignPathAsyncCapable;
+	fdwroutine->ForeignAsyncRequest = clickhouseForeignAsyncRequest;
+	fdwroutine->ForeignAsyncConfigureWait = clickhouseForeignAsyncConfigureWait;
+	fdwroutine->ForeignAsyncNotify = clickhouseForeignAsyncNotify;
+#endif
+
 	/* remainder are optional - use NULL if not required */
 	/* support for insert / update / delete */
 #if (PG_VERSION_NUM >= 90300)
@@ -255,6 +648,26 @@ clickhouse_fdw_handler(PG_FUNCTION_ARGS)
 	fdwroutine->ExecForeignDelete = clickhouseExecForeignDelete; /* D */
 	fdwroutine->EndForeignModify = clickhouseEndForeignModify;	/* I U D */
 #endif
+#if (PG_VERSION_NUM >= 90600)
+	/* UPDATE and DELETE run as ClickHouse mutations */
+	fdwroutine->PlanDirectModify = clickhousePlanDirectModify;	/* U D */
+	fdwroutine->BeginDirectModify = clickhouseBeginDirectModify;	/* U D */
+	fdwroutine->IterateDirectModify = clickhouseIterateDirectModify; /* U D */
+	fdwroutine->EndDirectModify = clickhouseEndDirectModify;	/* U D */
+	fdwroutine->ExplainDirectModify = clickhouseExplainDirectModify;	/* EXPLAIN U D */
+#endif
+#if (PG_VERSION_NUM >= 140000)
+	fdwroutine->ExecForeignBatchInsert = clickhouseExecForeignBatchInsert;	/* I */
+	fdwroutine->GetForeignModifyBatchSize = clickhouseGetForeignModifyBatchSize;
+
+	/* support for TRUNCATE */
+	fdwroutine->ExecForeignTruncate = clickhouseExecForeignTruncate;
+#endif
+#if (PG_VERSION_NUM >= 110000)
+	/* support for COPY and routing into foreign partitions */
+	fdwroutine->BeginForeignInsert = clickhouseBeginForeignInsert;
+	fdwroutine->EndForeignInsert = clickhouseEndForeignInsert;
+#endif
 
 	/* support for EXPLAIN */
 	fdwroutine->ExplainForeignScan = clickhouseExplainForeignScan;		/* EXPLAIN S U D */
@@ -281,6 +694,11 @@ clickhouse_fdw_handler(PG_FUNCTION_ARGS)
 
 #endif
 
+#if (PG_VERSION_NUM >= 110000)
+	/* Support for aggregation on ClickHouse */
+	fdwroutine->GetForeignUpperPaths = clickhouseGetForeignUpperPaths;
+#endif
+
 
 	PG_RETURN_POINTER(fdwroutine);
 }
@@ -289,20 +707,539 @@ Datum
 clickhouse_fdw_validator(PG_FUNCTION_ARGS)
 {
 	List	   *options_list = untransformRelOptions(PG_GETARG_DATUM(0));
+	Oid			catalog = PG_GETARG_OID(1);
+	ListCell   *cell;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
 	/* make sure the options are valid */
+	foreach(cell, options_list)
+	{
+		DefElem    *def = (DefElem *) lfirst(cell);
+		const struct clickhouseFdwOption *opt;
+		StringInfoData buf;
+
+		for (opt = valid_options; opt->optname; opt++)
+		{
+			if (catalog == opt->optcontext &&
+				strcmp(opt->optname, def->defname) == 0)
+				break;
+		}
+
+		if (opt->optname == NULL)
+		{
+			initStringInfo(&buf);
+			for (opt = valid_options; opt->optname; opt++)
+			{
+				if (catalog == opt->optcontext)
+					appendStringInfo(&buf, "%s%s", (buf.len > 0) ? ", " : "",
+									 opt->optname);
+			}
+
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+					 errmsg("invalid option \"%s\"", def->defname),
+					 buf.len > 0
+					 ? errhint("Valid options in this context are: %s",
+							   buf.data)
+					 : errhint("There are no valid options in this context.")));
+		}
+
+		/* check the values too */
+		if (strcmp(def->defname, "settings") == 0)
+		{
+			if (ch_check_settings(defGetString(def)) < 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, defGetString(def)),
+						 errdetail_internal("%s", ch_last_error())));
+		}
+		else if (strcmp(def->defname, "use_remote_estimate") == 0 ||
+				 strcmp(def->defname, "async_capable") == 0 ||
+				 strcmp(def->defname, "compression") == 0)
+			(void) defGetBoolean(def);
+		else if (strcmp(def->defname, "port") == 0 ||
+				 strcmp(def->defname, "connect_timeout") == 0 ||
+				 strcmp(def->defname, "receive_timeout") == 0 ||
+				 strcmp(def->defname, "send_timeout") == 0 ||
+				 strcmp(def->defname, "max_block_size") == 0 ||
+				 strcmp(def->defname, "max_block_bytes") == 0 ||
+				 strcmp(def->defname, "batch_size") == 0 ||
+				 strcmp(def->defname, "fetch_size") == 0)
+		{
+			char	   *value = defGetString(def);
+			char	   *end;
+			long		number;
+
+			errno = 0;
+			number = strtol(value, &end, 10);
+			if (errno != 0 || end == value || *end != '\0' ||
+				number <= 0 || number > INT_MAX ||
+				(strcmp(def->defname, "port") == 0 && number > 65535))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("invalid value for option \"%s\": \"%s\"",
+								def->defname, value),
+						 strcmp(def->defname, "port") == 0
+						 ? errhint("A port number is between 1 and 65535.")
+						 : errhint("The value must be a positive integer.")));
+		}
+	}
 
-	/* no options are supported */
+	PG_RETURN_VOID();
+}
 
-	if (list_length(options_list) > 0)
-		ereport(ERROR,
-				(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-				 errmsg("invalid options"),
-				 errhint("Clickhouse FDW does not support any options")));
+/* sizes of tables reported by ClickHouse are reused for this long */
+#define CH_TABLE_SIZE_TTL_MS	60000
 
-	PG_RETURN_VOID();
+/*
+ * Size of the remote table of a foreign table, as ClickHouse last reported
+ * it. Entries live for the backend, an entry of a changed foreign table is
+ * only marked stale, so that it still serves when ClickHouse cannot be
+ * asked.
+ */
+typedef struct ChTableSize
+{
+	Oid			relid;			/* hash key (must be first) */
+	TimestampTz fetched;		/* zero when stale */
+	double		rows;
+	int			natts;
+	double	   *widths;			/* average bytes of each attribute, in
+								 * CacheMemoryContext */
+	bool		has_sampling_key;
+} ChTableSize;
+
+static HTAB *TableSizeHash = NULL;
+
+static void
+chfdw_table_size_inval_callback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS scan;
+	ChTableSize *entry;
+
+	hash_seq_init(&scan, TableSizeHash);
+	while ((entry = (ChTableSize *) hash_seq_search(&scan)))
+	{
+		if (relid == InvalidOid || entry->relid == relid)
+			entry->fetched = 0;
+	}
+}
+
+/*
+ * Whether the planner asks ClickHouse for the size of the table, as set
+ * for the foreign table or else for its server.
+ */
+static bool
+use_remote_estimate(ForeignTable *table)
+{
+	ForeignServer *server = GetForeignServer(table->serverid);
+	bool		result = false;
+	ListCell   *lc;
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "use_remote_estimate") == 0)
+			result = defGetBoolean(def);
+	}
+	foreach(lc, table->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "use_remote_estimate") == 0)
+			result = defGetBoolean(def);
+	}
+
+	return result;
+}
+
+/*
+ * Value of an option of the foreign table, or of its server if the table
+ * does not set it. NULL if neither does.
+ */
+static const char *
+get_table_option(ForeignTable *table, const char *name)
+{
+	ForeignServer *server = GetForeignServer(table->serverid);
+	List	   *lists[2];
+	int			i;
+
+	lists[0] = table->options;
+	lists[1] = server->options;
+
+	for (i = 0; i < lengthof(lists); i++)
+	{
+		ListCell   *lc;
+
+		foreach(lc, lists[i])
+		{
+			DefElem    *def = (DefElem *) lfirst(lc);
+
+			if (strcmp(def->defname, name) == 0)
+				return defGetString(def);
+		}
+	}
+
+	return NULL;
+}
+
+#if (PG_VERSION_NUM >= 140000)
+/*
+ * Whether scans of the foreign table may run asynchronously, as set for the
+ * table or else for its server.
+ */
+static bool
+is_async_capable(ForeignTable *table)
+{
+	const char *value = get_table_option(table, "async_capable");
+	bool		result = false;
+
+	if (value != NULL)
+		(void) parse_bool(value, &result);
+
+	return result;
+}
+#endif
+
+/*
+ * Rows per block ClickHouse sends for a scan of the foreign table: its
+ * fetch_size, else its max_block_size, each of the table overriding that of
+ * the server. Zero leaves the setting of the client configuration.
+ */
+static uint64
+get_fetch_size(ForeignTable *table)
+{
+	const char *value = get_table_option(table, "fetch_size");
+
+	if (value == NULL)
+		value = get_table_option(table, "max_block_size");
+
+	return value ? (uint64) strtol(value, NULL, 10) : 0;
+}
+
+/*
+ * Size of the blocks an INSERT into the foreign table sends. ClickHouse
+ * writes a part for every block, so they are made as large as memory
+ * allows.
+ */
+static void
+get_insert_block_size(ForeignTable *table, uint64 *rows, uint64 *bytes)
+{
+	const char *value;
+
+	value = get_table_option(table, "max_block_size");
+	*rows = value ? (uint64) strtol(value, NULL, 10) : CH_INSERT_BLOCK_ROWS;
+
+	value = get_table_option(table, "max_block_bytes");
+	*bytes = value ? (uint64) strtol(value, NULL, 10) : CH_INSERT_BLOCK_BYTES;
+}
+
+/*
+ * ClickHouse settings of a query on the foreign table: those of its
+ * server, of the table and of the session, later lists overriding earlier
+ * ones.
+ */
+static void
+get_query_settings(ForeignTable *table, const char **settings)
+{
+	ForeignServer *server = GetForeignServer(table->serverid);
+	List	   *lists[2];
+	int			i;
+
+	lists[0] = server->options;
+	lists[1] = table->options;
+
+	for (i = 0; i < lengthof(lists); i++)
+	{
+		ListCell   *lc;
+
+		settings[i] = NULL;
+		foreach(lc, lists[i])
+		{
+			DefElem    *def = (DefElem *) lfirst(lc);
+
+			if (strcmp(def->defname, "settings") == 0)
+				settings[i] = defGetString(def);
+		}
+	}
+	settings[2] = chfdw_settings;
+}
+
+/*
+ * Run a query for the planner and collect its rows, arrays of ncols
+ * strings with NULL for a NULL value. Returns false if ClickHouse could not
+ * be reached or could not run it; estimates then do without it.
+ */
+static bool
+fetch_remote_rows(UserMapping *user, char *sql, int ncols, List **rows)
+{
+	ChConnection *conn = chfdw_get_connection(user, true);
+	CHReadCtx	ctx;
+	int			rc = -1;
+
+	*rows = NIL;
+	if (conn == NULL)
+	{
+		elog(DEBUG1, "clickhouse_fdw: could not connect to run \"%s\": %s",
+			 sql, ch_last_error());
+		return false;
+	}
+
+	MemSet(&ctx, 0, sizeof(ctx));
+	ctx.sql = sql;
+	ctx.conn = conn->conn;
+	ctx.natts = ncols;
+	ctx.columns = palloc0(sizeof(CHColumn) * ncols);
+
+	if (begin_ch_query(&ctx) == 0)
+	{
+		while ((rc = read_ch_query(&ctx)) > 0)
+		{
+			char	  **values = palloc(sizeof(char *) * ncols);
+			int			i;
+
+			for (i = 0; i < ncols && rc > 0; i++)
+			{
+				CHColumn   *col = &ctx.columns[i];
+				const char *text;
+
+				if (col->nullable && col->nullmap[ctx.currentRow])
+					values[i] = NULL;
+				else if ((text = ch_column_text(&ctx, i)) == NULL)
+					rc = -1;
+				else
+					values[i] = pstrdup(text);
+			}
+			if (rc < 0)
+				break;
+
+			*rows = lappend(*rows, values);
+		}
+	}
+
+	if (rc < 0)
+	{
+		elog(DEBUG1, "clickhouse_fdw: could not run \"%s\": %s",
+			 sql, ch_last_error());
+		end_ch_query(&ctx);
+		chfdw_release_connection(conn, false);
+
+		/* a query cancelled for an interrupt is not a soft failure */
+		CHECK_FOR_INTERRUPTS();
+		return false;
+	}
+
+	chfdw_release_connection(conn, end_ch_query(&ctx) == 0);
+	return true;
+}
+
+/*
+ * Rows and column sizes of the remote table of a foreign table, from the
+ * parts of a MergeTree table, and whether it has a sampling key. They are
+ * fetched at most once in CH_TABLE_SIZE_TTL_MS, and when ClickHouse cannot
+ * tell, the last size it reported is used. Returns NULL if the size is not
+ * known.
+ */
+static ChTableSize *
+get_table_size(Relation rel, UserMapping *user)
+{
+	Oid			relid = RelationGetRelid(rel);
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	ChTableSize *entry;
+	StringInfoData sql;
+	List	   *rows;
+	ListCell   *lc;
+	double	   *widths;
+	double		total = 0;
+	bool		has_sampling_key = false;
+	bool		known;
+	bool		found;
+	int			i;
+
+	if (TableSizeHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(ChTableSize);
+		ctl.hcxt = CacheMemoryContext;
+		TableSizeHash = hash_create("clickhouse_fdw table sizes", 64, &ctl,
+									HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+		CacheRegisterRelcacheCallback(chfdw_table_size_inval_callback,
+									  (Datum) 0);
+	}
+
+	entry = hash_search(TableSizeHash, &relid, HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->fetched = 0;
+		entry->rows = 0;
+		entry->natts = 0;
+		entry->widths = NULL;
+		entry->has_sampling_key = false;
+	}
+
+	/* a size of the table as it is now declared */
+	known = entry->widths != NULL && entry->natts == tupdesc->natts;
+	if (known && entry->fetched != 0 &&
+		!TimestampDifferenceExceeds(entry->fetched, GetCurrentTimestamp(),
+									CH_TABLE_SIZE_TTL_MS))
+		return entry;
+
+	initStringInfo(&sql);
+	chfdw_deparse_table_size_sql(&sql, rel);
+	if (!fetch_remote_rows(user, sql.data, 4, &rows))
+		return known ? entry : NULL;
+
+	widths = MemoryContextAllocZero(CacheMemoryContext,
+									sizeof(double) * tupdesc->natts);
+	foreach(lc, rows)
+	{
+		char	  **values = (char **) lfirst(lc);
+
+		if (values[2] != NULL)
+			total = strtod(values[2], NULL);
+		has_sampling_key = values[3] != NULL && values[3][0] != '\0';
+
+		for (i = 0; i < tupdesc->natts; i++)
+		{
+			Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+			if (!attr->attisdropped && values[0] != NULL &&
+				values[1] != NULL &&
+				strcmp(NameStr(attr->attname), values[0]) == 0)
+				widths[i] = strtod(values[1], NULL);
+		}
+	}
+
+	/*
+	 * Tables of other engines, Distributed ones for one, have no parts.
+	 * Their size is as unknown as that of an empty table.
+	 */
+	if (total <= 0)
+	{
+		pfree(widths);
+		return known ? entry : NULL;
+	}
+
+	for (i = 0; i < tupdesc->natts; i++)
+		widths[i] /= total;
+
+	if (entry->widths != NULL)
+		pfree(entry->widths);
+	entry->widths = widths;
+	entry->natts = tupdesc->natts;
+	entry->rows = total;
+	entry->has_sampling_key = has_sampling_key;
+	entry->fetched = GetCurrentTimestamp();
+
+	return entry;
+}
+
+/*
+ * Partition key of the remote table of a foreign table, as ClickHouse last
+ * reported it. Entries live for the backend and are refetched after
+ * CH_TABLE_SIZE_TTL_MS or a change of the foreign table, like ChTableSize.
+ */
+typedef struct ChPartitionKey
+{
+	Oid			relid;			/* hash key (must be first) */
+	TimestampTz fetched;		/* zero when stale */
+	char	   *key;			/* in CacheMemoryContext, NULL if not known */
+} ChPartitionKey;
+
+static HTAB *PartitionKeyHash = NULL;
+
+static void
+chfdw_partition_key_inval_callback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS scan;
+	ChPartitionKey *entry;
+
+	hash_seq_init(&scan, PartitionKeyHash);
+	while ((entry = (ChPartitionKey *) hash_seq_search(&scan)))
+	{
+		if (relid == InvalidOid || entry->relid == relid)
+			entry->fetched = 0;
+	}
+}
+
+/*
+ * Partition key of the remote table of the foreign table relid, sql being
+ * the query for it. Empty for a table without one, NULL if ClickHouse could
+ * not tell.
+ */
+static const char *
+get_partition_key(Oid relid, UserMapping *user, char *sql)
+{
+	ChPartitionKey *entry;
+	List	   *rows;
+	bool		found;
+
+	if (PartitionKeyHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(ChPartitionKey);
+		ctl.hcxt = CacheMemoryContext;
+		PartitionKeyHash = hash_create("clickhouse_fdw partition keys", 64,
+									   &ctl,
+									   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+		CacheRegisterRelcacheCallback(chfdw_partition_key_inval_callback,
+									  (Datum) 0);
+	}
+
+	entry = hash_search(PartitionKeyHash, &relid, HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->fetched = 0;
+		entry->key = NULL;
+	}
+
+	if (entry->fetched != 0 &&
+		!TimestampDifferenceExceeds(entry->fetched, GetCurrentTimestamp(),
+									CH_TABLE_SIZE_TTL_MS))
+		return entry->key;
+
+	if (!fetch_remote_rows(user, sql, 1, &rows))
+		return entry->key;
+
+	if (entry->key != NULL)
+		pfree(entry->key);
+	entry->key = MemoryContextStrdup(CacheMemoryContext,
+									 rows != NIL && ((char **) linitial(rows))[0] ?
+									 ((char **) linitial(rows))[0] : "");
+	entry->fetched = GetCurrentTimestamp();
+
+	return entry->key;
+}
+
+/*
+ * Uncompressed size of the remote table of a foreign table in pages, or a
+ * page if it is not known.
+ */
+static BlockNumber
+get_table_pages(Relation rel, UserMapping *user)
+{
+	ChTableSize *size = get_table_size(rel, user);
+	double		width = 0;
+	int			i;
+
+	if (size == NULL)
+		return 1;
+
+	for (i = 0; i < size->natts; i++)
+		width += size->widths[i];
+	if (size->rows * width / BLCKSZ <= 1)
+		return 1;
+
+	return (BlockNumber) Min(size->rows * width / BLCKSZ,
+							 (double) MaxBlockNumber);
 }
 
 #if (PG_VERSION_NUM >= 90200)
@@ -329,17 +1266,313 @@ clickhouseGetForeignRelSize(PlannerInfo *root,
 	 */
 
 	ClickhouseFdwPlanState *plan_state;
+	ChTableSize *size = NULL;
+	Oid			userid;
+	ListCell   *lc;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
-	baserel->rows = 0;
-
 	plan_state = palloc0(sizeof(ClickhouseFdwPlanState));
+	plan_state->pushdown_safe = true;
+	plan_state->index_rows = -1;
 	baserel->fdw_private = (void *) plan_state;
 
-	/* initialize required state in plan_state */
+	/* the user the table is read as, as in clickhouseBeginForeignScan */
+#if PG_VERSION_NUM >= 160000
+	userid = OidIsValid(baserel->userid) ? baserel->userid : GetUserId();
+#else
+	{
+		RangeTblEntry *rte = planner_rt_fetch(baserel->relid, root);
+
+		userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+	}
+#endif
+	plan_state->table = GetForeignTable(foreigntableid);
+	plan_state->user = GetUserMapping(userid, plan_state->table->serverid);
+
+	/* decide which restriction clauses go into the remote WHERE */
+	chfdw_classify_conditions(root, baserel, baserel->baserestrictinfo,
+							  &plan_state->remote_conds,
+							  &plan_state->local_conds);
+
+	/*
+	 * Fetch only the columns the query output and the local conditions
+	 * refer to; ClickHouse does not even read the others.
+	 */
+#if (PG_VERSION_NUM >= 90600)
+	pull_varattnos((Node *) baserel->reltarget->exprs, baserel->relid,
+				   &plan_state->attrs_used);
+#else
+	pull_varattnos((Node *) baserel->reltargetlist, baserel->relid,
+				   &plan_state->attrs_used);
+#endif
+	foreach(lc, plan_state->local_conds)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		pull_varattnos((Node *) rinfo->clause, baserel->relid,
+					   &plan_state->attrs_used);
+	}
+
+	/*
+	 * Take the row count from ClickHouse if asked to. Otherwise, a table
+	 * that was never analyzed gets the default size postgres_fdw assumes,
+	 * ten pages worth of rows.
+	 */
+	if (use_remote_estimate(plan_state->table))
+	{
+		Relation	rel = table_open(foreigntableid, NoLock);
+
+		size = get_table_size(rel, plan_state->user);
+		table_close(rel, NoLock);
+	}
+
+	if (size != NULL)
+		baserel->tuples = size->rows;
+#if (PG_VERSION_NUM >= 140000)
+	else if (baserel->tuples < 0)
+#else
+	else if (baserel->pages == 0 && baserel->tuples == 0)
+#endif
+	{
+		baserel->pages = 10;
+		baserel->tuples = (10 * BLCKSZ) /
+#if (PG_VERSION_NUM >= 90600)
+			(baserel->reltarget->width + MAXALIGN(SizeofHeapTupleHeader));
+#else
+			(baserel->width + MAXALIGN(SizeofHeapTupleHeader));
+#endif
+	}
+	set_baserel_size_estimates(root, baserel);
+
+	if (size != NULL)
+	{
+		bool		whole_row;
+		double		width = 0;
+		int			i;
+
+		/* the bytes of the fetched columns, rather than of their types */
+		whole_row = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber,
+								  plan_state->attrs_used);
+		for (i = 0; i < size->natts; i++)
+		{
+			if (whole_row ||
+				bms_is_member(i + 1 - FirstLowInvalidHeapAttributeNumber,
+							  plan_state->attrs_used))
+				width += size->widths[i];
+		}
+		if (width > 0)
+#if (PG_VERSION_NUM >= 90600)
+			baserel->reltarget->width = (int) (width + 0.5);
+#else
+			baserel->width = (int) (width + 0.5);
+#endif
+
+		/*
+		 * ClickHouse reads only the granules its primary key and partitions
+		 * let through, and can tell how many rows they hold.
+		 */
+		if (plan_state->remote_conds != NIL)
+		{
+			StringInfoData sql;
+			List	   *retrieved_attrs;
+			List	   *rows;
+
+			initStringInfo(&sql);
+			appendStringInfoString(&sql, "EXPLAIN ESTIMATE ");
+			chfdw_deparse_select_sql(&sql, root, baserel, NIL,
+									 plan_state->remote_conds, NIL, false,
+									 &retrieved_attrs);
+			if (fetch_remote_rows(plan_state->user, sql.data, 5, &rows))
+			{
+				plan_state->index_rows = 0;
+				foreach(lc, rows)
+				{
+					char	  **values = (char **) lfirst(lc);
+
+					if (values[3] != NULL)
+						plan_state->index_rows += strtod(values[3], NULL);
+				}
+				baserel->rows = clamp_row_est(Min(baserel->rows,
+												  plan_state->index_rows));
+			}
+		}
+	}
+
+	estimate_path_cost_size(root, baserel);
+}
+
+/*
+ * Estimate the rows and the cost of computing a relation on ClickHouse and
+ * fetching the result, and store them in its plan state.
+ *
+ * ClickHouse reads only the columns it is asked for and filters and
+ * aggregates them in bulk, so a row it does not send costs a single
+ * operator evaluation. The rows it sends cost the transfer and the local
+ * conditions.
+ */
+static void
+estimate_path_cost_size(PlannerInfo *root, RelOptInfo *foreignrel)
+{
+	ClickhouseFdwPlanState *plan_state = foreignrel->fdw_private;
+	QualCost	local_cost;
+	Cost		startup_cost;
+	Cost		run_cost;
+
+	cost_qual_eval(&local_cost, plan_state->local_conds, root);
+
+	if (IS_UPPER_REL(foreignrel))
+	{
+		ClickhouseFdwPlanState *ofpinfo = plan_state->outerrel->fdw_private;
+		double		input_rows = ofpinfo->retrieved_rows;
+		double		num_groups = 1;
+		List	   *group_exprs;
+
+		group_exprs = get_sortgrouplist_exprs(root->parse->groupClause,
+											  plan_state->grouped_tlist);
+		if (group_exprs != NIL)
+			num_groups = estimate_num_groups(root, group_exprs, input_rows,
+#if (PG_VERSION_NUM >= 140000)
+											 NULL,
+#endif
+											 NULL);
+
+		plan_state->retrieved_rows =
+			clamp_row_est(num_groups *
+						  clauselist_selectivity(root, plan_state->remote_conds,
+												 0, JOIN_INNER, NULL));
+		plan_state->rows =
+			clamp_row_est(plan_state->retrieved_rows *
+						  clauselist_selectivity(root, plan_state->local_conds,
+												 0, JOIN_INNER, NULL));
+
+		/* nothing comes back before every input row is aggregated */
+		plan_state->remote_cost = ofpinfo->remote_cost +
+			cpu_operator_cost * input_rows *
+			list_length(plan_state->grouped_tlist);
+		startup_cost = DEFAULT_FDW_STARTUP_COST + plan_state->remote_cost;
+		run_cost = 0;
+	}
+	else if (IS_JOIN_REL(foreignrel))
+	{
+		ClickhouseFdwPlanState *ofpinfo = plan_state->outerrel->fdw_private;
+		ClickhouseFdwPlanState *ifpinfo = plan_state->innerrel->fdw_private;
+		Cost		build_cost;
+
+		plan_state->retrieved_rows = foreignrel->rows;
+		plan_state->rows = foreignrel->rows;
+
+		/*
+		 * ClickHouse builds a hash table of the right side first, then
+		 * streams the left side through it. Only the joined rows cross the
+		 * network.
+		 */
+		build_cost = ifpinfo->remote_cost +
+			cpu_operator_cost * ifpinfo->retrieved_rows;
+		plan_state->remote_cost = build_cost + ofpinfo->remote_cost +
+			cpu_operator_cost * (ofpinfo->retrieved_rows + foreignrel->rows);
+		startup_cost = DEFAULT_FDW_STARTUP_COST + build_cost;
+		run_cost = plan_state->remote_cost - build_cost;
+	}
+	else
+	{
+		double		read_rows = foreignrel->tuples;
+
+		if (plan_state->index_rows >= 0)
+			read_rows = Min(read_rows, plan_state->index_rows);
+
+		plan_state->retrieved_rows =
+			clamp_row_est(Min(read_rows,
+							  foreignrel->tuples *
+							  clauselist_selectivity(root,
+													 plan_state->remote_conds,
+													 foreignrel->relid,
+													 JOIN_INNER, NULL)));
+		plan_state->rows = foreignrel->rows;
+
+		/* rows are streamed while the table is read */
+		plan_state->remote_cost = cpu_operator_cost * read_rows;
+		startup_cost = DEFAULT_FDW_STARTUP_COST;
+		run_cost = plan_state->remote_cost;
+	}
+
+	startup_cost += local_cost.startup;
+	run_cost += (DEFAULT_FDW_TUPLE_COST + cpu_tuple_cost + local_cost.per_tuple) *
+		plan_state->retrieved_rows;
+
+	plan_state->startup_cost = startup_cost;
+	plan_state->total_cost = startup_cost + run_cost;
+}
+
+#if (PG_VERSION_NUM >= 110000)
+/*
+ * Add a partial path for a parallel scan of a foreign table, whose
+ * participants each read a chunk of the table at a time over connections
+ * of their own. It pays when converting the rows, not reading them on
+ * ClickHouse, is the work of the scan, so the workers are planned from the
+ * size of the fetched rows.
+ */
+static void
+add_partial_scan_path(PlannerInfo *root, RelOptInfo *baserel,
+					  Oid foreigntableid)
+{
+	ClickhouseFdwPlanState *plan_state = baserel->fdw_private;
+	ForeignPath *path;
+	ChTableSize *size;
+	Relation	rel;
+	double		pages;
+	double		divisor;
+	bool		sampled;
+	int			nworkers;
+
+	pages = plan_state->retrieved_rows * baserel->reltarget->width / BLCKSZ;
+	nworkers = compute_parallel_worker(baserel, pages, -1,
+									   max_parallel_workers_per_gather);
+	if (nworkers <= 0)
+		return;
+
+	rel = table_open(foreigntableid, NoLock);
+	size = get_table_size(rel, plan_state->user);
+	table_close(rel, NoLock);
+
+	/*
+	 * Without a sampling key the chunks are split by a hash of the fetched
+	 * columns, there must be some.
+	 */
+	sampled = size != NULL && size->has_sampling_key;
+	if (!sampled && bms_is_empty(plan_state->attrs_used))
+		return;
+
+	/* the share of the rows of each participant, as cost_seqscan has it */
+	divisor = nworkers;
+	if (parallel_leader_participation && 1.0 - 0.3 * nworkers > 0)
+		divisor += 1.0 - 0.3 * nworkers;
+
+	path = create_foreignscan_path(root, baserel,
+								   NULL,	/* default pathtarget */
+								   clamp_row_est(plan_state->rows / divisor),
+#if (PG_VERSION_NUM >= 180000)
+								   0,		/* no disabled plan nodes */
+#endif
+								   plan_state->startup_cost,
+								   plan_state->startup_cost +
+								   (plan_state->total_cost -
+									plan_state->startup_cost) / divisor,
+								   NIL,		/* no pathkeys */
+								   NULL,	/* no outer rel either */
+								   NULL,	/* no extra plan */
+#if (PG_VERSION_NUM >= 170000)
+								   NIL,		/* no restrictions of its own */
+#endif
+								   list_make2(makeInteger(false),
+											  makeInteger(sampled)));
+	path->path.parallel_aware = true;
+	path->path.parallel_safe = true;
+	path->path.parallel_workers = nworkers;
 
+	add_partial_path(baserel, (Path *) path);
 }
+#endif
 
 static void
 clickhouseGetForeignPaths(PlannerInfo *root,
@@ -361,35 +1594,630 @@ clickhouseGetForeignPaths(PlannerInfo *root,
 	 * that is needed to identify the specific scan method intended.
 	 */
 
-	/*
-	 * ClickhouseFdwPlanState *plan_state = baserel->fdw_private;
-	 */
-
-	Cost		startup_cost,
-				total_cost;
+	ClickhouseFdwPlanState *plan_state = baserel->fdw_private;
+	ListCell   *lc;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
-	startup_cost = 0;
-	total_cost = startup_cost + baserel->rows;
-
-	/* Create a ForeignPath node and add it as only possible path */
+	/* Create a ForeignPath node for the plain scan */
 	add_path(baserel, (Path *)
 			 create_foreignscan_path(root, baserel,
 #if (PG_VERSION_NUM >= 90600)
 									 NULL,      /* default pathtarget */
 #endif
-									 baserel->rows,
-									 startup_cost,
-									 total_cost,
+									 plan_state->rows,
+#if (PG_VERSION_NUM >= 180000)
+									 0,			/* no disabled plan nodes */
+#endif
+									 plan_state->startup_cost,
+									 plan_state->total_cost,
 									 NIL,		/* no pathkeys */
 									 NULL,		/* no outer rel either */
 #if (PG_VERSION_NUM >= 90500)
 									 NULL,      /* no extra plan */
+#endif
+#if (PG_VERSION_NUM >= 170000)
+									 NIL,		/* no restrictions of its own */
+#endif
+									 NIL));		/* no fdw_private data */
+
+#if (PG_VERSION_NUM >= 110000)
+	/* one read by parallel workers */
+	if (baserel->consider_parallel && IS_SIMPLE_REL(baserel))
+		add_partial_scan_path(root, baserel, foreigntableid);
+#endif
+
+	/*
+	 * And one sorted by ClickHouse as the query wants it, for the ORDER BY
+	 * or a merge join. ClickHouse reads in the order of the sorting key of
+	 * the table when it can, but this is costed as a full sort.
+	 */
+	if (root->query_pathkeys == NIL)
+		return;
+
+	plan_state->qp_is_pushdown_safe = true;
+	foreach(lc, root->query_pathkeys)
+	{
+		if (!chfdw_is_foreign_pathkey(root, baserel, (PathKey *) lfirst(lc)))
+		{
+			plan_state->qp_is_pushdown_safe = false;
+			return;
+		}
+	}
+
+	add_path(baserel, (Path *)
+			 create_foreignscan_path(root, baserel,
+#if (PG_VERSION_NUM >= 90600)
+									 NULL,      /* default pathtarget */
+#endif
+									 plan_state->rows,
+#if (PG_VERSION_NUM >= 180000)
+									 0,			/* no disabled plan nodes */
+#endif
+									 plan_state->startup_cost *
+									 DEFAULT_FDW_SORT_MULTIPLIER,
+									 plan_state->total_cost *
+									 DEFAULT_FDW_SORT_MULTIPLIER,
+									 root->query_pathkeys,
+									 NULL,		/* no outer rel either */
+#if (PG_VERSION_NUM >= 90500)
+									 NULL,      /* no extra plan */
+#endif
+#if (PG_VERSION_NUM >= 170000)
+									 NIL,		/* no restrictions of its own */
 #endif
 									 NIL));		/* no fdw_private data */
 }
 
+#if (PG_VERSION_NUM >= 90600)
+/*
+ * Create a ForeignPath for a join, or a path of an upper relation when
+ * upper is set, with the function the PostgreSQL version has for it.
+ */
+static Path *
+create_foreign_rel_path(PlannerInfo *root, RelOptInfo *rel, PathTarget *target,
+						double rows, Cost startup_cost, Cost total_cost,
+						List *pathkeys, List *fdw_private, bool upper)
+{
+#if (PG_VERSION_NUM >= 120000)
+	if (upper)
+		return (Path *) create_foreign_upper_path(root, rel, target, rows,
+#if (PG_VERSION_NUM >= 180000)
+												  0,	/* not disabled */
+#endif
+												  startup_cost, total_cost,
+												  pathkeys,
+												  NULL, /* no extra plan */
+#if (PG_VERSION_NUM >= 170000)
+												  NIL,	/* no restrictions */
+#endif
+												  fdw_private);
+
+	return (Path *) create_foreign_join_path(root, rel, target, rows,
+#if (PG_VERSION_NUM >= 180000)
+											 0, /* not disabled */
+#endif
+											 startup_cost, total_cost,
+											 pathkeys,
+											 NULL,	/* no required_outer */
+											 NULL,	/* no extra plan */
+#if (PG_VERSION_NUM >= 170000)
+											 NIL,	/* no restrictions */
+#endif
+											 fdw_private);
+#else
+	return (Path *) create_foreignscan_path(root, rel, target, rows,
+											startup_cost, total_cost,
+											pathkeys,
+											NULL,	/* no required_outer */
+											NULL,	/* no extra plan */
+											fdw_private);
+#endif
+}
+
+/*
+ * Decide whether ClickHouse can compute the join of outerrel and innerrel,
+ * and fill fpinfo in for it.
+ *
+ * ClickHouse joins a table to the rows joined so far, so the inner side has
+ * to be a table. An outer join can only be on equalities between the
+ * sides. Conditions that have to hold before an outer join go into a
+ * subquery of the table they are on, all others into the WHERE clause.
+ */
+static bool
+foreign_join_ok(PlannerInfo *root, RelOptInfo *joinrel,
+				ClickhouseFdwPlanState *fpinfo, JoinType jointype,
+				RelOptInfo *outerrel, RelOptInfo *innerrel,
+				JoinPathExtraData *extra)
+{
+	ClickhouseFdwPlanState *fpinfo_o = outerrel->fdw_private;
+	ClickhouseFdwPlanState *fpinfo_i = innerrel->fdw_private;
+	List	   *vars;
+	ListCell   *lc;
+
+	if (jointype != JOIN_INNER && jointype != JOIN_LEFT &&
+		jointype != JOIN_RIGHT && jointype != JOIN_FULL)
+		return false;
+
+	if (fpinfo_o == NULL || !fpinfo_o->pushdown_safe ||
+		fpinfo_i == NULL || !fpinfo_i->pushdown_safe ||
+		!IS_SIMPLE_REL(innerrel))
+		return false;
+
+	/* both sides have to be read through the same connection */
+	if (fpinfo_o->user->umid != fpinfo_i->user->umid ||
+		fpinfo_o->user->serverid != fpinfo_i->user->serverid)
+		return false;
+
+	/* rows filtered locally would change the result of the join */
+	if (fpinfo_o->local_conds != NIL || fpinfo_i->local_conds != NIL)
+		return false;
+
+	/* the result is made of columns of the tables only */
+	vars = pull_var_clause((Node *) joinrel->reltarget->exprs,
+						   PVC_RECURSE_PLACEHOLDERS);
+	foreach(lc, vars)
+	{
+		Var		   *var = (Var *) lfirst(lc);
+
+		if (!IsA(var, Var) || var->varattno <= 0)
+			return false;
+	}
+
+	/* a placeholder evaluated within the join cannot be computed remotely */
+	foreach(lc, root->placeholder_list)
+	{
+		PlaceHolderInfo *phinfo = (PlaceHolderInfo *) lfirst(lc);
+
+		if (bms_is_subset(phinfo->ph_eval_at, joinrel->relids) &&
+			bms_nonempty_difference(joinrel->relids, phinfo->ph_eval_at))
+			return false;
+	}
+
+	foreach(lc, extra->restrictlist)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		bool		is_remote = chfdw_is_foreign_expr(root, joinrel,
+													  rinfo->clause);
+		bool		is_key = is_remote &&
+			chfdw_is_join_equality(root, rinfo->clause,
+								   outerrel->relids, innerrel->relids);
+
+		if (IS_OUTER_JOIN(jointype) &&
+			!RINFO_IS_PUSHED_DOWN(rinfo, joinrel->relids))
+		{
+			if (!is_key)
+				return false;
+			fpinfo->joinclauses = lappend(fpinfo->joinclauses, rinfo);
+		}
+		else if (!is_remote)
+			fpinfo->local_conds = lappend(fpinfo->local_conds, rinfo);
+		else if (jointype == JOIN_INNER && is_key)
+			fpinfo->joinclauses = lappend(fpinfo->joinclauses, rinfo);
+		else
+			fpinfo->remote_conds = lappend(fpinfo->remote_conds, rinfo);
+	}
+
+	if (IS_OUTER_JOIN(jointype) && fpinfo->joinclauses == NIL)
+		return false;
+
+	/*
+	 * Conditions of the sides. Those of a preserved side still hold when
+	 * checked after the join, those of a nullable side do not.
+	 */
+	switch (jointype)
+	{
+		case JOIN_INNER:
+			fpinfo->remote_conds = list_concat(fpinfo->remote_conds,
+											   list_copy(fpinfo_o->remote_conds));
+			fpinfo->remote_conds = list_concat(fpinfo->remote_conds,
+											   list_copy(fpinfo_i->remote_conds));
+			break;
+		case JOIN_LEFT:
+			fpinfo->remote_conds = list_concat(fpinfo->remote_conds,
+											   list_copy(fpinfo_o->remote_conds));
+			fpinfo->make_innerrel_subquery = fpinfo_i->remote_conds != NIL;
+			break;
+		case JOIN_RIGHT:
+			if (fpinfo_o->remote_conds != NIL)
+			{
+				if (!IS_SIMPLE_REL(outerrel))
+					return false;
+				fpinfo->make_outerrel_subquery = true;
+			}
+			fpinfo->remote_conds = list_concat(fpinfo->remote_conds,
+											   list_copy(fpinfo_i->remote_conds));
+			break;
+		case JOIN_FULL:
+			if (fpinfo_o->remote_conds != NIL)
+			{
+				if (!IS_SIMPLE_REL(outerrel))
+					return false;
+				fpinfo->make_outerrel_subquery = true;
+			}
+			fpinfo->make_innerrel_subquery = fpinfo_i->remote_conds != NIL;
+			break;
+		default:
+			return false;
+	}
+
+	fpinfo->outerrel = outerrel;
+	fpinfo->innerrel = innerrel;
+	fpinfo->jointype = jointype;
+	fpinfo->table = fpinfo_o->table;
+	fpinfo->user = fpinfo_o->user;
+	fpinfo->pushdown_safe = true;
+
+	return true;
+}
+
+/*
+ * Columns a join computed by ClickHouse returns: those of its output and
+ * those its local conditions need.
+ */
+static List *
+build_join_tlist(RelOptInfo *joinrel)
+{
+	ClickhouseFdwPlanState *fpinfo = joinrel->fdw_private;
+	List	   *tlist;
+	ListCell   *lc;
+
+	tlist = add_to_flat_tlist(NIL,
+							  pull_var_clause((Node *) joinrel->reltarget->exprs,
+											  PVC_RECURSE_PLACEHOLDERS));
+	foreach(lc, fpinfo->local_conds)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		tlist = add_to_flat_tlist(tlist,
+								  pull_var_clause((Node *) rinfo->clause,
+												  PVC_RECURSE_PLACEHOLDERS));
+	}
+
+	return tlist;
+}
+#endif
+
+#if (PG_VERSION_NUM >= 110000)
+/*
+ * Decide whether ClickHouse can compute an aggregation over the relation it
+ * already scans, and build the select list of the remote query: the
+ * grouping expressions, and the aggregates of the output and of the HAVING
+ * conditions that have to be checked locally. HAVING conditions are split
+ * into the plan state's remote and local conditions.
+ */
+static bool
+foreign_grouping_ok(PlannerInfo *root, RelOptInfo *grouped_rel,
+					Node *havingQual)
+{
+	Query	   *query = root->parse;
+	ClickhouseFdwPlanState *fpinfo = grouped_rel->fdw_private;
+	ClickhouseFdwPlanState *ofpinfo = fpinfo->outerrel->fdw_private;
+	PathTarget *grouping_target = grouped_rel->reltarget;
+	List	   *tlist = NIL;
+	ListCell   *lc;
+	int			i = 0;
+
+	if (query->groupingSets)
+		return false;
+
+	/* rows that are filtered locally must not reach the aggregates */
+	if (ofpinfo->local_conds != NIL)
+		return false;
+
+	foreach(lc, grouping_target->exprs)
+	{
+		Expr	   *expr = (Expr *) lfirst(lc);
+		Index		sgref = get_pathtarget_sortgroupref(grouping_target, i);
+
+		i++;
+
+		if (sgref && get_sortgroupref_clause_noerr(sgref, query->groupClause))
+		{
+			TargetEntry *tle;
+
+			/* ClickHouse may read a constant key as a column position */
+			if (IsA(expr, Const) ||
+				!chfdw_is_foreign_expr(root, grouped_rel, expr))
+				return false;
+
+			tle = makeTargetEntry(expr, list_length(tlist) + 1, NULL, false);
+			tle->ressortgroupref = sgref;
+			tlist = lappend(tlist, tle);
+		}
+		else if (chfdw_is_foreign_expr(root, grouped_rel, expr))
+			tlist = add_to_flat_tlist(tlist, list_make1(expr));
+		else
+		{
+			/*
+			 * The expression is computed locally from the aggregates and
+			 * grouping columns ClickHouse returns.
+			 */
+			List	   *aggvars = pull_var_clause((Node *) expr,
+												  PVC_INCLUDE_AGGREGATES);
+			ListCell   *l;
+
+			if (!chfdw_is_foreign_expr(root, grouped_rel, (Expr *) aggvars))
+				return false;
+
+			foreach(l, aggvars)
+			{
+				if (IsA(lfirst(l), Aggref))
+					tlist = add_to_flat_tlist(tlist, list_make1(lfirst(l)));
+			}
+		}
+	}
+
+	foreach(lc, (List *) havingQual)
+	{
+		Expr	   *expr = (Expr *) lfirst(lc);
+
+		if (chfdw_is_foreign_expr(root, grouped_rel, expr))
+			fpinfo->remote_conds = lappend(fpinfo->remote_conds, expr);
+		else
+			fpinfo->local_conds = lappend(fpinfo->local_conds, expr);
+	}
+
+	/* aggregates of local HAVING conditions are fetched as well */
+	foreach(lc, fpinfo->local_conds)
+	{
+		List	   *aggvars = pull_var_clause((Node *) lfirst(lc),
+											  PVC_INCLUDE_AGGREGATES);
+		ListCell   *l;
+
+		foreach(l, aggvars)
+		{
+			Expr	   *expr = (Expr *) lfirst(l);
+
+			/* Vars are grouping columns, which are fetched already */
+			if (!IsA(expr, Aggref))
+				continue;
+			if (!chfdw_is_foreign_expr(root, grouped_rel, expr))
+				return false;
+			tlist = add_to_flat_tlist(tlist, list_make1(expr));
+		}
+	}
+
+	fpinfo->grouped_tlist = tlist;
+	return true;
+}
+
+/*
+ * Cost of a path that also sorts the relation on ClickHouse, or returns at
+ * most limit_rows of it when that is positive.
+ */
+static void
+estimate_sort_limit_cost(ClickhouseFdwPlanState *plan_state, bool sorted,
+						 double limit_rows, double *rows,
+						 Cost *startup_cost, Cost *total_cost)
+{
+	Cost		per_row = DEFAULT_FDW_TUPLE_COST + cpu_tuple_cost;
+	double		retrieved_rows = plan_state->retrieved_rows;
+	Cost		remote_cost = plan_state->total_cost - per_row * retrieved_rows;
+
+	*rows = plan_state->rows;
+	*startup_cost = plan_state->startup_cost;
+
+	if (sorted)
+	{
+		/* the first row comes only after all of them are sorted */
+		remote_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+		*startup_cost = remote_cost;
+	}
+
+	if (limit_rows > 0 && limit_rows < retrieved_rows)
+	{
+		/* an unsorted scan stops as soon as it has enough rows */
+		if (!sorted)
+			remote_cost = *startup_cost +
+				(remote_cost - *startup_cost) * limit_rows / retrieved_rows;
+		retrieved_rows = limit_rows;
+		*rows = Min(*rows, limit_rows);
+	}
+
+	*total_cost = remote_cost + per_row * retrieved_rows;
+}
+
+/*
+ * Add a path computing a GROUP BY, or an aggregation of the whole input,
+ * on ClickHouse.
+ */
+static void
+add_foreign_grouping_paths(PlannerInfo *root, RelOptInfo *input_rel,
+						   RelOptInfo *grouped_rel, GroupPathExtraData *extra)
+{
+	ClickhouseFdwPlanState *fpinfo = grouped_rel->fdw_private;
+	Path	   *path;
+
+	/* a partial aggregate of a partition would have to be combined locally */
+	if (extra->patype == PARTITIONWISE_AGGREGATE_PARTIAL)
+		return;
+
+	if (!foreign_grouping_ok(root, grouped_rel, extra->havingQual))
+		return;
+	fpinfo->pushdown_safe = true;
+
+	estimate_path_cost_size(root, grouped_rel);
+
+	path = create_foreign_rel_path(root, grouped_rel, grouped_rel->reltarget,
+								   fpinfo->rows, fpinfo->startup_cost,
+								   fpinfo->total_cost, NIL, NIL, true);
+	add_path(grouped_rel, path);
+}
+
+#if (PG_VERSION_NUM >= 120000)
+/*
+ * Whether a LIMIT or OFFSET value can be written into the remote query.
+ */
+static bool
+is_limit_const(Node *node)
+{
+	if (node == NULL)
+		return true;
+	if (!IsA(node, Const))
+		return false;
+	return ((Const *) node)->constisnull ||
+		DatumGetInt64(((Const *) node)->constvalue) >= 0;
+}
+
+/*
+ * Add a path sorting an aggregation on ClickHouse for the ORDER BY. The path
+ * belongs to the aggregation, which is computed by the same remote query.
+ */
+static void
+add_foreign_ordered_paths(PlannerInfo *root, RelOptInfo *input_rel,
+						  RelOptInfo *ordered_rel)
+{
+	ClickhouseFdwPlanState *ifpinfo = input_rel->fdw_private;
+	ClickhouseFdwPlanState *fpinfo = ordered_rel->fdw_private;
+	double		rows;
+	Cost		startup_cost;
+	Cost		total_cost;
+	Path	   *path;
+	ListCell   *lc;
+
+	if (root->parse->hasTargetSRFs)
+		return;
+
+	fpinfo->is_ordered = true;
+
+	/*
+	 * For a table the query pathkeys are those of the ORDER BY, the sorted
+	 * path is built by clickhouseGetForeignPaths already. The ordered
+	 * relation only tells the LIMIT stage whether the sort is remote.
+	 */
+	if (!IS_UPPER_REL(input_rel))
+	{
+		fpinfo->pushdown_safe = ifpinfo->qp_is_pushdown_safe;
+		return;
+	}
+
+	foreach(lc, root->sort_pathkeys)
+	{
+		if (!chfdw_is_foreign_pathkey(root, input_rel, (PathKey *) lfirst(lc)))
+			return;
+	}
+	fpinfo->pushdown_safe = true;
+
+	estimate_sort_limit_cost(ifpinfo, true, 0, &rows,
+							 &startup_cost, &total_cost);
+
+	path = create_foreign_rel_path(root, input_rel,
+								   root->upper_targets[UPPERREL_ORDERED],
+								   rows, startup_cost, total_cost,
+								   root->sort_pathkeys,
+								   list_make1(makeInteger(false)), true);
+	add_path(ordered_rel, path);
+}
+
+/*
+ * Add a path applying the LIMIT and OFFSET of the query on ClickHouse,
+ * after the remote ORDER BY if there is one, so that ClickHouse runs its
+ * own top-N and only the requested rows are transferred.
+ */
+static void
+add_foreign_final_paths(PlannerInfo *root, RelOptInfo *input_rel,
+						RelOptInfo *final_rel, FinalPathExtraData *extra)
+{
+	Query	   *parse = root->parse;
+	ClickhouseFdwPlanState *ifpinfo = input_rel->fdw_private;
+	ClickhouseFdwPlanState *fpinfo = final_rel->fdw_private;
+	List	   *pathkeys = NIL;
+	double		rows;
+	Cost		startup_cost;
+	Cost		total_cost;
+	Path	   *path;
+
+	if (parse->commandType != CMD_SELECT || parse->rowMarks != NIL ||
+		parse->hasTargetSRFs || !extra->limit_needed)
+		return;
+
+	/* the path extends the query of the relation that was sorted */
+	if (ifpinfo->is_ordered)
+	{
+		input_rel = ifpinfo->outerrel;
+		ifpinfo = input_rel->fdw_private;
+		pathkeys = root->sort_pathkeys;
+	}
+
+	/* rows removed locally would have to be replaced by further ones */
+	if (ifpinfo->local_conds != NIL)
+		return;
+
+#if (PG_VERSION_NUM >= 130000)
+	if (parse->limitOption == LIMIT_OPTION_WITH_TIES)
+		return;
+#endif
+
+	if (!is_limit_const(parse->limitOffset) ||
+		!is_limit_const(parse->limitCount))
+		return;
+	fpinfo->pushdown_safe = true;
+
+	estimate_sort_limit_cost(ifpinfo, pathkeys != NIL, extra->limit_tuples,
+							 &rows, &startup_cost, &total_cost);
+
+	path = create_foreign_rel_path(root, input_rel,
+								   root->upper_targets[UPPERREL_FINAL],
+								   rows, startup_cost, total_cost, pathkeys,
+								   list_make1(makeInteger(true)), true);
+	add_path(final_rel, path);
+}
+#endif
+
+/*
+ * Add paths computing upper relations on ClickHouse: the aggregation, and
+ * from PostgreSQL 12 on the ORDER BY of an aggregation and the LIMIT.
+ */
+static void
+clickhouseGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+							   RelOptInfo *input_rel, RelOptInfo *output_rel,
+							   void *extra)
+{
+	ClickhouseFdwPlanState *ifpinfo = input_rel->fdw_private;
+	ClickhouseFdwPlanState *fpinfo;
+
+	elog(DEBUG1, "entering function %s", __func__);
+
+	/* the function is called once for every input path, plan only once */
+	if (ifpinfo == NULL || !ifpinfo->pushdown_safe ||
+		output_rel->fdw_private != NULL)
+		return;
+
+	if (stage != UPPERREL_GROUP_AGG
+#if (PG_VERSION_NUM >= 120000)
+		&& stage != UPPERREL_ORDERED && stage != UPPERREL_FINAL
+#endif
+		)
+		return;
+
+	fpinfo = palloc0(sizeof(ClickhouseFdwPlanState));
+	fpinfo->outerrel = input_rel;
+	fpinfo->table = ifpinfo->table;
+	fpinfo->user = ifpinfo->user;
+	output_rel->fdw_private = fpinfo;
+
+	switch (stage)
+	{
+		case UPPERREL_GROUP_AGG:
+			add_foreign_grouping_paths(root, input_rel, output_rel,
+									   (GroupPathExtraData *) extra);
+			break;
+#if (PG_VERSION_NUM >= 120000)
+		case UPPERREL_ORDERED:
+			add_foreign_ordered_paths(root, input_rel, output_rel);
+			break;
+		case UPPERREL_FINAL:
+			add_foreign_final_paths(root, input_rel, output_rel,
+									(FinalPathExtraData *) extra);
+			break;
+#endif
+		default:
+			break;
+	}
+}
+#endif
+
 
 #if (PG_VERSION_NUM < 90500)
 static ForeignScan *
@@ -422,39 +2250,128 @@ clickhouseGetForeignPlan(PlannerInfo *root,
 	 *
 	 */
 
-	/*
-	 * ClickhouseFdwPlanState *plan_state = baserel->fdw_private;
-	 */
+	ClickhouseFdwPlanState *plan_state = baserel->fdw_private;
+	Index		scan_relid;
+	StringInfoData sql;
+	List	   *remote_exprs = NIL;
+	List	   *local_exprs = NIL;
+	List	   *recheck_exprs = NIL;
+	List	   *fdw_scan_tlist = NIL;
+	List	   *retrieved_attrs;
+	List	   *chunk_sqls = NIL;
+	List	   *fdw_private;
+	bool		has_limit = false;
+	ListCell   *lc;
+
+	elog(DEBUG1, "entering function %s", __func__);
 
-	Index		scan_relid = baserel->relid;
+	if (best_path->fdw_private != NIL)
+		has_limit = intVal(list_nth(best_path->fdw_private,
+									FdwPathPrivateHasLimit));
 
 	/*
-	 * We have no native ability to evaluate restriction clauses, so we just
-	 * put all the scan_clauses into the plan node's qual list for the
-	 * executor to check. So all we have to do here is strip RestrictInfo
-	 * nodes from the clauses and ignore pseudoconstants (which will be
-	 * handled elsewhere).
+	 * A join or an aggregation computed by ClickHouse returns the rows of
+	 * its remote select list rather than those of a table. Its conditions
+	 * were classified by foreign_join_ok or foreign_grouping_ok.
 	 */
+	if (IS_UPPER_REL(baserel))
+	{
+		scan_relid = 0;
+		fdw_scan_tlist = plan_state->grouped_tlist;
+		remote_exprs = plan_state->remote_conds;
+		local_exprs = plan_state->local_conds;
+	}
+#if (PG_VERSION_NUM >= 90600)
+	else if (IS_JOIN_REL(baserel))
+	{
+		/* a join returns the columns of build_join_tlist */
+		scan_relid = 0;
+		fdw_scan_tlist = build_join_tlist(baserel);
+		remote_exprs = plan_state->remote_conds;
+		local_exprs = extract_actual_clauses(plan_state->local_conds, false);
+	}
+#endif
+	else
+		scan_relid = baserel->relid;
 
-	elog(DEBUG1, "entering function %s", __func__);
+	/*
+	 * Clauses classified in clickhouseGetForeignRelSize run on ClickHouse or
+	 * stay in the plan node's qual list. Others, such as join clauses of a
+	 * parameterized path, are classified here. Pseudoconstants are handled
+	 * elsewhere.
+	 */
+	foreach(lc, scan_clauses)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		Assert(IsA(rinfo, RestrictInfo));
+
+		if (rinfo->pseudoconstant)
+			continue;
+
+		if (list_member_ptr(plan_state->remote_conds, rinfo))
+			remote_exprs = lappend(remote_exprs, rinfo->clause);
+		else if (list_member_ptr(plan_state->local_conds, rinfo))
+			local_exprs = lappend(local_exprs, rinfo->clause);
+		else if (chfdw_is_foreign_expr(root, baserel, rinfo->clause))
+			remote_exprs = lappend(remote_exprs, rinfo->clause);
+		else
+			local_exprs = lappend(local_exprs, rinfo->clause);
+	}
+
+	/* rows re-checked by EvalPlanQual must pass the remote conditions */
+	if (IS_SIMPLE_REL(baserel))
+		recheck_exprs = remote_exprs;
+
+	/* Build the query to run on ClickHouse */
+	initStringInfo(&sql);
+	chfdw_deparse_select_sql(&sql, root, baserel, fdw_scan_tlist,
+							 remote_exprs, best_path->path.pathkeys,
+							 has_limit, &retrieved_attrs);
+
+#if (PG_VERSION_NUM >= 110000)
+	/*
+	 * A parallel scan reads the table in a chunk for every participant it
+	 * is planned for. The chunks are claimed as the participants come, so
+	 * all are read even if fewer workers start.
+	 */
+	if (best_path->path.parallel_aware)
+	{
+		bool		sampled = intVal(list_nth(best_path->fdw_private,
+											  FdwPathPrivateSampled));
+		int			nchunks = best_path->path.parallel_workers + 1;
+		int			i;
+
+		for (i = 0; i < nchunks; i++)
+		{
+			StringInfoData chunk_sql;
+
+			initStringInfo(&chunk_sql);
+			chfdw_deparse_chunk_sql(&chunk_sql, root, baserel, remote_exprs,
+									sampled, i, nchunks);
+			chunk_sqls = lappend(chunk_sqls, makeString(chunk_sql.data));
+		}
+	}
+#endif
 
-	scan_clauses = extract_actual_clauses(scan_clauses, false);
+	fdw_private = list_make3(makeString(sql.data), retrieved_attrs,
+							 chunk_sqls);
 
 	/* Create the ForeignScan node */
 #if(PG_VERSION_NUM < 90500)
 	return make_foreignscan(tlist,
-							scan_clauses,
+							local_exprs,
 							scan_relid,
 							NIL,	/* no expressions to evaluate */
-							NIL);		/* no private state either */
+							fdw_private);
 #else
 	return make_foreignscan(tlist,
-							scan_clauses,
+							local_exprs,
 							scan_relid,
 							NIL,	/* no expressions to evaluate */
-							NIL,	/* no private state either */
-							NIL,	/* no custom tlist */
-							NIL,    /* no remote quals */
+							fdw_private,
+							fdw_scan_tlist,
+							recheck_exprs,
 							outer_plan);
 #endif
 
@@ -499,11 +2416,93 @@ clickhouseBeginForeignScan(ForeignScanState *node,
 	 *
 	 */
 
-	ClickhouseFdwScanState * scan_state = palloc0(sizeof(ClickhouseFdwScanState));
-	node->fdw_state = scan_state;
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+	EState	   *estate = node->ss.ps.state;
+	ClickhouseFdwScanState *scan_state;
+	MemoryContextCallback *cleanup;
+	RangeTblEntry *rte;
+	ForeignTable *table;
+	Oid			userid;
+	int			rtindex;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
+	scan_state = palloc0(sizeof(ClickhouseFdwScanState));
+	node->fdw_state = scan_state;
+
+	/*
+	 * An aggregation computed remotely has no scan relation of its own, the
+	 * table it reads is the one of its input.
+	 */
+	if (fsplan->scan.scanrelid > 0)
+		rtindex = fsplan->scan.scanrelid;
+	else
+#if PG_VERSION_NUM >= 160000
+		rtindex = bms_next_member(fsplan->fs_base_relids, -1);
+#else
+		rtindex = bms_next_member(fsplan->fs_relids, -1);
+#endif
+	rte = rt_fetch(rtindex, estate->es_range_table);
+
+	/*
+	 * Identify which user to do the remote access as. This should match what
+	 * ExecCheckRTEPerms() does.
+	 */
+#if PG_VERSION_NUM >= 160000
+	userid = OidIsValid(fsplan->checkAsUser) ? fsplan->checkAsUser : GetUserId();
+#else
+	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+#endif
+	table = GetForeignTable(rte->relid);
+	scan_state->user = GetUserMapping(userid, table->serverid);
+
+	scan_state->read.sql = strVal(list_nth(fsplan->fdw_private,
+										   FdwScanPrivateSelectSql));
+	scan_state->retrieved_attrs = (List *) list_nth(fsplan->fdw_private,
+													FdwScanPrivateRetrievedAttrs);
+	scan_state->chunk_sqls = (List *) list_nth(fsplan->fdw_private,
+											   FdwScanPrivateChunkSqls);
+	scan_state->read.natts = list_length(scan_state->retrieved_attrs);
+	scan_state->read.columns = palloc0(sizeof(CHColumn) *
+									   scan_state->read.natts);
+	scan_state->read.maxBlockSize = get_fetch_size(table);
+	get_query_settings(table, scan_state->read.settings);
+	scan_state->scan_cxt = CurrentMemoryContext;
+#if (PG_VERSION_NUM >= 140000)
+	scan_state->async = node->ss.ps.async_capable;
+#endif
+	scan_state->fetch_fd = -1;
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	/*
+	 * A scan that is abandoned by an error still holds its connection, close
+	 * the remote query when the executor state goes away.
+	 */
+	cleanup = palloc0(sizeof(MemoryContextCallback));
+	cleanup->func = clickhouseScanCleanup;
+	cleanup->arg = scan_state;
+	MemoryContextRegisterResetCallback(scan_state->scan_cxt, cleanup);
+}
+
+/*
+ * Close the remote query of a scan and give its connection back to the
+ * cache, unless the connection lost sync with the server.
+ */
+static void
+clickhouseScanCleanup(void *arg)
+{
+	ClickhouseFdwScanState *scan_state = (ClickhouseFdwScanState *) arg;
+
+	if (scan_state->conn)
+	{
+		bool		reusable = end_ch_query(&scan_state->read) == 0;
+
+		chfdw_release_connection(scan_state->conn, reusable);
+		scan_state->conn = NULL;
+		scan_state->fetch_fd = -1;
+	}
 }
 
 
@@ -535,22 +2534,86 @@ clickhouseIterateForeignScan(ForeignScanState *node)
 	 */
 
 
-	/* ----
-	 * ClickhouseFdwScanState *scan_state =
-	 *	 (ClickhouseFdwScanState *) node->fdw_state;
-	 * ----
-	 */
-
+	ClickhouseFdwScanState *scan_state =
+		(ClickhouseFdwScanState *) node->fdw_state;
 	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
-
-	elog(DEBUG1, "entering function %s", __func__);
+	TupleDesc	tupdesc = slot->tts_tupleDescriptor;
+	int			rc;
 
 	ExecClearTuple(slot);
 
-	/* get the next record, if any, and fill in the slot */
+	for (;;)
+	{
+		if (scan_state->conn == NULL)
+		{
+			/* a parallel participant reads the next chunk nobody has taken */
+			if (scan_state->pscan != NULL)
+			{
+				uint32		chunk;
+
+				chunk = pg_atomic_fetch_add_u32(&scan_state->pscan->next_chunk, 1);
+				if (chunk >= list_length(scan_state->chunk_sqls))
+				{
+					scan_state->eof = true;
+					return slot;
+				}
+				scan_state->read.sql = strVal(list_nth(scan_state->chunk_sqls,
+													   chunk));
+			}
+
+			scan_state->conn = chfdw_get_connection(scan_state->user, false);
+			scan_state->read.conn = scan_state->conn->conn;
+			if (begin_ch_query(&scan_state->read) < 0)
+			{
+				chfdw_release_connection(scan_state->conn, false);
+				scan_state->conn = NULL;
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+						 errmsg("clickhouse_fdw: %s", ch_last_error())));
+			}
+		}
+
+		/* an asynchronous scan does not wait, the Append asks again */
+		if (scan_state->async && !ch_query_ready(&scan_state->read))
+			return slot;
+
+		/* get the next record, if any, and fill in the slot */
+		rc = read_ch_query(&scan_state->read);
+		if (rc < 0)
+		{
+			CHECK_FOR_INTERRUPTS();
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_ERROR),
+					 errmsg("clickhouse_fdw: %s", ch_last_error())));
+		}
+		if (rc > 0)
+			break;
+		if (scan_state->pscan == NULL)
+		{
+			scan_state->eof = true;
+			return slot;
+		}
+
+		/* the chunk is read, go on with another one */
+		clickhouseScanCleanup(scan_state);
+	}
+
+	if (scan_state->convs == NULL)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(scan_state->scan_cxt);
+
+		scan_state->convs = chfdw_prepare_converters(&scan_state->read, tupdesc,
+													 scan_state->retrieved_attrs);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* columns that are not fetched are NULL */
+	memset(slot->tts_isnull, true, sizeof(bool) * tupdesc->natts);
+	chfdw_convert_row(&scan_state->read, scan_state->convs,
+					  slot->tts_values, slot->tts_isnull);
 
 	/* then return the slot */
-	return slot;
+	return ExecStoreVirtualTuple(slot);
 }
 
 
@@ -563,14 +2626,14 @@ clickhouseReScanForeignScan(ForeignScanState *node)
 	 * return exactly the same rows.
 	 */
 
-	/* ----
-	 * ClickhouseFdwScanState *scan_state =
-	 *	 (ClickhouseFdwScanState *) node->fdw_state;
-	 * ----
-	 */
+	ClickhouseFdwScanState *scan_state =
+		(ClickhouseFdwScanState *) node->fdw_state;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
+	/* the query is sent again by the next IterateForeignScan */
+	clickhouseScanCleanup(scan_state);
+	scan_state->eof = false;
 }
 
 
@@ -583,15 +2646,181 @@ clickhouseEndForeignScan(ForeignScanState *node)
 	 * remote servers should be cleaned up.
 	 */
 
-	/* ----
-	 * ClickhouseFdwScanState *scan_state =
-	 *	 (ClickhouseFdwScanState *) node->fdw_state;
-	 * ----
-	 */
+	ClickhouseFdwScanState *scan_state =
+		(ClickhouseFdwScanState *) node->fdw_state;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
+	if (scan_state)
+		clickhouseScanCleanup(scan_state);
+}
+
+
+#if (PG_VERSION_NUM >= 110000)
+static bool
+clickhouseIsForeignScanParallelSafe(PlannerInfo *root,
+									RelOptInfo *rel,
+									RangeTblEntry *rte)
+{
+	/*
+	 * Test whether a scan can be performed within a parallel worker. Every
+	 * worker opens connections of its own, so a scan is always safe; only
+	 * a partial path splits it between them.
+	 */
+
+	return true;
+}
+
+static Size
+clickhouseEstimateDSMForeignScan(ForeignScanState *node,
+								 ParallelContext *pcxt)
+{
+	/*
+	 * Estimate the amount of dynamic shared memory that will be required for
+	 * parallel operation.
+	 */
+
+	return sizeof(ChParallelScan);
+}
+
+static void
+clickhouseInitializeDSMForeignScan(ForeignScanState *node,
+								   ParallelContext *pcxt,
+								   void *coordinate)
+{
+	/*
+	 * Initialize the dynamic shared memory that will be required for
+	 * parallel operation. This is called in the leader, which reads chunks
+	 * like any worker.
+	 */
+
+	ClickhouseFdwScanState *scan_state =
+		(ClickhouseFdwScanState *) node->fdw_state;
+	ChParallelScan *pscan = (ChParallelScan *) coordinate;
+
+	pg_atomic_init_u32(&pscan->next_chunk, 0);
+	scan_state->pscan = pscan;
+}
+
+static void
+clickhouseReInitializeDSMForeignScan(ForeignScanState *node,
+									 ParallelContext *pcxt,
+									 void *coordinate)
+{
+	/*
+	 * Re-initialize the dynamic shared memory required for parallel
+	 * operation when the foreign-scan plan node is about to be re-scanned.
+	 */
+
+	ChParallelScan *pscan = (ChParallelScan *) coordinate;
+
+	pg_atomic_write_u32(&pscan->next_chunk, 0);
+}
+
+static void
+clickhouseInitializeWorkerForeignScan(ForeignScanState *node,
+									  shm_toc *toc,
+									  void *coordinate)
+{
+	/*
+	 * Initialize a parallel worker's local state based on the shared state
+	 * set up by the leader during InitializeDSMForeignScan.
+	 */
+
+	ClickhouseFdwScanState *scan_state =
+		(ClickhouseFdwScanState *) node->fdw_state;
+
+	scan_state->pscan = (ChParallelScan *) coordinate;
+}
+#endif
+
+
+#if (PG_VERSION_NUM >= 140000)
+static bool
+clickhouseIsForeignPathAsyncCapable(ForeignPath *path)
+{
+	/*
+	 * Test whether the foreign path can be executed asynchronously, as the
+	 * async_capable option of its table or server says.
+	 */
+
+	ClickhouseFdwPlanState *fpinfo = path->path.parent->fdw_private;
+
+	return is_async_capable(fpinfo->table);
+}
+
+/*
+ * Return the next row of an asynchronous scan to the Append, or, if the
+ * rows received so far are all returned, have the next block received in
+ * the background and leave the request pending until it is there.
+ */
+static void
+produce_tuple_asynchronously(AsyncRequest *areq)
+{
+	ForeignScanState *node = (ForeignScanState *) areq->requestee;
+	ClickhouseFdwScanState *scan_state =
+		(ClickhouseFdwScanState *) node->fdw_state;
+	TupleTableSlot *result;
+
+	/* this runs the local conditions, and sends the query the first time */
+	result = ExecProcNode((PlanState *) node);
+	if (!TupIsNull(result) || scan_state->eof)
+	{
+		ExecAsyncRequestDone(areq, result);
+		return;
+	}
+
+	scan_state->fetch_fd = ch_query_prefetch(&scan_state->read);
+	if (scan_state->fetch_fd < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("clickhouse_fdw: %s", ch_last_error())));
+	ExecAsyncRequestPending(areq);
+}
+
+static void
+clickhouseForeignAsyncRequest(AsyncRequest *areq)
+{
+	/*
+	 * Produce one tuple asynchronously from the ForeignScan node. The
+	 * queries of all the scans of an Append are sent on the first request,
+	 * so ClickHouse runs them at once.
+	 */
+
+	produce_tuple_asynchronously(areq);
+}
+
+static void
+clickhouseForeignAsyncConfigureWait(AsyncRequest *areq)
+{
+	/*
+	 * Configure a file descriptor event for which the ForeignScan node wishes
+	 * to wait: the notification of the block being received.
+	 */
+
+	ForeignScanState *node = (ForeignScanState *) areq->requestee;
+	ClickhouseFdwScanState *scan_state =
+		(ClickhouseFdwScanState *) node->fdw_state;
+	AppendState *requestor = (AppendState *) areq->requestor;
+
+	Assert(areq->callback_pending);
+	Assert(scan_state->fetch_fd >= 0);
+
+	AddWaitEventToSet(requestor->as_eventset, WL_SOCKET_READABLE,
+					  scan_state->fetch_fd, NULL, areq);
+}
+
+static void
+clickhouseForeignAsyncNotify(AsyncRequest *areq)
+{
+	/*
+	 * Process a relevant event that has occurred, then produce one tuple
+	 * asynchronously from the ForeignScan node.
+	 */
+
+	produce_tuple_asynchronously(areq);
 }
+#endif
 
 
 #if (PG_VERSION_NUM >= 90300)
@@ -632,6 +2861,33 @@ clickhouseAddForeignUpdateTargets(Query *parsetree,
 }
 
 
+/*
+ * Attributes an INSERT sends: every column, since ClickHouse has no use for
+ * PostgreSQL defaults.
+ */
+static List *
+insert_target_attrs(Relation rel)
+{
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	List	   *target_attrs = NIL;
+	int			attnum;
+
+	for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+
+		if (attr->attisdropped)
+			continue;
+#if (PG_VERSION_NUM >= 120000)
+		if (attr->attgenerated)
+			continue;
+#endif
+		target_attrs = lappend_int(target_attrs, attnum);
+	}
+
+	return target_attrs;
+}
+
 static List *
 clickhousePlanForeignModify(PlannerInfo *root,
 						   ModifyTable *plan,
@@ -658,9 +2914,187 @@ clickhousePlanForeignModify(PlannerInfo *root,
 	 * BeginForeignModify will be NIL.
 	 */
 
+	RangeTblEntry *rte = planner_rt_fetch(resultRelation, root);
+	Relation	rel;
+	List	   *target_attrs;
+	StringInfoData sql;
+
 	elog(DEBUG1, "entering function %s", __func__);
 
-	return NULL;
+	if (plan->operation != CMD_INSERT)
+		return NIL;
+
+	/* the planner already holds a lock on the table */
+	rel = table_open(rte->relid, NoLock);
+
+	target_attrs = insert_target_attrs(rel);
+	initStringInfo(&sql);
+	chfdw_deparse_insert_sql(&sql, rel, target_attrs);
+
+	table_close(rel, NoLock);
+
+	return list_make2(makeString(sql.data), target_attrs);
+}
+
+
+/*
+ * Set up the state of an INSERT into a foreign table. The remote INSERT is
+ * only sent with the first row.
+ */
+static ClickhouseFdwModifyState *
+create_insert_state(Relation rel, Oid userid, char *sql, List *target_attrs)
+{
+	ClickhouseFdwModifyState *state = palloc0(sizeof(ClickhouseFdwModifyState));
+	ForeignTable *table = GetForeignTable(RelationGetRelid(rel));
+	StringInfoData partition_sql;
+	MemoryContextCallback *cleanup;
+
+	state->user = GetUserMapping(userid, table->serverid);
+	state->tupdesc = RelationGetDescr(rel);
+	state->target_attrs = target_attrs;
+	get_insert_block_size(table, &state->block_rows, &state->block_bytes);
+
+	state->insert.sql = sql;
+	state->insert.natts = list_length(target_attrs);
+	state->insert.columns = palloc0(sizeof(CHColumn) * state->insert.natts);
+	get_query_settings(table, state->insert.settings);
+
+	initStringInfo(&partition_sql);
+	chfdw_deparse_partition_key_sql(&partition_sql, rel);
+	state->relid = RelationGetRelid(rel);
+	state->partition_sql = partition_sql.data;
+
+	state->modify_cxt = CurrentMemoryContext;
+	state->temp_cxt = AllocSetContextCreate(CurrentMemoryContext,
+											"clickhouse_fdw insert",
+											ALLOCSET_DEFAULT_MINSIZE,
+											ALLOCSET_DEFAULT_INITSIZE,
+											ALLOCSET_DEFAULT_MAXSIZE);
+
+	/*
+	 * An INSERT that is abandoned by an error still holds its connection,
+	 * which is closed without finishing the INSERT. ClickHouse keeps the
+	 * blocks it has already received as parts of the table; only the block
+	 * being built is lost. The INSERT is not atomic.
+	 */
+	cleanup = palloc0(sizeof(MemoryContextCallback));
+	cleanup->func = clickhouseModifyCleanup;
+	cleanup->arg = state;
+	MemoryContextRegisterResetCallback(state->modify_cxt, cleanup);
+
+	return state;
+}
+
+static void
+clickhouseModifyCleanup(void *arg)
+{
+	ClickhouseFdwModifyState *state = (ClickhouseFdwModifyState *) arg;
+
+	if (state->conn)
+	{
+		abort_ch_insert(&state->insert);
+		chfdw_release_connection(state->conn, false);
+		state->conn = NULL;
+	}
+}
+
+/*
+ * Send the INSERT and choose the conversions of the columns ClickHouse
+ * describes in its answer.
+ */
+static void
+begin_remote_insert(ClickhouseFdwModifyState *state)
+{
+	MemoryContext oldcontext;
+	const char *partition_key;
+
+	oldcontext = MemoryContextSwitchTo(state->modify_cxt);
+
+	/*
+	 * The rows of a block are sent grouped by the partition key of the
+	 * table, if it has one, so that ClickHouse writes each group as one
+	 * part. Without it the blocks are sent as they are.
+	 */
+	partition_key = get_partition_key(state->relid, state->user,
+									  state->partition_sql);
+	state->insert.partitionKey = partition_key ? pstrdup(partition_key) : NULL;
+
+	state->conn = chfdw_get_connection(state->user, false);
+	state->insert.conn = state->conn->conn;
+	if (begin_ch_insert(&state->insert) < 0)
+	{
+		chfdw_release_connection(state->conn, false);
+		state->conn = NULL;
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+				 errmsg("could not start INSERT into ClickHouse"),
+				 errdetail_internal("%s", ch_last_error()),
+				 errcontext("remote SQL command: %s", state->insert.sql)));
+	}
+
+	/* a key the client could not use, the blocks are sent ungrouped */
+	if (partition_key != NULL && partition_key[0] != '\0' &&
+		state->insert.partitionKey == NULL)
+		elog(DEBUG1, "clickhouse_fdw: rows are not grouped by partition key \"%s\": %s",
+			 partition_key, ch_last_error());
+
+	state->inserters = chfdw_prepare_inserters(&state->insert, state->tupdesc,
+											   state->target_attrs);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Add the rows of slots to the block of the INSERT, and send the block when
+ * it is full.
+ */
+static void
+insert_remote_slots(ClickhouseFdwModifyState *state, TupleTableSlot **slots,
+					int nslots)
+{
+	MemoryContext oldcontext;
+
+	if (state->conn == NULL)
+		begin_remote_insert(state);
+
+	oldcontext = MemoryContextSwitchTo(state->temp_cxt);
+	chfdw_insert_slots(&state->insert, state->inserters, slots, nslots);
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(state->temp_cxt);
+
+	if (state->insert.blockRows >= state->block_rows ||
+		state->insert.blockBytes >= state->block_bytes)
+	{
+		if (flush_ch_insert(&state->insert) < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_ERROR),
+					 errmsg("could not send data to ClickHouse"),
+					 errdetail_internal("%s", ch_last_error()),
+					 errcontext("remote SQL command: %s", state->insert.sql)));
+	}
+}
+
+/*
+ * Send the rest of the rows and wait until ClickHouse has written them.
+ */
+static void
+end_remote_insert(ClickhouseFdwModifyState *state)
+{
+	ChConnection *conn = state->conn;
+	bool		ok;
+
+	if (conn == NULL)
+		return;
+
+	ok = end_ch_insert(&state->insert) == 0;
+	state->conn = NULL;
+	chfdw_release_connection(conn, ok);
+
+	if (!ok)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("could not insert into ClickHouse"),
+				 errdetail_internal("%s", ch_last_error()),
+				 errcontext("remote SQL command: %s", state->insert.sql)));
 }
 
 
@@ -697,15 +3131,40 @@ clickhouseBeginForeignModify(ModifyTableState *mtstate,
 	 * during executor startup.
 	 */
 
-	ClickhouseFdwModifyState *modify_state =
-		palloc0(sizeof(ClickhouseFdwModifyState));
-	rinfo->ri_FdwState = modify_state;
+	EState	   *estate = mtstate->ps.state;
+	Oid			userid;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
+	/* UPDATE and DELETE have nothing to prepare */
+	if (fdw_private == NIL || (eflags & EXEC_FLAG_EXPLAIN_ONLY))
+		return;
+
+	/*
+	 * Identify which user to do the remote access as. This should match what
+	 * ExecCheckRTEPerms() does.
+	 */
+#if PG_VERSION_NUM >= 160000
+	userid = ExecGetResultRelCheckAsUser(rinfo, estate);
+#else
+	{
+		RangeTblEntry *rte = rt_fetch(rinfo->ri_RangeTableIndex,
+									  estate->es_range_table);
+
+		userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+	}
+#endif
+
+	rinfo->ri_FdwState =
+		create_insert_state(rinfo->ri_RelationDesc, userid,
+							strVal(list_nth(fdw_private,
+											FdwModifyPrivateInsertSql)),
+							(List *) list_nth(fdw_private,
+											  FdwModifyPrivateTargetAttrs));
 }
 
 
+
 static TupleTableSlot *
 clickhouseExecForeignInsert(EState *estate,
 						   ResultRelInfo *rinfo,
@@ -737,129 +3196,845 @@ clickhouseExecForeignInsert(EState *estate,
 	 * If the ExecForeignInsert pointer is set to NULL, attempts to insert
 	 * into the foreign table will fail with an error message.
 	 *
+	 * Rows are collected into large blocks, ClickHouse writes a part for
+	 * every block it receives. RETURNING gets the row as it was given.
 	 */
 
-	/* ----
-	 * ClickhouseFdwModifyState *modify_state =
-	 *	 (ClickhouseFdwModifyState *) rinfo->ri_FdwState;
-	 * ----
+	ClickhouseFdwModifyState *modify_state =
+		(ClickhouseFdwModifyState *) rinfo->ri_FdwState;
+
+	insert_remote_slots(modify_state, &slot, 1);
+
+	return slot;
+}
+
+
+#if (PG_VERSION_NUM >= 140000)
+static TupleTableSlot **
+clickhouseExecForeignBatchInsert(EState *estate,
+								ResultRelInfo *rinfo,
+								TupleTableSlot **slots,
+								TupleTableSlot **planSlots,
+								int *numSlots)
+{
+	/*
+	 * Insert multiple tuples in bulk into the foreign table. The parameters
+	 * are the same as for ExecForeignInsert except slots and planSlots
+	 * contain multiple tuples and *numSlots specifies the number of tuples in
+	 * those arrays.
+	 *
+	 * The batch is added to the block of the INSERT in one pass per column.
+	 */
+
+	ClickhouseFdwModifyState *modify_state =
+		(ClickhouseFdwModifyState *) rinfo->ri_FdwState;
+
+	insert_remote_slots(modify_state, slots, *numSlots);
+
+	return slots;
+}
+
+static int
+clickhouseGetForeignModifyBatchSize(ResultRelInfo *rinfo)
+{
+	/*
+	 * Report the maximum number of tuples that a single
+	 * ExecForeignBatchInsert call can handle for the specified foreign table.
+	 * The executor passes at most the given number of tuples to
+	 * ExecForeignBatchInsert.
+	 *
+	 * Rows that RETURNING or row triggers need one at a time are inserted
+	 * one by one.
+	 */
+
+	ForeignTable *table;
+	const char *value;
+
+	elog(DEBUG1, "entering function %s", __func__);
+
+	if (rinfo->ri_projectReturning != NULL ||
+		(rinfo->ri_TrigDesc &&
+		 (rinfo->ri_TrigDesc->trig_insert_before_row ||
+		  rinfo->ri_TrigDesc->trig_insert_after_row)))
+		return 1;
+
+	table = GetForeignTable(RelationGetRelid(rinfo->ri_RelationDesc));
+	value = get_table_option(table, "batch_size");
+
+	return value ? (int) strtol(value, NULL, 10) : CH_INSERT_BATCH_SIZE;
+}
+#endif
+
+
+static TupleTableSlot *
+clickhouseExecForeignUpdate(EState *estate,
+						   ResultRelInfo *rinfo,
+						   TupleTableSlot *slot,
+						   TupleTableSlot *planSlot)
+{
+	/*
+	 * Update one tuple in the foreign table. estate is global execution state
+	 * for the query. rinfo is the ResultRelInfo struct describing the target
+	 * foreign table. slot contains the new data for the tuple; it will match
+	 * the rowtype definition of the foreign table. planSlot contains the
+	 * tuple that was generated by the ModifyTable plan node's subplan; it
+	 * differs from slot in possibly containing additional "junk" columns. In
+	 * particular, any junk columns that were requested by
+	 * AddForeignUpdateTargets will be available from this slot.
+	 *
+	 * The return value is either a slot containing the row as it was actually
+	 * updated (this might differ from the data supplied, for example as a
+	 * result of trigger actions), or NULL if no row was actually updated
+	 * (again, typically as a result of triggers). The passed-in slot can be
+	 * re-used for this purpose.
+	 *
+	 * The data in the returned slot is used only if the UPDATE query has a
+	 * RETURNING clause. Hence, the FDW could choose to optimize away
+	 * returning some or all columns depending on the contents of the
+	 * RETURNING clause. However, some slot must be returned to indicate
+	 * success, or the query's reported rowcount will be wrong.
+	 *
+	 * If the ExecForeignUpdate pointer is set to NULL, attempts to update the
+	 * foreign table will fail with an error message.
+	 *
+	 * ClickHouse rows have no identity, an UPDATE can only run as a whole
+	 * mutation, see clickhousePlanDirectModify.
+	 */
+
+	elog(DEBUG1, "entering function %s", __func__);
+
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("cannot update rows of ClickHouse foreign table \"%s\" one by one",
+					RelationGetRelationName(rinfo->ri_RelationDesc)),
+			 errhint("An UPDATE whose conditions and new values ClickHouse can evaluate, without RETURNING, runs as a mutation.")));
+
+	return slot;
+}
+
+
+static TupleTableSlot *
+clickhouseExecForeignDelete(EState *estate,
+						   ResultRelInfo *rinfo,
+						   TupleTableSlot *slot,
+						   TupleTableSlot *planSlot)
+{
+	/*
+	 * Delete one tuple from the foreign table. estate is global execution
+	 * state for the query. rinfo is the ResultRelInfo struct describing the
+	 * target foreign table. slot contains nothing useful upon call, but can
+	 * be used to hold the returned tuple. planSlot contains the tuple that
+	 * was generated by the ModifyTable plan node's subplan; in particular, it
+	 * will carry any junk columns that were requested by
+	 * AddForeignUpdateTargets. The junk column(s) must be used to identify
+	 * the tuple to be deleted.
+	 *
+	 * The return value is either a slot containing the row that was deleted,
+	 * or NULL if no row was deleted (typically as a result of triggers). The
+	 * passed-in slot can be used to hold the tuple to be returned.
+	 *
+	 * The data in the returned slot is used only if the DELETE query has a
+	 * RETURNING clause. Hence, the FDW could choose to optimize away
+	 * returning some or all columns depending on the contents of the
+	 * RETURNING clause. However, some slot must be returned to indicate
+	 * success, or the query's reported rowcount will be wrong.
+	 *
+	 * If the ExecForeignDelete pointer is set to NULL, attempts to delete
+	 * from the foreign table will fail with an error message.
+	 *
+	 * ClickHouse rows have no identity, a DELETE can only run as a whole
+	 * mutation, see clickhousePlanDirectModify.
+	 */
+
+	elog(DEBUG1, "entering function %s", __func__);
+
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("cannot delete rows of ClickHouse foreign table \"%s\" one by one",
+					RelationGetRelationName(rinfo->ri_RelationDesc)),
+			 errhint("A DELETE whose conditions ClickHouse can evaluate, without RETURNING, runs as a mutation.")));
+
+	return slot;
+}
+
+
+static void
+clickhouseEndForeignModify(EState *estate,
+						  ResultRelInfo *rinfo)
+{
+	/*
+	 * End the table update and release resources. It is normally not
+	 * important to release palloc'd memory, but for example open files and
+	 * connections to remote servers should be cleaned up.
+	 *
+	 * If the EndForeignModify pointer is set to NULL, no action is taken
+	 * during executor shutdown.
+	 */
+
+	ClickhouseFdwModifyState *modify_state =
+		(ClickhouseFdwModifyState *) rinfo->ri_FdwState;
+
+	elog(DEBUG1, "entering function %s", __func__);
+
+	if (modify_state)
+		end_remote_insert(modify_state);
+}
+
+#if (PG_VERSION_NUM >= 90600)
+/*
+ * The ForeignScan of the foreign table the ModifyTable plan modifies, NULL
+ * if the table is not scanned by a ForeignScan of its own.
+ */
+static ForeignScan *
+find_modifytable_subplan(PlannerInfo *root, ModifyTable *plan, Index rtindex,
+						 int subplan_index)
+{
+#if (PG_VERSION_NUM >= 140000)
+	Plan	   *subplan = outerPlan(plan);
+
+	/*
+	 * The ForeignScan is either the child of the ModifyTable, or the
+	 * subplan_index'th child of an Append (under a Result) that is.
+	 */
+	if (IsA(subplan, Result) && outerPlan(subplan) != NULL &&
+		IsA(outerPlan(subplan), Append))
+		subplan = outerPlan(subplan);
+	if (IsA(subplan, Append))
+	{
+		Append	   *appendplan = (Append *) subplan;
+
+		if (subplan_index < list_length(appendplan->appendplans))
+			subplan = (Plan *) list_nth(appendplan->appendplans, subplan_index);
+	}
+#else
+	Plan	   *subplan = (Plan *) list_nth(plan->plans, subplan_index);
+#endif
+
+	if (IsA(subplan, ForeignScan) &&
+		((ForeignScan *) subplan)->scan.scanrelid == rtindex)
+		return (ForeignScan *) subplan;
+
+	return NULL;
+}
+
+/*
+ * Whether the remote columns of the attributes are all Nullable without a
+ * default, so that a remote INSERT leaving them out stores NULL in them.
+ * False as well when ClickHouse cannot tell.
+ */
+static bool
+remote_columns_nullable(ForeignTable *table, Oid userid, Relation rel,
+						List *attnums)
+{
+	UserMapping *user = GetUserMapping(userid, table->serverid);
+	StringInfoData sql;
+	List	   *rows;
+	ListCell   *lc;
+
+	initStringInfo(&sql);
+	chfdw_deparse_columns_sql(&sql, rel);
+	if (!fetch_remote_rows(user, sql.data, 3, &rows))
+		return false;
+
+	foreach(lc, attnums)
+	{
+		Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel),
+											   lfirst_int(lc) - 1);
+		bool		nullable = false;
+		ListCell   *lc2;
+
+		foreach(lc2, rows)
+		{
+			char	  **values = (char **) lfirst(lc2);
+
+			if (values[0] != NULL &&
+				strcmp(values[0], NameStr(attr->attname)) == 0)
+			{
+				nullable = values[1] != NULL &&
+					strncmp(values[1], "Nullable(", 9) == 0 &&
+					(values[2] == NULL || values[2][0] == '\0');
+				break;
+			}
+		}
+
+		if (!nullable)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Plan an INSERT whose rows come from a query ClickHouse computes, on the
+ * server of the target table, as one remote INSERT ... SELECT. The query
+ * must return the attributes of the target table as they are, each of its
+ * columns going to one attribute. An attribute the INSERT leaves NULL is
+ * left out of the remote INSERT, which gives it the ClickHouse default; that
+ * is only NULL for a Nullable column without a default, other columns keep
+ * the local INSERT.
+ */
+static bool
+plan_insert_select(PlannerInfo *root, ModifyTable *plan, Index resultRelation,
+				   int subplan_index)
+{
+	RangeTblEntry *rte = planner_rt_fetch(resultRelation, root);
+	ForeignTable *table = GetForeignTable(rte->relid);
+	ForeignScan *fscan;
+	Relation	rel;
+	List	   *retrieved_attrs;
+	List	   *target_attrs;
+	int			nremote;
+	int		   *remote_attnums;
+	List	   *insert_attrs = NIL;
+	List	   *null_attrs = NIL;
+	Oid			source_userid;
+	Oid			target_userid;
+	char	   *target;
+	bool		ok = true;
+	int			i;
+	ListCell   *lc;
+	StringInfoData sql;
+
+#if (PG_VERSION_NUM >= 140000)
+	fscan = (ForeignScan *) outerPlan(plan);
+#else
+	fscan = (ForeignScan *) list_nth(plan->plans, subplan_index);
+#endif
+	if (!IsA(fscan, ForeignScan) || fscan->operation != CMD_SELECT ||
+		fscan->fs_server != table->serverid ||
+		fscan->scan.plan.qual != NIL || fscan->fdw_exprs != NIL)
+		return false;
+
+	if (plan->onConflictAction != ONCONFLICT_NONE ||
+		plan->returningLists != NIL)
+		return false;
+
+	/* both statements run as one, on the connection of one user */
+#if PG_VERSION_NUM >= 160000
+	source_userid = fscan->checkAsUser;
+	target_userid = getRTEPermissionInfo(root->parse->rteperminfos,
+										 rte)->checkAsUser;
+#else
+	source_userid = planner_rt_fetch(fscan->scan.scanrelid > 0 ?
+									 fscan->scan.scanrelid :
+									 bms_next_member(fscan->fs_relids, -1),
+									 root)->checkAsUser;
+	target_userid = rte->checkAsUser;
+#endif
+	if (source_userid != target_userid)
+		return false;
+
+	/*
+	 * The columns of the remote query: attributes of the scanned table, or
+	 * positions in fdw_scan_tlist for a join or an aggregation.
+	 */
+	retrieved_attrs = (List *) list_nth(fscan->fdw_private,
+										FdwScanPrivateRetrievedAttrs);
+	nremote = list_length(retrieved_attrs);
+	remote_attnums = palloc0(sizeof(int) * Max(nremote, 1));
+
+	/* the planner already holds a lock on the table */
+	rel = table_open(rte->relid, NoLock);
+	target_attrs = insert_target_attrs(rel);
+
+	foreach(lc, target_attrs)
+	{
+		int			attnum = lfirst_int(lc);
+		TargetEntry *tle = get_tle_by_resno(fscan->scan.plan.targetlist, attnum);
+		Expr	   *expr = tle ? tle->expr : NULL;
+		int			column = 0;
+		int			pos = 0;
+		ListCell   *lc2;
+
+		if (expr == NULL)
+		{
+			ok = false;
+			break;
+		}
+
+		/* left NULL, checked against the remote columns below */
+		if (IsA(expr, Const) && ((Const *) expr)->constisnull)
+		{
+			null_attrs = lappend_int(null_attrs, attnum);
+			continue;
+		}
+
+		if (exprType((Node *) expr) !=
+			TupleDescAttr(RelationGetDescr(rel), attnum - 1)->atttypid)
+		{
+			ok = false;
+			break;
+		}
+
+		/* the attribute of the table, or the entry of fdw_scan_tlist */
+		if (fscan->scan.scanrelid > 0)
+		{
+			Var		   *var = (Var *) expr;
+
+			if (IsA(var, Var) && var->varno == fscan->scan.scanrelid &&
+				var->varlevelsup == 0 && var->varattno > 0)
+				column = var->varattno;
+		}
+		else
+		{
+			i = 0;
+			foreach(lc2, fscan->fdw_scan_tlist)
+			{
+				i++;
+				if (equal(((TargetEntry *) lfirst(lc2))->expr, expr))
+				{
+					column = i;
+					break;
+				}
+			}
+		}
+
+		i = 0;
+		foreach(lc2, retrieved_attrs)
+		{
+			i++;
+			if (column != 0 && lfirst_int(lc2) == column)
+				pos = i;
+		}
+
+		if (pos == 0 || remote_attnums[pos - 1] != 0)
+		{
+			ok = false;
+			break;
+		}
+		remote_attnums[pos - 1] = attnum;
+	}
+
+	/* every column of the remote query goes to an attribute */
+	for (i = 0; ok && i < nremote; i++)
+	{
+		if (remote_attnums[i] == 0)
+			ok = false;
+		else
+			insert_attrs = lappend_int(insert_attrs, remote_attnums[i]);
+	}
+
+	/* ClickHouse cannot INSERT without a column */
+	if (insert_attrs == NIL)
+		ok = false;
+
+	if (ok && null_attrs != NIL)
+		ok = remote_columns_nullable(table,
+									 OidIsValid(target_userid) ?
+									 target_userid : GetUserId(),
+									 rel, null_attrs);
+
+	if (ok)
+	{
+		initStringInfo(&sql);
+		chfdw_deparse_insert_select_sql(&sql, rel, insert_attrs,
+										strVal(list_nth(fscan->fdw_private,
+														FdwScanPrivateSelectSql)));
+
+		fscan->operation = CMD_INSERT;
+#if (PG_VERSION_NUM >= 140000)
+		fscan->resultRelation = resultRelation;
+#endif
+
+		/*
+		 * The ForeignScan is still that of the query, EXPLAIN shows it as a
+		 * Foreign Insert on the scanned table, so the target is named too.
+		 */
+		target = quote_qualified_identifier(get_namespace_name(RelationGetNamespace(rel)),
+											RelationGetRelationName(rel));
+		fscan->fdw_private = list_make3(makeString(sql.data),
+										makeInteger(plan->canSetTag),
+										makeString(target));
+	}
+
+	table_close(rel, NoLock);
+
+	return ok;
+}
+
+static bool
+clickhousePlanDirectModify(PlannerInfo *root,
+						   ModifyTable *plan,
+						   Index resultRelation,
+						   int subplan_index)
+{
+	/*
+	 * Decide whether it is safe to execute a direct modification on the
+	 * remote server. If so, return true after performing planning actions
+	 * needed for that. Otherwise, return false.
+	 *
+	 * ClickHouse rows have no identity, so UPDATE and DELETE only run as a
+	 * mutation of all rows meeting the conditions of the scan, which then
+	 * must all be evaluated by ClickHouse. Mutations return no rows, so
+	 * there is no RETURNING. An INSERT from a query ClickHouse computes
+	 * runs as a remote INSERT ... SELECT, see plan_insert_select.
 	 */
 
+	CmdType		operation = plan->operation;
+	ForeignScan *fscan;
+	RelOptInfo *foreignrel;
+	RangeTblEntry *rte;
+	ClickhouseFdwPlanState *fpinfo;
+	Relation	rel;
+	List	   *target_attrs = NIL;
+	List	   *target_exprs = NIL;
+	ListCell   *lc;
+	StringInfoData sql;
+
+	elog(DEBUG1, "entering function %s", __func__);
+
+	if (operation == CMD_INSERT)
+		return plan_insert_select(root, plan, resultRelation, subplan_index);
+
+	if (operation != CMD_UPDATE && operation != CMD_DELETE)
+		return false;
+
+	fscan = find_modifytable_subplan(root, plan, resultRelation, subplan_index);
+	if (fscan == NULL || fscan->scan.plan.qual != NIL)
+		return false;
+
+	if (plan->returningLists != NIL)
+		return false;
+
+	foreignrel = root->simple_rel_array[resultRelation];
+	rte = root->simple_rte_array[resultRelation];
+	fpinfo = (ClickhouseFdwPlanState *) foreignrel->fdw_private;
+
+	if (operation == CMD_UPDATE)
+	{
+#if (PG_VERSION_NUM >= 140000)
+		List	   *processed_tlist = NIL;
+
+		get_translated_update_targetlist(root, resultRelation,
+										 &processed_tlist, &target_attrs);
+		foreach(lc, processed_tlist)
+			target_exprs = lappend(target_exprs,
+								   ((TargetEntry *) lfirst(lc))->expr);
+#else
+		int			col = -1;
+
+		while ((col = bms_next_member(rte->updatedCols, col)) >= 0)
+		{
+			AttrNumber	attno = col + FirstLowInvalidHeapAttributeNumber;
+			TargetEntry *tle;
+
+			if (attno <= InvalidAttrNumber)
+				elog(ERROR, "system-column update is not supported");
+
+			tle = get_tle_by_resno(fscan->scan.plan.targetlist, attno);
+			if (tle == NULL)
+				elog(ERROR, "attribute number %d not found in UPDATE targetlist",
+					 attno);
+
+			target_attrs = lappend_int(target_attrs, attno);
+			target_exprs = lappend(target_exprs, tle->expr);
+		}
+#endif
+
+		foreach(lc, target_attrs)
+		{
+			if (lfirst_int(lc) <= InvalidAttrNumber)
+				elog(ERROR, "system-column update is not supported");
+		}
+		foreach(lc, target_exprs)
+		{
+			if (!chfdw_is_foreign_expr(root, foreignrel, (Expr *) lfirst(lc)))
+				return false;
+		}
+	}
+
+	/* the planner already holds a lock on the table */
+	rel = table_open(rte->relid, NoLock);
+
+	initStringInfo(&sql);
+	chfdw_deparse_direct_modify_sql(&sql, root, foreignrel, rel, operation,
+									target_attrs, target_exprs,
+									fpinfo->remote_conds);
+
+	table_close(rel, NoLock);
+
+	fscan->operation = operation;
+#if (PG_VERSION_NUM >= 140000)
+	fscan->resultRelation = resultRelation;
+#endif
+	fscan->fdw_private = list_make3(makeString(sql.data),
+									makeInteger(plan->canSetTag),
+									makeString(""));
+
+	return true;
+}
+
+static void
+clickhouseBeginDirectModify(ForeignScanState *node, int eflags)
+{
+	/*
+	 * Prepare to execute a direct modification on the remote server. This is
+	 * called during executor startup. It should perform any initialization
+	 * needed prior to the direct modification (that should be done upon the
+	 * first call to IterateDirectModify).
+	 */
+
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+	EState	   *estate = node->ss.ps.state;
+	ClickhouseFdwDirectModifyState *dmstate;
+	RangeTblEntry *rte;
+	ForeignTable *table;
+	Index		rtindex;
+	Oid			userid;
+
+	elog(DEBUG1, "entering function %s", __func__);
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	dmstate = palloc0(sizeof(ClickhouseFdwDirectModifyState));
+	node->fdw_state = dmstate;
+
+	/* the target table, not the scanned one of an INSERT ... SELECT */
+#if (PG_VERSION_NUM >= 140000)
+	rtindex = node->resultRelInfo->ri_RangeTableIndex;
+#else
+	rtindex = estate->es_result_relation_info->ri_RangeTableIndex;
+#endif
+	rte = rt_fetch(rtindex, estate->es_range_table);
+
+	/*
+	 * Identify which user to do the remote access as. This should match what
+	 * ExecCheckRTEPerms() does.
+	 */
+#if PG_VERSION_NUM >= 160000
+	userid = OidIsValid(fsplan->checkAsUser) ? fsplan->checkAsUser : GetUserId();
+#else
+	userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+#endif
+	table = GetForeignTable(rte->relid);
+	dmstate->user = GetUserMapping(userid, table->serverid);
+	get_query_settings(table, dmstate->settings);
+
+	/*
+	 * A mutation returns before it is applied unless ClickHouse is asked to
+	 * wait for it on all replicas, so the statement behaves like the UPDATE
+	 * or DELETE it stands for. It goes first in the settings of the server,
+	 * where any of the lists can override it.
+	 */
+	if (fsplan->operation == CMD_UPDATE || fsplan->operation == CMD_DELETE)
+		dmstate->settings[0] = dmstate->settings[0] ?
+			psprintf("mutations_sync = 2, %s", dmstate->settings[0]) :
+			"mutations_sync = 2";
+
+	dmstate->sql = strVal(list_nth(fsplan->fdw_private,
+								   FdwDirectModifyPrivateUpdateSql));
+	dmstate->set_processed = intVal(list_nth(fsplan->fdw_private,
+											 FdwDirectModifyPrivateSetProcessed));
+}
+
+/*
+ * Run a statement on ClickHouse and return the rows the server reported
+ * written by it, zero if it reported none.
+ */
+static uint64
+execute_remote_statement(UserMapping *user, const char **settings, char *sql)
+{
+	ChConnection *conn = chfdw_get_connection(user, false);
+	CHReadCtx	read;
+	bool		reusable;
+	int			rc;
+
+	MemSet(&read, 0, sizeof(read));
+	read.sql = sql;
+	read.natts = 0;
+	read.conn = conn->conn;
+	memcpy(read.settings, settings, sizeof(read.settings));
+
+	rc = begin_ch_query(&read);
+	while (rc == 0 && (rc = read_ch_query(&read)) > 0)
+		rc = 0;
+
+	if (rc < 0)
+	{
+		end_ch_query(&read);
+		chfdw_release_connection(conn, false);
+		CHECK_FOR_INTERRUPTS();
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("could not execute ClickHouse query"),
+				 errdetail_internal("%s", ch_last_error()),
+				 errcontext("remote SQL command: %s", sql)));
+	}
+
+	reusable = end_ch_query(&read) == 0;
+	chfdw_release_connection(conn, reusable);
+
+	return read.writtenRows;
+}
+
+static TupleTableSlot *
+clickhouseIterateDirectModify(ForeignScanState *node)
+{
+	/*
+	 * Execute the direct modification on the remote server. The row count
+	 * is what the server reports written in the progress of the statement.
+	 * A mutation usually reports none, and then counts as zero rows rather
+	 * than paying for a second scan with the same conditions. The mutation
+	 * is waited for, see clickhouseBeginDirectModify.
+	 */
+
+	ClickhouseFdwDirectModifyState *dmstate =
+		(ClickhouseFdwDirectModifyState *) node->fdw_state;
+	EState	   *estate = node->ss.ps.state;
+	Instrumentation *instr = node->ss.ps.instrument;
+	uint64		count;
+
+	if (!dmstate->done)
+	{
+		count = execute_remote_statement(dmstate->user, dmstate->settings,
+										 dmstate->sql);
+		dmstate->done = true;
+
+		if (dmstate->set_processed)
+			estate->es_processed += count;
+		if (instr)
+			instr->tuplecount += count;
+	}
+
+	return ExecClearTuple(node->ss.ss_ScanTupleSlot);
+}
+
+static void
+clickhouseEndDirectModify(ForeignScanState *node)
+{
+	/*
+	 * Clean up following a direct modification on the remote server. The
+	 * connections are back in the cache once each statement has run.
+	 */
+
+	elog(DEBUG1, "entering function %s", __func__);
+}
+
+static void
+clickhouseExplainDirectModify(ForeignScanState *node,
+							 struct ExplainState *es)
+{
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+
 	elog(DEBUG1, "entering function %s", __func__);
 
-	return slot;
+	if (fsplan->operation == CMD_INSERT)
+		ExplainPropertyText("Insert target",
+							strVal(list_nth(fsplan->fdw_private,
+											FdwDirectModifyPrivateTarget)),
+							es);
+	if (es->verbose)
+		ExplainPropertyText("ClickHouse query",
+							strVal(list_nth(fsplan->fdw_private,
+											FdwDirectModifyPrivateUpdateSql)),
+							es);
 }
+#endif
 
-
-static TupleTableSlot *
-clickhouseExecForeignUpdate(EState *estate,
-						   ResultRelInfo *rinfo,
-						   TupleTableSlot *slot,
-						   TupleTableSlot *planSlot)
+#if (PG_VERSION_NUM >= 140000)
+static void
+clickhouseExecForeignTruncate(List *rels,
+							  DropBehavior behavior,
+							  bool restart_seqs)
 {
 	/*
-	 * Update one tuple in the foreign table. estate is global execution state
-	 * for the query. rinfo is the ResultRelInfo struct describing the target
-	 * foreign table. slot contains the new data for the tuple; it will match
-	 * the rowtype definition of the foreign table. planSlot contains the
-	 * tuple that was generated by the ModifyTable plan node's subplan; it
-	 * differs from slot in possibly containing additional "junk" columns. In
-	 * particular, any junk columns that were requested by
-	 * AddForeignUpdateTargets will be available from this slot.
-	 *
-	 * The return value is either a slot containing the row as it was actually
-	 * updated (this might differ from the data supplied, for example as a
-	 * result of trigger actions), or NULL if no row was actually updated
-	 * (again, typically as a result of triggers). The passed-in slot can be
-	 * re-used for this purpose.
-	 *
-	 * The data in the returned slot is used only if the UPDATE query has a
-	 * RETURNING clause. Hence, the FDW could choose to optimize away
-	 * returning some or all columns depending on the contents of the
-	 * RETURNING clause. However, some slot must be returned to indicate
-	 * success, or the query's reported rowcount will be wrong.
-	 *
-	 * If the ExecForeignUpdate pointer is set to NULL, attempts to update the
-	 * foreign table will fail with an error message.
-	 *
+	 * Truncate foreign tables. The core calls this once for the tables of
+	 * each foreign server, which are truncated one after the other on the
+	 * same cached connection. ClickHouse has neither foreign keys nor
+	 * sequences, so behavior and restart_seqs make no difference.
 	 */
 
-	/* ----
-	 * ClickhouseFdwModifyState *modify_state =
-	 *	 (ClickhouseFdwModifyState *) rinfo->ri_FdwState;
-	 * ----
-	 */
+	ListCell   *lc;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
-	return slot;
+	foreach(lc, rels)
+	{
+		Relation	rel = (Relation) lfirst(lc);
+		ForeignTable *table = GetForeignTable(RelationGetRelid(rel));
+		UserMapping *user = GetUserMapping(GetUserId(), table->serverid);
+		const char *settings[CH_SETTINGS_LISTS];
+		StringInfoData sql;
+
+		get_query_settings(table, settings);
+
+		initStringInfo(&sql);
+		chfdw_deparse_truncate_sql(&sql, rel);
+		execute_remote_statement(user, settings, sql.data);
+		pfree(sql.data);
+	}
 }
+#endif
 
-
-static TupleTableSlot *
-clickhouseExecForeignDelete(EState *estate,
-						   ResultRelInfo *rinfo,
-						   TupleTableSlot *slot,
-						   TupleTableSlot *planSlot)
+#if (PG_VERSION_NUM >= 110000)
+static void
+clickhouseBeginForeignInsert(ModifyTableState *mtstate,
+							ResultRelInfo *rinfo)
 {
 	/*
-	 * Delete one tuple from the foreign table. estate is global execution
-	 * state for the query. rinfo is the ResultRelInfo struct describing the
-	 * target foreign table. slot contains nothing useful upon call, but can
-	 * be used to hold the returned tuple. planSlot contains the tuple that
-	 * was generated by the ModifyTable plan node's subplan; in particular, it
-	 * will carry any junk columns that were requested by
-	 * AddForeignUpdateTargets. The junk column(s) must be used to identify
-	 * the tuple to be deleted.
-	 *
-	 * The return value is either a slot containing the row that was deleted,
-	 * or NULL if no row was deleted (typically as a result of triggers). The
-	 * passed-in slot can be used to hold the tuple to be returned.
-	 *
-	 * The data in the returned slot is used only if the DELETE query has a
-	 * RETURNING clause. Hence, the FDW could choose to optimize away
-	 * returning some or all columns depending on the contents of the
-	 * RETURNING clause. However, some slot must be returned to indicate
-	 * success, or the query's reported rowcount will be wrong.
+	 * Begin executing an insert operation on a foreign table. This routine is
+	 * called right before the first tuple is inserted into the foreign table
+	 * in both cases when it is the partition chosen for tuple routing and the
+	 * target specified in a COPY FROM command. Subsequently,
+	 * ExecForeignInsert is called for each tuple to be inserted.
 	 *
-	 * If the ExecForeignDelete pointer is set to NULL, attempts to delete
-	 * from the foreign table will fail with an error message.
+	 * The rows go through the same native blocks as those of an INSERT, with
+	 * one remote INSERT for all rows routed into the table.
 	 */
 
-	/* ----
-	 * ClickhouseFdwModifyState *modify_state =
-	 *	 (ClickhouseFdwModifyState *) rinfo->ri_FdwState;
-	 * ----
-	 */
+	EState	   *estate = mtstate->ps.state;
+	Relation	rel = rinfo->ri_RelationDesc;
+	List	   *target_attrs;
+	StringInfoData sql;
+	Oid			userid;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
-	return slot;
-}
+	/*
+	 * Identify which user to do the remote access as. COPY has no range
+	 * table entry with a checkAsUser, it runs as the current user.
+	 */
+#if PG_VERSION_NUM >= 160000
+	userid = ExecGetResultRelCheckAsUser(rinfo, estate);
+#else
+	userid = GetUserId();
+	if (rinfo->ri_RangeTableIndex > 0)
+	{
+		RangeTblEntry *rte = rt_fetch(rinfo->ri_RangeTableIndex,
+									  estate->es_range_table);
+
+		if (rte->checkAsUser)
+			userid = rte->checkAsUser;
+	}
+#endif
+
+	target_attrs = insert_target_attrs(rel);
+	initStringInfo(&sql);
+	chfdw_deparse_insert_sql(&sql, rel, target_attrs);
 
+	rinfo->ri_FdwState = create_insert_state(rel, userid, sql.data,
+											 target_attrs);
+}
 
 static void
-clickhouseEndForeignModify(EState *estate,
+clickhouseEndForeignInsert(EState *estate,
 						  ResultRelInfo *rinfo)
 {
 	/*
-	 * End the table update and release resources. It is normally not
-	 * important to release palloc'd memory, but for example open files and
-	 * connections to remote servers should be cleaned up.
-	 *
-	 * If the EndForeignModify pointer is set to NULL, no action is taken
-	 * during executor shutdown.
+	 * End the insert operation and release resources. The rows still in the
+	 * block are sent, and ClickHouse confirms it has written all of them.
 	 */
 
-	/* ----
-	 * ClickhouseFdwModifyState *modify_state =
-	 *	 (ClickhouseFdwModifyState *) rinfo->ri_FdwState;
-	 * ----
-	 */
+	ClickhouseFdwModifyState *modify_state =
+		(ClickhouseFdwModifyState *) rinfo->ri_FdwState;
 
 	elog(DEBUG1, "entering function %s", __func__);
 
+	if (modify_state)
+		end_remote_insert(modify_state);
 }
+#endif
 
 static int
 clickhouseIsForeignRelUpdatable(Relation rel)
@@ -903,8 +4078,25 @@ clickhouseExplainForeignScan(ForeignScanState *node,
 	 * information is printed during EXPLAIN.
 	 */
 
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+
 	elog(DEBUG1, "entering function %s", __func__);
 
+	if (es->verbose)
+	{
+		List	   *chunk_sqls = (List *) list_nth(fsplan->fdw_private,
+												   FdwScanPrivateChunkSqls);
+
+		ExplainPropertyText("ClickHouse query",
+							strVal(list_nth(fsplan->fdw_private,
+											FdwScanPrivateSelectSql)),
+							es);
+#if (PG_VERSION_NUM >= 110000)
+		if (chunk_sqls != NIL)
+			ExplainPropertyInteger("ClickHouse chunks", NULL,
+								   list_length(chunk_sqls), es);
+#endif
+	}
 }
 
 
@@ -928,19 +4120,194 @@ clickhouseExplainForeignModify(ModifyTableState *mtstate,
 	 * information is printed during EXPLAIN.
 	 */
 
-	/* ----
-	 * ClickhouseFdwModifyState *modify_state =
-	 *	 (ClickhouseFdwModifyState *) rinfo->ri_FdwState;
-	 * ----
-	 */
-
 	elog(DEBUG1, "entering function %s", __func__);
 
+	if (es->verbose && fdw_private != NIL)
+		ExplainPropertyText("ClickHouse query",
+							strVal(list_nth(fdw_private,
+											FdwModifyPrivateInsertSql)),
+							es);
 }
 #endif
 
 
 #if (PG_VERSION_NUM >= 90200)
+/*
+ * Statistics target of an attribute: zero if ANALYZE skips it, as it does
+ * dropped attributes, -1 for default_statistics_target.
+ */
+static int
+attribute_stats_target(Relation relation, int attnum)
+{
+	Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(relation),
+										   attnum - 1);
+#if (PG_VERSION_NUM >= 170000)
+	HeapTuple	tuple;
+	Datum		target;
+	bool		isnull;
+#endif
+
+	if (attr->attisdropped)
+		return 0;
+
+#if (PG_VERSION_NUM >= 170000)
+	tuple = SearchSysCache2(ATTNUM,
+							ObjectIdGetDatum(RelationGetRelid(relation)),
+							Int16GetDatum(attnum));
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "cache lookup failed for attribute %d of relation %u",
+			 attnum, RelationGetRelid(relation));
+	target = SysCacheGetAttr(ATTNUM, tuple, Anum_pg_attribute_attstattarget,
+							 &isnull);
+	ReleaseSysCache(tuple);
+
+	return isnull ? -1 : DatumGetInt16(target);
+#else
+	return attr->attstattarget;
+#endif
+}
+
+/*
+ * Sample the remote table of a foreign table for ANALYZE. ClickHouse picks
+ * the sample, so that only targrows rows of the analyzed columns are sent;
+ * the other columns are NULL in the sample rows.
+ */
+static int
+clickhouseAcquireSampleRows(Relation relation, int elevel,
+							HeapTuple *rows, int targrows,
+							double *totalrows,
+							double *totaldeadrows)
+{
+	TupleDesc	tupdesc = RelationGetDescr(relation);
+	ForeignTable *table = GetForeignTable(RelationGetRelid(relation));
+	UserMapping *user = GetUserMapping(relation->rd_rel->relowner,
+									   table->serverid);
+	Bitmapset  *attrs_used = NULL;
+	List	   *retrieved_attrs;
+	List	   *info;
+	StringInfoData sql;
+	ChConnection *conn;
+	CHReadCtx	read;
+	ChConverter *convs = NULL;
+	MemoryContext tmp_cxt;
+	Datum	   *values;
+	bool	   *nulls;
+	bool		has_sampling_key = false;
+	int			numrows = 0;
+	int			i;
+
+	*totalrows = 0;
+	*totaldeadrows = 0;
+
+	initStringInfo(&sql);
+	chfdw_deparse_analyze_info_sql(&sql, relation);
+	if (!fetch_remote_rows(user, sql.data, 2, &info) || info == NIL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("could not get the size of table \"%s\" from ClickHouse",
+						RelationGetRelationName(relation)),
+				 errdetail_internal("%s", ch_last_error())));
+	else
+	{
+		char	  **row = (char **) linitial(info);
+
+		if (row[0] != NULL)
+			*totalrows = strtod(row[0], NULL);
+		has_sampling_key = row[1] != NULL && row[1][0] != '\0';
+	}
+
+	for (i = 1; i <= tupdesc->natts; i++)
+	{
+		if (attribute_stats_target(relation, i) != 0)
+			attrs_used = bms_add_member(attrs_used,
+										i - FirstLowInvalidHeapAttributeNumber);
+	}
+
+	resetStringInfo(&sql);
+	chfdw_deparse_analyze_sql(&sql, relation, attrs_used, *totalrows,
+							  has_sampling_key, targrows, &retrieved_attrs);
+
+	MemSet(&read, 0, sizeof(read));
+	read.sql = sql.data;
+	read.natts = list_length(retrieved_attrs);
+	read.columns = palloc0(sizeof(CHColumn) * read.natts);
+	read.maxBlockSize = get_fetch_size(table);
+	get_query_settings(table, read.settings);
+	values = palloc(sizeof(Datum) * tupdesc->natts);
+	nulls = palloc(sizeof(bool) * tupdesc->natts);
+
+	/* values are converted in a context reset for every row */
+	tmp_cxt = AllocSetContextCreate(CurrentMemoryContext,
+									"clickhouse_fdw analyze",
+									ALLOCSET_SMALL_MINSIZE,
+									ALLOCSET_SMALL_INITSIZE,
+									ALLOCSET_SMALL_MAXSIZE);
+
+	conn = chfdw_get_connection(user, false);
+	read.conn = conn->conn;
+
+	PG_TRY();
+	{
+		int			rc;
+
+		if (begin_ch_query(&read) < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					 errmsg("clickhouse_fdw: %s", ch_last_error())));
+
+		while (numrows < targrows && (rc = read_ch_query(&read)) != 0)
+		{
+			MemoryContext oldcontext;
+
+			if (rc < 0)
+			{
+				CHECK_FOR_INTERRUPTS();
+				ereport(ERROR,
+						(errcode(ERRCODE_FDW_ERROR),
+						 errmsg("clickhouse_fdw: %s", ch_last_error())));
+			}
+
+			if (convs == NULL)
+				convs = chfdw_prepare_converters(&read, tupdesc,
+												 retrieved_attrs);
+
+			oldcontext = MemoryContextSwitchTo(tmp_cxt);
+			memset(nulls, true, sizeof(bool) * tupdesc->natts);
+			chfdw_convert_row(&read, convs, values, nulls);
+			MemoryContextSwitchTo(oldcontext);
+
+			rows[numrows++] = heap_form_tuple(tupdesc, values, nulls);
+			MemoryContextReset(tmp_cxt);
+
+#if (PG_VERSION_NUM >= 180000)
+			vacuum_delay_point(true);
+#else
+			vacuum_delay_point();
+#endif
+		}
+	}
+	PG_CATCH();
+	{
+		end_ch_query(&read);
+		chfdw_release_connection(conn, false);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	chfdw_release_connection(conn, end_ch_query(&read) == 0);
+	MemoryContextDelete(tmp_cxt);
+
+	/* the count may be behind inserts made since */
+	if (*totalrows < numrows)
+		*totalrows = numrows;
+
+	ereport(elevel,
+			(errmsg("\"%s\": table contains %.0f rows, %d rows in sample",
+					RelationGetRelationName(relation), *totalrows, numrows)));
+
+	return numrows;
+}
+
 static bool
 clickhouseAnalyzeForeignTable(Relation relation,
 							 AcquireSampleRowsFunc *func,
@@ -973,14 +4340,579 @@ clickhouseAnalyzeForeignTable(Relation relation,
 	 * ----
 	 */
 
+	ForeignTable *table;
+	UserMapping *user;
+
 	elog(DEBUG1, "entering function %s", __func__);
 
-	return false;
+	*func = clickhouseAcquireSampleRows;
+
+	table = GetForeignTable(RelationGetRelid(relation));
+	user = GetUserMapping(relation->rd_rel->relowner, table->serverid);
+	*totalpages = get_table_pages(relation, user);
+
+	return true;
+}
+
+/*
+ * Which statistics of an attribute ClickHouse can compute. Most common
+ * values come back as text, so they are taken for types whose text form is
+ * the same in both systems; histograms need quantiles too, that ClickHouse
+ * computes for numbers and dates only. Timestamps are printed in the time
+ * zone of the ClickHouse server, so they get neither.
+ */
+static void
+get_stats_kinds(Oid typid, bool *mcv, bool *histogram, bool *is_integer)
+{
+	*mcv = false;
+	*histogram = false;
+	*is_integer = false;
+
+	switch (typid)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+			*is_integer = true;
+			/* FALLTHROUGH */
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+		case DATEOID:
+			*histogram = true;
+			/* FALLTHROUGH */
+		case BOOLOID:
+		case TEXTOID:
+		case VARCHAROID:
+		case UUIDOID:
+			*mcv = true;
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Text form of a value converted to the type of an attribute.
+ */
+static Datum
+stats_value(Form_pg_attribute attr, const char *text)
+{
+	Oid			typinput;
+	Oid			typioparam;
+
+	getTypeInputInfo(attr->atttypid, &typinput, &typioparam);
+	return OidInputFunctionCall(typinput, (char *) text, typioparam,
+								attr->atttypmod);
+}
+
+/* value of an upper case hex digit, as ClickHouse's hex() writes them */
+static int
+hex_digit(char c)
+{
+	return c >= 'A' ? c - 'A' + 10 : c - '0';
+}
+
+/*
+ * The most common values chfdw_deparse_column_stats_sql returns in one
+ * string, each as "x" and its text form in hex.
+ */
+static List *
+split_hex_values(const char *str)
+{
+	List	   *values = NIL;
+
+	while (*str == 'x')
+	{
+		const char *end = strchr(str + 1, 'x');
+		size_t		len = end ? (size_t) (end - str - 1) : strlen(str + 1);
+		char	   *value = palloc(len / 2 + 1);
+		size_t		i;
+
+		for (i = 0; i < len / 2; i++)
+			value[i] = (char) (hex_digit(str[1 + 2 * i]) << 4 |
+							   hex_digit(str[2 + 2 * i]));
+		value[len / 2] = '\0';
+		values = lappend(values, value);
+		str += len + 1;
+	}
+
+	return values;
+}
+
+/*
+ * The space separated histogram bounds chfdw_deparse_value_stats_sql
+ * returns for an attribute.
+ */
+static List *
+split_bounds(const char *str)
+{
+	List	   *values = NIL;
+
+	while (*str != '\0')
+	{
+		const char *end = strchr(str, ' ');
+		size_t		len = end ? (size_t) (end - str) : strlen(str);
+
+		if (len > 0)
+			values = lappend(values, pnstrdup(str, len));
+		str += end ? len + 1 : len;
+	}
+
+	return values;
+}
+
+typedef struct
+{
+	const char *value;
+	double		count;
+} ChMcvCount;
+
+/* most common first */
+static int
+mcv_count_cmp(const void *a, const void *b)
+{
+	double		ca = ((const ChMcvCount *) a)->count;
+	double		cb = ((const ChMcvCount *) b)->count;
+
+	return ca > cb ? -1 : ca < cb ? 1 : 0;
+}
+
+/*
+ * Store the statistics ClickHouse computed for an attribute in pg_statistic,
+ * in the slots ANALYZE would fill. counts are the results of the second
+ * query for the attribute, the row counts of its most common values
+ * followed by the histogram bounds, NULL if that query did not run.
+ */
+static void
+import_column_stats(Relation rel, ChColumnStats *cs, double totalrows,
+					char **counts)
+{
+	int			attnum = cs->attnum;
+	Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), attnum - 1);
+	double		nonnull = cs->nonnull;
+	double		ndistinct = cs->ndistinct;
+	TypeCacheEntry *typentry;
+	Datum		values[Natts_pg_statistic];
+	bool		nulls[Natts_pg_statistic];
+	bool		replaces[Natts_pg_statistic];
+	Relation	sd;
+	HeapTuple	stup;
+	HeapTuple	oldtup;
+	ListCell   *lc;
+	double		stadistinct;
+	Datum	   *mcv_values = NULL;
+	Datum	   *mcv_freqs = NULL;
+	double		mcv_rows = 0;
+	int			nmcv = 0;
+	int			slot = 0;
+	int			k;
+
+	typentry = lookup_type_cache(attr->atttypid,
+								 TYPECACHE_EQ_OPR | TYPECACHE_LT_OPR);
+
+	memset(nulls, false, sizeof(nulls));
+	memset(replaces, true, sizeof(replaces));
+
+	values[Anum_pg_statistic_starelid - 1] =
+		ObjectIdGetDatum(RelationGetRelid(rel));
+	values[Anum_pg_statistic_staattnum - 1] = Int16GetDatum(attnum);
+	values[Anum_pg_statistic_stainherit - 1] = BoolGetDatum(false);
+	for (k = 0; k < STATISTIC_NUM_SLOTS; k++)
+	{
+		values[Anum_pg_statistic_stakind1 - 1 + k] = Int16GetDatum(0);
+		values[Anum_pg_statistic_staop1 - 1 + k] = ObjectIdGetDatum(InvalidOid);
+#if (PG_VERSION_NUM >= 120000)
+		values[Anum_pg_statistic_stacoll1 - 1 + k] =
+			ObjectIdGetDatum(InvalidOid);
+#endif
+		nulls[Anum_pg_statistic_stanumbers1 - 1 + k] = true;
+		nulls[Anum_pg_statistic_stavalues1 - 1 + k] = true;
+	}
+
+	/* as ANALYZE does, a count growing with the table is a fraction */
+	stadistinct = ndistinct;
+	if (totalrows > 0 && stadistinct > 0.1 * totalrows)
+		stadistinct = -(stadistinct / totalrows);
+
+	values[Anum_pg_statistic_stanullfrac - 1] =
+		Float4GetDatum(totalrows > 0 ? (totalrows - nonnull) / totalrows : 0);
+	values[Anum_pg_statistic_stawidth - 1] =
+		Int32GetDatum(attr->attlen > 0 ? attr->attlen :
+					  (int32) (cs->avglen + 0.5) + VARHDRSZ);
+	values[Anum_pg_statistic_stadistinct - 1] = Float4GetDatum(stadistinct);
+
+	/* the most common values, with their frequencies */
+	if (counts != NULL && cs->mcvs != NIL)
+	{
+		ChMcvCount *mcvs = palloc(sizeof(ChMcvCount) * list_length(cs->mcvs));
+		int			n = 0;
+		int			i;
+
+		/* values gone by the second query are left out */
+		foreach(lc, cs->mcvs)
+		{
+			char	   *count = counts[n];
+
+			mcvs[n].value = (const char *) lfirst(lc);
+			mcvs[n].count = count ? strtod(count, NULL) : 0;
+			n++;
+		}
+		qsort(mcvs, n, sizeof(ChMcvCount), mcv_count_cmp);
+
+		mcv_values = palloc(sizeof(Datum) * n);
+		mcv_freqs = palloc(sizeof(Datum) * n);
+		for (i = 0; i < n && mcvs[i].count > 0; i++)
+		{
+			mcv_rows += mcvs[i].count;
+			mcv_values[nmcv] = stats_value(attr, mcvs[i].value);
+			mcv_freqs[nmcv++] = Float4GetDatum(mcvs[i].count / totalrows);
+		}
+
+		if (nmcv > 0)
+		{
+			values[Anum_pg_statistic_stakind1 - 1 + slot] =
+				Int16GetDatum(STATISTIC_KIND_MCV);
+			values[Anum_pg_statistic_staop1 - 1 + slot] =
+				ObjectIdGetDatum(typentry->eq_opr);
+#if (PG_VERSION_NUM >= 120000)
+			values[Anum_pg_statistic_stacoll1 - 1 + slot] =
+				ObjectIdGetDatum(attr->attcollation);
+#endif
+			values[Anum_pg_statistic_stanumbers1 - 1 + slot] =
+				PointerGetDatum(construct_array(mcv_freqs, nmcv, FLOAT4OID,
+												sizeof(float4),
+												FLOAT4PASSBYVAL, 'i'));
+			nulls[Anum_pg_statistic_stanumbers1 - 1 + slot] = false;
+			values[Anum_pg_statistic_stavalues1 - 1 + slot] =
+				PointerGetDatum(construct_array(mcv_values, nmcv,
+												attr->atttypid, attr->attlen,
+												attr->attbyval,
+												attr->attalign));
+			nulls[Anum_pg_statistic_stavalues1 - 1 + slot] = false;
+			slot++;
+		}
+	}
+
+	/* bounds of equal parts of the other values */
+	if (counts != NULL && cs->nbounds >= 2 && nonnull > mcv_rows &&
+		counts[list_length(cs->mcvs)] != NULL)
+	{
+		List	   *texts = split_bounds(counts[list_length(cs->mcvs)]);
+		Datum	   *bounds = palloc(sizeof(Datum) * Max(list_length(texts), 1));
+		int			n = 0;
+
+		foreach(lc, texts)
+			bounds[n++] = stats_value(attr, (const char *) lfirst(lc));
+
+		if (n >= 2)
+		{
+			values[Anum_pg_statistic_stakind1 - 1 + slot] =
+				Int16GetDatum(STATISTIC_KIND_HISTOGRAM);
+			values[Anum_pg_statistic_staop1 - 1 + slot] =
+				ObjectIdGetDatum(typentry->lt_opr);
+#if (PG_VERSION_NUM >= 120000)
+			values[Anum_pg_statistic_stacoll1 - 1 + slot] =
+				ObjectIdGetDatum(attr->attcollation);
+#endif
+			values[Anum_pg_statistic_stavalues1 - 1 + slot] =
+				PointerGetDatum(construct_array(bounds, n, attr->atttypid,
+												attr->attlen, attr->attbyval,
+												attr->attalign));
+			nulls[Anum_pg_statistic_stavalues1 - 1 + slot] = false;
+			slot++;
+		}
+	}
+
+	/* replace the statistics of the attribute, as update_attstats does */
+	sd = table_open(StatisticRelationId, RowExclusiveLock);
+	oldtup = SearchSysCache3(STATRELATTINH,
+							 ObjectIdGetDatum(RelationGetRelid(rel)),
+							 Int16GetDatum(attnum),
+							 BoolGetDatum(false));
+	if (HeapTupleIsValid(oldtup))
+	{
+		stup = heap_modify_tuple(oldtup, RelationGetDescr(sd),
+								 values, nulls, replaces);
+		ReleaseSysCache(oldtup);
+#if (PG_VERSION_NUM >= 100000)
+		CatalogTupleUpdate(sd, &stup->t_self, stup);
+#else
+		simple_heap_update(sd, &stup->t_self, stup);
+		CatalogUpdateIndexes(sd, stup);
+#endif
+	}
+	else
+	{
+		stup = heap_form_tuple(RelationGetDescr(sd), values, nulls);
+#if (PG_VERSION_NUM >= 100000)
+		CatalogTupleInsert(sd, stup);
+#else
+		simple_heap_insert(sd, stup);
+		CatalogUpdateIndexes(sd, stup);
+#endif
+	}
+	heap_freetuple(stup);
+	table_close(sd, RowExclusiveLock);
+}
+
+PG_FUNCTION_INFO_V1(clickhouse_import_stats);
+
+/*
+ * clickhouse_import_stats(regclass)
+ *
+ * Statistics of a ClickHouse foreign table without sampling it: ClickHouse
+ * aggregates the whole table into counts of rows, NULLs and distinct
+ * values, most common values and quantiles, and they are stored as ANALYZE
+ * would store its own, along with the row count of the table.
+ */
+Datum
+clickhouse_import_stats(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	Relation	rel;
+	ForeignTable *table;
+	UserMapping *user;
+	StringInfoData sql;
+	List	   *columns = NIL;
+	List	   *rows;
+	char	  **row;
+	char	  **counts = NULL;
+	double		totalrows = 0;
+	ListCell   *lc;
+	int			ncounts = 0;
+	int			col;
+	int			i;
+
+	/* the lock ANALYZE takes */
+	rel = table_open(relid, ShareUpdateExclusiveLock);
+
+	if (rel->rd_rel->relkind != RELKIND_FOREIGN_TABLE ||
+		GetFdwRoutineForRelation(rel, false)->AnalyzeForeignTable !=
+		clickhouseAnalyzeForeignTable)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a ClickHouse foreign table",
+						RelationGetRelationName(rel))));
+
+#if (PG_VERSION_NUM >= 160000)
+	if (!object_ownercheck(RelationRelationId, relid, GetUserId()))
+#else
+	if (!pg_class_ownercheck(relid, GetUserId()))
+#endif
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be owner of foreign table %s",
+						RelationGetRelationName(rel))));
+
+	table = GetForeignTable(relid);
+	user = GetUserMapping(rel->rd_rel->relowner, table->serverid);
+
+	for (i = 1; i <= RelationGetDescr(rel)->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), i - 1);
+		int			target = attribute_stats_target(rel, i);
+		ChColumnStats *cs;
+		bool		want_mcv;
+		bool		want_histogram;
+
+		if (target == 0)
+			continue;
+		if (target < 0)
+			target = default_statistics_target;
+
+		cs = palloc0(sizeof(ChColumnStats));
+		cs->attnum = i;
+		get_stats_kinds(attr->atttypid, &want_mcv, &want_histogram,
+						&cs->is_integer);
+		if (want_mcv &&
+			OidIsValid(lookup_type_cache(attr->atttypid,
+										 TYPECACHE_EQ_OPR)->eq_opr))
+			cs->nvalues = target;
+		/* nbounds is set once the number of distinct values is known */
+		if (want_histogram &&
+			OidIsValid(lookup_type_cache(attr->atttypid,
+										 TYPECACHE_LT_OPR)->lt_opr))
+			cs->nbounds = target + 1;
+		columns = lappend(columns, cs);
+	}
+
+	/*
+	 * The counts of the whole table and the most common values of each
+	 * attribute come from one pass, their frequencies and the histograms
+	 * from a second one.
+	 */
+	initStringInfo(&sql);
+	chfdw_deparse_column_stats_sql(&sql, rel, columns);
+	if (!fetch_remote_rows(user, sql.data, 1 + 4 * list_length(columns),
+						   &rows) || rows == NIL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("could not compute statistics of table \"%s\" on ClickHouse",
+						RelationGetRelationName(rel)),
+				 errdetail_internal("%s", ch_last_error())));
+
+	row = (char **) linitial(rows);
+	if (row[0] != NULL)
+		totalrows = strtod(row[0], NULL);
+
+	col = 1;
+	foreach(lc, columns)
+	{
+		ChColumnStats *cs = (ChColumnStats *) lfirst(lc);
+		int			nmcv;
+
+		cs->nonnull = row[col] ? strtod(row[col], NULL) : 0;
+		/* uniq is an estimate, it may count more values than there are */
+		cs->ndistinct = Min(row[col + 1] ? strtod(row[col + 1], NULL) : 0,
+							cs->nonnull);
+		cs->avglen = row[col + 2] ? strtod(row[col + 2], NULL) : 0;
+		if (cs->nvalues > 0 && cs->nonnull > 0 && row[col + 3] != NULL)
+			cs->mcvs = split_hex_values(row[col + 3]);
+		col += 4;
+
+		nmcv = list_length(cs->mcvs);
+		if (cs->ndistinct <= nmcv)
+			cs->nbounds = 0;
+		else if (cs->ndistinct - nmcv < cs->nbounds)
+			cs->nbounds = (int) (cs->ndistinct - nmcv);
+		if (cs->nbounds < 2)
+			cs->nbounds = 0;
+
+		ncounts += nmcv + (cs->nbounds > 0 ? 1 : 0);
+	}
+
+	/* without it the attributes get no most common values nor histograms */
+	if (ncounts > 0)
+	{
+		resetStringInfo(&sql);
+		chfdw_deparse_value_stats_sql(&sql, rel, columns);
+		if (fetch_remote_rows(user, sql.data, ncounts, &rows) && rows != NIL)
+			counts = (char **) linitial(rows);
+	}
+
+	col = 0;
+	foreach(lc, columns)
+	{
+		ChColumnStats *cs = (ChColumnStats *) lfirst(lc);
+
+		import_column_stats(rel, cs, totalrows, counts ? counts + col : NULL);
+		col += list_length(cs->mcvs) + (cs->nbounds > 0 ? 1 : 0);
+	}
+
+	/* negative n_distinct values are fractions of the row count */
+#if (PG_VERSION_NUM >= 180000)
+	vac_update_relstats(rel, get_table_pages(rel, user), totalrows, 0, 0,
+						false, InvalidTransactionId, InvalidMultiXactId,
+						NULL, NULL, true);
+#elif (PG_VERSION_NUM >= 150000)
+	vac_update_relstats(rel, get_table_pages(rel, user), totalrows, 0,
+						false, InvalidTransactionId, InvalidMultiXactId,
+						NULL, NULL, true);
+#else
+	vac_update_relstats(rel, get_table_pages(rel, user), totalrows, 0,
+						false, InvalidTransactionId, InvalidMultiXactId,
+						true);
+#endif
+
+	table_close(rel, NoLock);
+
+	PG_RETURN_VOID();
 }
 #endif
 
 
 #if (PG_VERSION_NUM >= 90500)
+/*
+ * PostgreSQL type of an imported ClickHouse column, the one its values are
+ * converted to most directly. *nullable is set for a Nullable type.
+ */
+static char *
+ch_type_to_pg(const char *chtype, bool *nullable)
+{
+	static const struct
+	{
+		const char *chtype;
+		const char *pgtype;
+	}			simple_types[] =
+	{
+		{"Bool", "boolean"},
+		{"Int8", "smallint"},
+		{"Int16", "smallint"},
+		{"Int32", "integer"},
+		{"Int64", "bigint"},
+		{"UInt8", "smallint"},
+		{"UInt16", "integer"},
+		{"UInt32", "bigint"},
+		{"UInt64", "numeric(20)"},
+		{"Int128", "numeric(39)"},
+		{"UInt128", "numeric(39)"},
+		{"Int256", "numeric(77)"},
+		{"UInt256", "numeric(78)"},
+		{"Float32", "real"},
+		{"Float64", "double precision"},
+		{"String", "text"},
+		{"UUID", "uuid"},
+		{"Date", "date"},
+		{"Date32", "date"},
+		{"DateTime", "timestamptz"},
+		{"IPv4", "inet"},
+		{"IPv6", "inet"},
+		{NULL, NULL}
+	};
+	size_t		len = strlen(chtype);
+	int			precision;
+	int			scale;
+	int			i;
+
+#define CH_TYPE_ARGUMENT(wrapper) \
+	pnstrdup(chtype + strlen(wrapper), len - strlen(wrapper) - 1)
+
+	if (strncmp(chtype, "Nullable(", 9) == 0)
+	{
+		*nullable = true;
+		return ch_type_to_pg(CH_TYPE_ARGUMENT("Nullable("), nullable);
+	}
+	if (strncmp(chtype, "LowCardinality(", 15) == 0)
+		return ch_type_to_pg(CH_TYPE_ARGUMENT("LowCardinality("), nullable);
+	if (strncmp(chtype, "Array(", 6) == 0)
+	{
+		bool		element_nullable = false;
+
+		return psprintf("%s[]",
+						ch_type_to_pg(CH_TYPE_ARGUMENT("Array("),
+									  &element_nullable));
+	}
+
+	for (i = 0; simple_types[i].chtype; i++)
+	{
+		if (strcmp(chtype, simple_types[i].chtype) == 0)
+			return pstrdup(simple_types[i].pgtype);
+	}
+
+	if (sscanf(chtype, "Decimal(%d,%d)", &precision, &scale) == 2)
+		return psprintf("numeric(%d,%d)", precision, scale);
+	if (sscanf(chtype, "Decimal32(%d)", &scale) == 1)
+		return psprintf("numeric(9,%d)", scale);
+	if (sscanf(chtype, "Decimal64(%d)", &scale) == 1)
+		return psprintf("numeric(18,%d)", scale);
+	if (sscanf(chtype, "Decimal128(%d)", &scale) == 1)
+		return psprintf("numeric(38,%d)", scale);
+	if (sscanf(chtype, "Decimal256(%d)", &scale) == 1)
+		return psprintf("numeric(76,%d)", scale);
+
+	/* DateTime('zone') is a point in time whatever the zone it shows */
+	if (strncmp(chtype, "DateTime(", 9) == 0)
+		return pstrdup("timestamptz");
+	if (sscanf(chtype, "DateTime64(%d", &precision) == 1)
+		return psprintf("timestamptz(%d)", Min(precision, 6));
+
+	/* FixedString, Enum and anything else is read through its text form */
+	return pstrdup("text");
+
+#undef CH_TYPE_ARGUMENT
+}
+
 static void
 clickhouseGetForeignJoinPaths(PlannerInfo *root,
 							 RelOptInfo *joinrel,
@@ -1019,8 +4951,59 @@ clickhouseGetForeignJoinPaths(PlannerInfo *root,
 	 * runtime in the tuples it returns.
 	 */
 
+#if (PG_VERSION_NUM >= 90600)
+	ClickhouseFdwPlanState *fpinfo;
+	ListCell   *lc;
+#endif
+
 	elog(DEBUG1, "entering function %s", __func__);
 
+#if (PG_VERSION_NUM >= 90600)
+	/* the first pair of sides ClickHouse can join decides */
+	if (joinrel->fdw_private != NULL)
+		return;
+
+	/* rows to lock or modify would have to be re-checked locally */
+	if (root->parse->commandType == CMD_UPDATE ||
+		root->parse->commandType == CMD_DELETE ||
+		root->rowMarks != NIL)
+		return;
+
+	fpinfo = palloc0(sizeof(ClickhouseFdwPlanState));
+	if (!foreign_join_ok(root, joinrel, fpinfo, jointype, outerrel, innerrel,
+						 extra))
+	{
+		pfree(fpinfo);
+		return;
+	}
+	joinrel->fdw_private = fpinfo;
+
+	estimate_path_cost_size(root, joinrel);
+
+	add_path(joinrel,
+			 create_foreign_rel_path(root, joinrel, NULL, fpinfo->rows,
+									 fpinfo->startup_cost, fpinfo->total_cost,
+									 NIL, NIL, false));
+
+	/* and one sorted as the query wants it, as for a table */
+	if (root->query_pathkeys == NIL)
+		return;
+
+	foreach(lc, root->query_pathkeys)
+	{
+		if (!chfdw_is_foreign_pathkey(root, joinrel, (PathKey *) lfirst(lc)))
+			return;
+	}
+	fpinfo->qp_is_pushdown_safe = true;
+
+	add_path(joinrel,
+			 create_foreign_rel_path(root, joinrel, NULL, fpinfo->rows,
+									 fpinfo->startup_cost *
+									 DEFAULT_FDW_SORT_MULTIPLIER,
+									 fpinfo->total_cost *
+									 DEFAULT_FDW_SORT_MULTIPLIER,
+									 root->query_pathkeys, NIL, false));
+#endif
 }
 
 
@@ -1132,9 +5115,99 @@ clickhouseImportForeignSchema(ImportForeignSchemaStmt *stmt,
 	 * foreign-table name will pass the filter.
 	 */
 
+	ForeignServer *server = GetForeignServer(serverOid);
+	UserMapping *user = GetUserMapping(GetUserId(), serverOid);
+	List	   *table_names = NIL;
+	List	   *tables = NIL;
+	List	   *commands = NIL;
+	List	   *rows;
+	StringInfoData buf;
+	ListCell   *lc;
+
 	elog(DEBUG1, "entering function %s", __func__);
 
-	return NULL;
+	foreach(lc, stmt->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+				 errmsg("invalid option \"%s\"", def->defname)));
+	}
+
+	if (stmt->list_type != FDW_IMPORT_SCHEMA_ALL)
+	{
+		foreach(lc, stmt->table_list)
+			table_names = lappend(table_names,
+								  ((RangeVar *) lfirst(lc))->relname);
+	}
+
+	initStringInfo(&buf);
+	chfdw_deparse_import_sql(&buf, stmt->remote_schema, table_names,
+							 stmt->list_type == FDW_IMPORT_SCHEMA_EXCEPT);
+	if (!fetch_remote_rows(user, buf.data, 4, &rows))
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("could not list the tables of ClickHouse database \"%s\"",
+						stmt->remote_schema),
+				 errdetail_internal("%s", ch_last_error())));
+
+	/* gather the rows of each table, in case they are not together */
+	foreach(lc, rows)
+	{
+		char	  **row = (char **) lfirst(lc);
+		List	   *table = NIL;
+		ListCell   *lc2;
+
+		foreach(lc2, tables)
+		{
+			char	  **first = (char **) linitial((List *) lfirst(lc2));
+
+			if (strcmp(first[0], row[0]) == 0)
+			{
+				table = (List *) lfirst(lc2);
+				lfirst(lc2) = lappend(table, row);
+				break;
+			}
+		}
+		if (table == NIL)
+			tables = lappend(tables, list_make1(row));
+	}
+
+	foreach(lc, tables)
+	{
+		List	   *columns = (List *) lfirst(lc);
+		char	  **first = (char **) linitial(columns);
+		ListCell   *lc2;
+
+		resetStringInfo(&buf);
+		appendStringInfo(&buf, "CREATE FOREIGN TABLE %s (",
+						 quote_identifier(first[0]));
+		foreach(lc2, columns)
+		{
+			char	  **row = (char **) lfirst(lc2);
+			bool		nullable = false;
+			char	   *type = ch_type_to_pg(row[2], &nullable);
+
+			appendStringInfo(&buf, "%s\n  %s %s%s",
+							 lc2 == list_head(columns) ? "" : ",",
+							 quote_identifier(row[1]), type,
+							 nullable ? "" : " NOT NULL");
+		}
+		appendStringInfo(&buf, "\n) SERVER %s\nOPTIONS (database %s",
+						 quote_identifier(server->servername),
+						 quote_literal_cstr(stmt->remote_schema));
+
+		/* for planning that takes the order of the table into account */
+		if (first[3] != NULL && first[3][0] != '\0')
+			appendStringInfo(&buf, ", sorting_key %s",
+							 quote_literal_cstr(first[3]));
+		appendStringInfoString(&buf, ");");
+
+		commands = lappend(commands, pstrdup(buf.data));
+	}
+
+	return commands;
 }
 
 #endif
@@ -1231,18 +5304,47 @@ retcomposite(PG_FUNCTION_ARGS)
 
 
 
+/*
+ * State of ch_execute kept across calls. Converters are chosen when the
+ * first block of the result has arrived.
+ */
+typedef struct ChExecuteState
+{
+	CHReadCtx	read;
+	ChConnection *conn;
+	ChConverter *convs;
+	Datum	   *values;
+	bool	   *nulls;
+} ChExecuteState;
+
+/*
+ * Memory context callback closing a ClickHouse query whose result was not
+ * read to the end.
+ */
+static void
+ch_query_cleanup(void *arg)
+{
+	ChExecuteState *state = (ChExecuteState *) arg;
+
+	if (state->conn)
+	{
+		bool		reusable = end_ch_query(&state->read) == 0;
+
+		chfdw_release_connection(state->conn, reusable);
+		state->conn = NULL;
+	}
+}
+
 PG_FUNCTION_INFO_V1(ch_execute);
 
 Datum
 ch_execute(PG_FUNCTION_ARGS)
 {
     FuncCallContext     *funcctx;
-    int                  call_cntr;
-    int                  max_calls;
     TupleDesc            tupdesc;
-    AttInMetadata       *attinmeta;
-	char				*sql;
-	CHReadCtx			*userCtx;
+	ChExecuteState		*state;
+	MemoryContextCallback *cleanup;
+	int					rc;
 
      /* stuff done only on the first call of the function */
      if (SRF_IS_FIRSTCALL())
@@ -1255,11 +5357,6 @@ ch_execute(PG_FUNCTION_ARGS)
         /* switch to memory context appropriate for multiple function calls */
         oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
 
-        /* total number of tuples to be returned */
-        funcctx->max_calls = 7;
-
-
-
         /* Build a tuple descriptor for our result type */
         if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
             ereport(ERROR,
@@ -1267,70 +5364,80 @@ ch_execute(PG_FUNCTION_ARGS)
                      errmsg("function returning record called in context "
                             "that cannot accept type record")));
 
-        /*
-         * generate attribute metadata needed later to produce tuples from raw
-         * C strings
-         */
-        attinmeta = TupleDescGetAttInMetadata(tupdesc);
-        funcctx->attinmeta = attinmeta;
-
-
-		sql = (char*) text_to_cstring(PG_GETARG_TEXT_PP(0));
-		userCtx = palloc0(sizeof(CHReadCtx));
-		funcctx->user_fctx = userCtx;
-		userCtx->sql = sql;
-		userCtx->natts = tupdesc->natts;
-		userCtx->tupleValues = palloc(sizeof(char*) * tupdesc->natts);
-		//userCtx->tupleValues[0] = palloc(16);
-		userCtx->password = (char*) text_to_cstring(PG_GETARG_TEXT_PP(1));
-
-		begin_ch_query(userCtx);
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		state = palloc0(sizeof(ChExecuteState));
+		funcctx->user_fctx = state;
+		state->read.sql = (char*) text_to_cstring(PG_GETARG_TEXT_PP(0));
+		state->read.natts = tupdesc->natts;
+		state->read.columns = palloc0(sizeof(CHColumn) * tupdesc->natts);
+		state->read.settings[2] = chfdw_settings;
+		state->read.password = (char*) text_to_cstring(PG_GETARG_TEXT_PP(1));
+		state->values = palloc(sizeof(Datum) * tupdesc->natts);
+		state->nulls = palloc(sizeof(bool) * tupdesc->natts);
+
+		/*
+		 * The query holds a connection until its result is read to the end,
+		 * release it if the function is not run to completion.
+		 */
+		cleanup = palloc0(sizeof(MemoryContextCallback));
+		cleanup->func = ch_query_cleanup;
+		cleanup->arg = state;
+		MemoryContextRegisterResetCallback(funcctx->multi_call_memory_ctx,
+										   cleanup);
+
+		/* the server of the ClickHouse client configuration */
+		state->conn = chfdw_get_connection(NULL, false);
+		state->read.conn = state->conn->conn;
+		if (begin_ch_query(&state->read) < 0)
+		{
+			chfdw_release_connection(state->conn, false);
+			state->conn = NULL;
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+					 errmsg("clickhouse_fdw: %s", ch_last_error())));
+		}
 
         MemoryContextSwitchTo(oldcontext);
     }
 
     /* stuff done on every call of the function */
     funcctx = SRF_PERCALL_SETUP();
+	state = (ChExecuteState *) funcctx->user_fctx;
 
-    call_cntr = funcctx->call_cntr;
-    max_calls = funcctx->max_calls;
-    attinmeta = funcctx->attinmeta;
+	rc = read_ch_query(&state->read);
+	if (rc < 0)
+	{
+		CHECK_FOR_INTERRUPTS();
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("clickhouse_fdw: %s", ch_last_error())));
+	}
 
-    if (read_ch_query((CHReadCtx*)funcctx->user_fctx))    /* do when there is more left to send */
+    if (rc > 0)    /* do when there is more left to send */
     {
-        //char       **values;
         HeapTuple    tuple;
-        Datum        result;
-
-        /*
-         * Prepare a values array for building the returned tuple.
-         * This should be an array of C strings which will
-         * be processed later by the type input functions.
-         */
-        //values = (char **) palloc(3 * sizeof(char *));
-        //values[0] = (char *) palloc(16 * sizeof(char));
 
-        //snprintf(values[0], 16, "%d", 123);
+		if (state->convs == NULL)
+		{
+			MemoryContext oldcontext;
 
-        /* build a tuple */
-		//elog(NOTICE,"building tuple");
-		//elog(NOTICE,"%s",((CHReadCtx*)funcctx->user_fctx)->tupleValues[0]);
-
-        tuple = BuildTupleFromCStrings(attinmeta, ((CHReadCtx*)funcctx->user_fctx)->tupleValues);
-
-        /* make the tuple into a datum */
-        result = HeapTupleGetDatum(tuple);
+			oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+			state->convs = chfdw_prepare_converters(&state->read,
+													funcctx->tuple_desc, NIL);
+			MemoryContextSwitchTo(oldcontext);
+		}
 
-        /* clean up (this is not really necessary) */
-        //pfree(values[0]);
-        //pfree(values);
+		/* values are converted straight from the columns of the block */
+		chfdw_convert_row(&state->read, state->convs,
+						  state->values, state->nulls);
+        tuple = heap_form_tuple(funcctx->tuple_desc, state->values, state->nulls);
 
-        SRF_RETURN_NEXT(funcctx, result);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
     }
     else    /* do when there is no more left */
     {
-		elog(NOTICE,"finishing");
-		end_ch_query((CHReadCtx*)funcctx->user_fctx);
+		ch_query_cleanup(state);
         SRF_RETURN_DONE(funcctx);
     }
-}
\ No newline at end of file
+}
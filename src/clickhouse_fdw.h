@@ -0,0 +1,244 @@
+/*-------------------------------------------------------------------------
+ *
+ * Clickhouse Foreign Data Wrapper for PostgreSQL
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * IDENTIFICATION
+ *		  clickhouse_fdw/src/clickhouse_fdw.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef CLICKHOUSE_FDW_H
+#define CLICKHOUSE_FDW_H
+
+#include "access/tupdesc.h"
+#include "datatype/timestamp.h"
+#include "fmgr.h"
+#include "foreign/foreign.h"
+#include "lib/stringinfo.h"
+#include "nodes/pg_list.h"
+#if PG_VERSION_NUM >= 120000
+#include "nodes/pathnodes.h"
+#else
+#include "nodes/relation.h"
+#endif
+#include "utils/relcache.h"
+
+#include "../pg2ch/interface.h"
+
+#if PG_VERSION_NUM < 120000
+#define table_open(relid, lockmode) heap_open(relid, lockmode)
+#define table_close(rel, lockmode) heap_close(rel, lockmode)
+#endif
+
+#ifndef TupleDescAttr
+#define TupleDescAttr(tupdesc, i) ((tupdesc)->attrs[(i)])
+#endif
+
+#ifndef IS_SIMPLE_REL
+#define IS_SIMPLE_REL(rel) \
+	((rel)->reloptkind == RELOPT_BASEREL || \
+	 (rel)->reloptkind == RELOPT_OTHER_MEMBER_REL)
+#endif
+
+#ifndef IS_JOIN_REL
+#define IS_JOIN_REL(rel) ((rel)->reloptkind == RELOPT_JOINREL)
+#endif
+
+#ifndef IS_UPPER_REL
+#if PG_VERSION_NUM >= 90600
+#define IS_UPPER_REL(rel) ((rel)->reloptkind == RELOPT_UPPER_REL)
+#else
+#define IS_UPPER_REL(rel) false
+#endif
+#endif
+
+/*
+ * Planner information about a relation ClickHouse computes: a foreign table,
+ * a join of foreign tables, or an aggregation over either. It is set up in
+ * clickhouseGetForeignRelSize, clickhouseGetForeignJoinPaths or
+ * clickhouseGetForeignUpperPaths and kept in the fdw_private of the
+ * RelOptInfo.
+ */
+typedef struct ClickhouseFdwPlanState
+{
+	bool		pushdown_safe;	/* the remote query can compute the relation */
+	bool		qp_is_pushdown_safe;	/* and sort it as the query wants */
+
+	ForeignTable *table;		/* a table of the relation */
+	UserMapping *user;			/* user mapping all its tables are read as */
+
+	/*
+	 * Conditions of the relation, RestrictInfos for a table or a join and
+	 * bare HAVING expressions for an aggregation. Those of a join are
+	 * evaluated in the WHERE clause, after all of its joins.
+	 */
+	List	   *remote_conds;	/* evaluated by ClickHouse */
+	List	   *local_conds;	/* checked after the scan */
+
+	Bitmapset  *attrs_used;		/* attributes to fetch, offset by
+								 * FirstLowInvalidHeapAttributeNumber */
+
+	/* estimates */
+	double		rows;			/* rows left after the local conditions */
+	double		retrieved_rows; /* rows sent by ClickHouse */
+	Cost		remote_cost;	/* work of ClickHouse before sending them */
+	double		index_rows;		/* rows of a table ClickHouse reads after
+								 * its primary key, -1 if not known */
+	Cost		startup_cost;
+	Cost		total_cost;
+
+	/* join, aggregation, ORDER BY and LIMIT */
+	RelOptInfo *outerrel;		/* left side of a join, or the relation
+								 * being aggregated or sorted */
+	List	   *grouped_tlist;	/* TargetEntries of the remote select list */
+	bool		is_ordered;		/* an ORDER BY over outerrel */
+
+	/*
+	 * A join of outerrel with a table, innerrel. ClickHouse joins are
+	 * written as a left-deep chain, conditions that must hold before an
+	 * outer join put a side into a subquery.
+	 */
+	RelOptInfo *innerrel;
+	JoinType	jointype;
+	List	   *joinclauses;	/* equalities of the ON clause */
+	bool		make_outerrel_subquery;
+	bool		make_innerrel_subquery;
+} ClickhouseFdwPlanState;
+
+/*
+ * Conversion of one ClickHouse column to a PostgreSQL attribute. The
+ * function is chosen once per scan from the ClickHouse column kind and the
+ * attribute type, so that the per-row work is a plain read of column memory.
+ */
+typedef struct ChConverter ChConverter;
+
+typedef Datum (*ChConvertFunc) (ChConverter *conv, CHReadCtx *ctx, size_t col);
+
+struct ChConverter
+{
+	ChConvertFunc func;
+	int			attindex;		/* position in the values and nulls arrays */
+	Oid			typid;
+	int32		typmod;
+	FmgrInfo	input;			/* type input function, for the text fallback */
+	Oid			typioparam;
+};
+
+/*
+ * Conversion of one PostgreSQL attribute to a ClickHouse column of an INSERT,
+ * the reverse of ChConverter. Types without a direct mapping are sent in
+ * their text form, which ClickHouse parses.
+ */
+typedef struct ChInserter ChInserter;
+
+typedef void (*ChInsertFunc) (ChInserter *ins, CHInsertCtx *ctx, size_t col,
+							  Datum value);
+
+struct ChInserter
+{
+	ChInsertFunc func;
+	int			attindex;		/* position in the values and nulls arrays */
+	const char *attname;
+	FmgrInfo	output;			/* type output function, for the text forms */
+	bool		quote_elements; /* array elements are written as strings */
+};
+
+/*
+ * Statistics of one attribute computed by ClickHouse for
+ * clickhouse_import_stats. The first query over the table returns the
+ * counts and the nvalues most common values; a second one counts each of
+ * these values and computes nbounds histogram bounds of the others.
+ */
+typedef struct ChColumnStats
+{
+	int			attnum;
+	int			nvalues;		/* most common values to look for, 0 for none */
+	bool		is_integer;		/* histogram bounds are rounded */
+	double		nonnull;
+	double		ndistinct;
+	double		avglen;			/* of a value in text form */
+	List	   *mcvs;			/* text forms of the most common values */
+	int			nbounds;		/* histogram bounds to compute, 0 for none */
+} ChColumnStats;
+
+/*
+ * Cached connection to ClickHouse. It streams one query at a time and is
+ * busy from chfdw_get_connection until chfdw_release_connection.
+ */
+typedef struct ChConnection
+{
+	void	   *conn;			/* DB::Connection */
+	bool		busy;
+	bool		invalidated;	/* server or user mapping has changed */
+	TimestampTz last_used;
+	struct ConnCacheEntry *entry;
+} ChConnection;
+
+/* in connection.c */
+extern int	chfdw_idle_timeout;
+extern ChConnection *chfdw_get_connection(UserMapping *user,
+											 bool missing_ok);
+extern void chfdw_release_connection(ChConnection *conn, bool reusable);
+
+/* in deparse.c */
+extern bool chfdw_is_foreign_expr(PlannerInfo *root, RelOptInfo *baserel,
+								  Expr *expr);
+extern void chfdw_classify_conditions(PlannerInfo *root, RelOptInfo *baserel,
+									  List *input_conds,
+									  List **remote_conds,
+									  List **local_conds);
+extern Expr *chfdw_find_em_expr(PlannerInfo *root, EquivalenceClass *ec,
+								RelOptInfo *rel);
+extern bool chfdw_is_foreign_pathkey(PlannerInfo *root, RelOptInfo *rel,
+									 PathKey *pathkey);
+extern bool chfdw_is_join_equality(PlannerInfo *root, Expr *expr,
+								   Relids outer_relids, Relids inner_relids);
+extern void chfdw_deparse_select_sql(StringInfo buf, PlannerInfo *root,
+									 RelOptInfo *rel, List *tlist,
+									 List *remote_conds, List *pathkeys,
+									 bool has_limit,
+									 List **retrieved_attrs);
+extern void chfdw_deparse_chunk_sql(StringInfo buf, PlannerInfo *root,
+									RelOptInfo *rel, List *remote_conds,
+									bool sampled, int chunk, int nchunks);
+extern void chfdw_deparse_table_size_sql(StringInfo buf, Relation rel);
+extern void chfdw_deparse_analyze_info_sql(StringInfo buf, Relation rel);
+extern void chfdw_deparse_analyze_sql(StringInfo buf, Relation rel,
+									  Bitmapset *attrs_used, double totalrows,
+									  bool has_sampling_key, int targrows,
+									  List **retrieved_attrs);
+extern void chfdw_deparse_column_stats_sql(StringInfo buf, Relation rel,
+										   List *columns);
+extern void chfdw_deparse_value_stats_sql(StringInfo buf, Relation rel,
+										  List *columns);
+extern void chfdw_deparse_insert_sql(StringInfo buf, Relation rel,
+									 List *target_attrs);
+extern void chfdw_deparse_insert_select_sql(StringInfo buf, Relation rel,
+											List *target_attrs,
+											const char *select_sql);
+extern void chfdw_deparse_direct_modify_sql(StringInfo buf,
+											PlannerInfo *root,
+											RelOptInfo *foreignrel,
+											Relation rel, CmdType operation,
+											List *target_attrs,
+											List *target_exprs,
+											List *remote_conds);
+extern void chfdw_deparse_truncate_sql(StringInfo buf, Relation rel);
+extern void chfdw_deparse_partition_key_sql(StringInfo buf, Relation rel);
+extern void chfdw_deparse_columns_sql(StringInfo buf, Relation rel);
+extern void chfdw_deparse_import_sql(StringInfo buf, const char *database,
+									 List *table_names, bool except);
+
+/* in convert.c */
+extern ChConverter *chfdw_prepare_converters(CHReadCtx *ctx, TupleDesc tupdesc,
+											 List *retrieved_attrs);
+extern void chfdw_convert_row(CHReadCtx *ctx, ChConverter *convs,
+							  Datum *values, bool *nulls);
+extern ChInserter *chfdw_prepare_inserters(CHInsertCtx *ctx, TupleDesc tupdesc,
+										   List *target_attrs);
+extern void chfdw_insert_slots(CHInsertCtx *ctx, ChInserter *inserters,
+							   struct TupleTableSlot **slots, int nslots);
+
+#endif							/* CLICKHOUSE_FDW_H */
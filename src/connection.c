@@ -0,0 +1,323 @@
+/*-------------------------------------------------------------------------
+ *
+ * Clickhouse Foreign Data Wrapper for PostgreSQL
+ *
+ * Connection cache. Connections to ClickHouse stay open for the life of
+ * the backend and are reused across queries and transactions. A ClickHouse
+ * connection can stream only one query result at a time, so every cache
+ * entry (a foreign server and a user mapping) holds as many connections as
+ * there are concurrently running remote queries. Connections left idle for
+ * longer than clickhouse_fdw.idle_timeout are closed at the next lookup of
+ * any entry and at the end of every transaction.
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * IDENTIFICATION
+ *		  clickhouse_fdw/src/connection.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "commands/defrem.h"
+#include "miscadmin.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+
+#include "clickhouse_fdw.h"
+
+/* a connection idle for longer than this is pinged before it is reused */
+#define CH_PING_INTERVAL_MS		1000
+
+/* GUC: seconds an idle connection is kept, zero keeps it forever */
+int			chfdw_idle_timeout = 300;
+
+typedef struct ConnCacheKey
+{
+	Oid			serverid;
+	Oid			umid;			/* user mapping */
+} ConnCacheKey;
+
+typedef struct ConnCacheEntry
+{
+	ConnCacheKey key;			/* hash key (must be first) */
+	List	   *conns;			/* ChConnection, in CacheMemoryContext */
+	uint32		server_hashvalue;	/* hash value of foreign server OID */
+	uint32		mapping_hashvalue;	/* hash value of user mapping OID */
+} ConnCacheEntry;
+
+static HTAB *ConnectionHash = NULL;
+
+static void chfdw_inval_callback(Datum arg, int cacheid, uint32 hashvalue);
+static void chfdw_xact_callback(XactEvent event, void *arg);
+
+static void
+chfdw_close_connection(ConnCacheEntry *entry, ChConnection *conn)
+{
+	entry->conns = list_delete_ptr(entry->conns, conn);
+	ch_disconnect(conn->conn);
+	pfree(conn);
+}
+
+/*
+ * Close the idle connections of every cache entry that have been invalidated
+ * or unused for longer than clickhouse_fdw.idle_timeout.
+ */
+static void
+chfdw_close_idle_connections(TimestampTz now)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (ConnectionHash == NULL)
+		return;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		List	   *stale = NIL;
+		ListCell   *lc;
+
+		foreach(lc, entry->conns)
+		{
+			ChConnection *conn = (ChConnection *) lfirst(lc);
+
+			if (!conn->busy &&
+				(conn->invalidated ||
+				 (chfdw_idle_timeout > 0 &&
+				  TimestampDifferenceExceeds(conn->last_used, now,
+											 chfdw_idle_timeout * 1000))))
+				stale = lappend(stale, conn);
+		}
+
+		foreach(lc, stale)
+			chfdw_close_connection(entry, (ChConnection *) lfirst(lc));
+		list_free(stale);
+	}
+}
+
+/*
+ * Connection parameters from the options of the foreign server and the user
+ * mapping. The strings point into the option lists, which the validator has
+ * already checked.
+ */
+static void
+chfdw_connection_options(UserMapping *user, CHConnOptions *opts)
+{
+	ForeignServer *server;
+	List	   *options;
+	ListCell   *lc;
+
+	MemSet(opts, 0, sizeof(CHConnOptions));
+	opts->compression = -1;
+
+	if (user == NULL)
+		return;
+
+	server = GetForeignServer(user->serverid);
+	options = list_concat(list_copy(server->options), user->options);
+
+	foreach(lc, options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "host") == 0)
+			opts->host = defGetString(def);
+		else if (strcmp(def->defname, "port") == 0)
+			opts->port = atoi(defGetString(def));
+		else if (strcmp(def->defname, "database") == 0)
+			opts->database = defGetString(def);
+		else if (strcmp(def->defname, "compression") == 0)
+			opts->compression = defGetBoolean(def) ? 1 : 0;
+		else if (strcmp(def->defname, "connect_timeout") == 0)
+			opts->connect_timeout = atoi(defGetString(def));
+		else if (strcmp(def->defname, "receive_timeout") == 0)
+			opts->receive_timeout = atoi(defGetString(def));
+		else if (strcmp(def->defname, "send_timeout") == 0)
+			opts->send_timeout = atoi(defGetString(def));
+		else if (strcmp(def->defname, "user") == 0)
+			opts->user = defGetString(def);
+		else if (strcmp(def->defname, "password") == 0)
+			opts->password = defGetString(def);
+	}
+}
+
+/*
+ * Get an idle connection for the user mapping, or open a new one. The
+ * connection is busy until chfdw_release_connection. A NULL user mapping
+ * stands for the server of the ClickHouse client configuration, used by
+ * ch_execute. If the server cannot be reached, returns NULL when missing_ok
+ * is true and raises an error otherwise.
+ */
+ChConnection *
+chfdw_get_connection(UserMapping *user, bool missing_ok)
+{
+	ConnCacheKey key;
+	ConnCacheEntry *entry;
+	ChConnection *result = NULL;
+	TimestampTz now = GetCurrentTimestamp();
+	List	   *stale = NIL;
+	ListCell   *lc;
+	bool		found;
+
+	if (ConnectionHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(ConnCacheKey);
+		ctl.entrysize = sizeof(ConnCacheEntry);
+		ctl.hcxt = CacheMemoryContext;
+		ConnectionHash = hash_create("clickhouse_fdw connections", 8,
+									 &ctl,
+									 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+		/* drop connections whose server or user mapping has been altered */
+		CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+									  chfdw_inval_callback, (Datum) 0);
+		CacheRegisterSyscacheCallback(USERMAPPINGOID,
+									  chfdw_inval_callback, (Datum) 0);
+
+		/* close connections that nothing looks up again */
+		RegisterXactCallback(chfdw_xact_callback, NULL);
+	}
+
+	chfdw_close_idle_connections(now);
+
+	key.serverid = user ? user->serverid : InvalidOid;
+	key.umid = user ? user->umid : InvalidOid;
+
+	entry = hash_search(ConnectionHash, &key, HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->conns = NIL;
+		entry->server_hashvalue =
+			GetSysCacheHashValue1(FOREIGNSERVEROID,
+								  ObjectIdGetDatum(key.serverid));
+		entry->mapping_hashvalue =
+			GetSysCacheHashValue1(USERMAPPINGOID,
+								  ObjectIdGetDatum(key.umid));
+	}
+
+	foreach(lc, entry->conns)
+	{
+		ChConnection *conn = (ChConnection *) lfirst(lc);
+
+		if (conn->busy || result != NULL)
+			continue;
+
+		/* the server may have closed a connection that sat idle for a while */
+		if (TimestampDifferenceExceeds(conn->last_used, now,
+									   CH_PING_INTERVAL_MS) &&
+			!ch_ping(conn->conn))
+		{
+			stale = lappend(stale, conn);
+			continue;
+		}
+
+		result = conn;
+	}
+
+	foreach(lc, stale)
+		chfdw_close_connection(entry, (ChConnection *) lfirst(lc));
+	list_free(stale);
+
+	if (result == NULL)
+	{
+		CHConnOptions opts;
+		void	   *conn;
+		MemoryContext oldcontext;
+
+		chfdw_connection_options(user, &opts);
+		conn = ch_connect(&opts);
+		if (conn == NULL && missing_ok)
+			return NULL;
+		if (conn == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_SQLCLIENT_UNABLE_TO_ESTABLISH_SQLCONNECTION),
+					 errmsg("could not connect to ClickHouse server"),
+					 errdetail_internal("%s", ch_last_error())));
+
+		oldcontext = MemoryContextSwitchTo(CacheMemoryContext);
+		result = palloc0(sizeof(ChConnection));
+		result->conn = conn;
+		result->entry = entry;
+		entry->conns = lappend(entry->conns, result);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	result->busy = true;
+	return result;
+}
+
+/*
+ * Return a connection to the cache once its query is finished. A connection
+ * that lost sync with the server, or whose options have changed, is closed.
+ */
+void
+chfdw_release_connection(ChConnection *conn, bool reusable)
+{
+	conn->busy = false;
+	conn->last_used = GetCurrentTimestamp();
+
+	if (!reusable || conn->invalidated)
+		chfdw_close_connection(conn->entry, conn);
+}
+
+/*
+ * Connection invalidation callback function
+ *
+ * After a change to a pg_foreign_server or pg_user_mapping catalog entry,
+ * mark the connections depending on that entry as invalid. Idle ones are
+ * closed at the next lookup, busy ones when they are released.
+ */
+static void
+chfdw_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	Assert(cacheid == FOREIGNSERVEROID || cacheid == USERMAPPINGOID);
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		ListCell   *lc;
+
+		if (hashvalue == 0 ||
+			(cacheid == FOREIGNSERVEROID &&
+			 entry->server_hashvalue == hashvalue) ||
+			(cacheid == USERMAPPINGOID &&
+			 entry->mapping_hashvalue == hashvalue))
+		{
+			foreach(lc, entry->conns)
+				((ChConnection *) lfirst(lc))->invalidated = true;
+		}
+	}
+}
+
+/*
+ * Transaction end callback: close the connections that have been idle for
+ * too long, so that they do not stay open until the same server is used
+ * again.
+ */
+static void
+chfdw_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			chfdw_close_idle_connections(GetCurrentTimestamp());
+			break;
+		default:
+			break;
+	}
+}
@@ -0,0 +1,1026 @@
+/*-------------------------------------------------------------------------
+ *
+ * Clickhouse Foreign Data Wrapper for PostgreSQL
+ *
+ * Conversion of ClickHouse column values to PostgreSQL Datums. Values are
+ * read directly from the column memory of the current block; only types
+ * without a direct mapping go through their text form and the type input
+ * function. INSERT converts the other way.
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * IDENTIFICATION
+ *		  clickhouse_fdw/src/convert.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "catalog/pg_type.h"
+#include "executor/tuptable.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/lsyscache.h"
+#include "utils/timestamp.h"
+#include "utils/uuid.h"
+
+#include "clickhouse_fdw.h"
+
+/* days and seconds between the Unix and the PostgreSQL epochs */
+#define CH_EPOCH_DAYS	(POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE)
+#define CH_EPOCH_SECS	((int64) CH_EPOCH_DAYS * SECS_PER_DAY)
+
+#define CH_VALUE(ctx, col, type) \
+	(((const type *) (ctx)->columns[(col)].data)[(ctx)->currentRow])
+
+static inline int16
+ch_int64_to_int2(int64 v)
+{
+	if (v < PG_INT16_MIN || v > PG_INT16_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("smallint out of range")));
+	return (int16) v;
+}
+
+static inline int32
+ch_int64_to_int4(int64 v)
+{
+	if (v < PG_INT32_MIN || v > PG_INT32_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("integer out of range")));
+	return (int32) v;
+}
+
+static inline int64
+ch_uint64_to_int8(uint64 v)
+{
+	if (v > (uint64) PG_INT64_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("bigint out of range")));
+	return (int64) v;
+}
+
+#define CH_SIGNED(v) ((int64) (v))
+#define CH_UNSIGNED(v) ch_uint64_to_int8((uint64) (v))
+
+#define DEFINE_CONVERTER(name, ctype, expr) \
+static Datum \
+name(ChConverter *conv, CHReadCtx *ctx, size_t col) \
+{ \
+	ctype		v = CH_VALUE(ctx, col, ctype); \
+	return (expr); \
+}
+
+/* integer columns go to any PostgreSQL integer, float, numeric or boolean */
+#define DEFINE_INT_CONVERTERS(prefix, ctype, to_int8) \
+DEFINE_CONVERTER(prefix##_int2, ctype, Int16GetDatum(ch_int64_to_int2(to_int8(v)))) \
+DEFINE_CONVERTER(prefix##_int4, ctype, Int32GetDatum(ch_int64_to_int4(to_int8(v)))) \
+DEFINE_CONVERTER(prefix##_int8, ctype, Int64GetDatum(to_int8(v))) \
+DEFINE_CONVERTER(prefix##_float4, ctype, Float4GetDatum((float4) v)) \
+DEFINE_CONVERTER(prefix##_float8, ctype, Float8GetDatum((float8) v)) \
+DEFINE_CONVERTER(prefix##_numeric, ctype, DirectFunctionCall1(int8_numeric, Int64GetDatum(to_int8(v)))) \
+DEFINE_CONVERTER(prefix##_bool, ctype, BoolGetDatum(v != 0))
+
+DEFINE_INT_CONVERTERS(ch_int8, int8, CH_SIGNED)
+DEFINE_INT_CONVERTERS(ch_int16, int16, CH_SIGNED)
+DEFINE_INT_CONVERTERS(ch_int32, int32, CH_SIGNED)
+DEFINE_INT_CONVERTERS(ch_int64, int64, CH_SIGNED)
+DEFINE_INT_CONVERTERS(ch_uint8, uint8, CH_SIGNED)
+DEFINE_INT_CONVERTERS(ch_uint16, uint16, CH_SIGNED)
+DEFINE_INT_CONVERTERS(ch_uint32, uint32, CH_SIGNED)
+DEFINE_INT_CONVERTERS(ch_uint64, uint64, CH_UNSIGNED)
+
+DEFINE_CONVERTER(ch_float32_float4, float, Float4GetDatum(v))
+DEFINE_CONVERTER(ch_float32_float8, float, Float8GetDatum((float8) v))
+DEFINE_CONVERTER(ch_float64_float4, double, Float4GetDatum((float4) v))
+DEFINE_CONVERTER(ch_float64_float8, double, Float8GetDatum(v))
+
+DEFINE_CONVERTER(ch_date_date, uint16, DateADTGetDatum((DateADT) v - CH_EPOCH_DAYS))
+DEFINE_CONVERTER(ch_date_timestamp, uint16,
+				 TimestampGetDatum(((Timestamp) v - CH_EPOCH_DAYS) * USECS_PER_DAY))
+DEFINE_CONVERTER(ch_date_timestamptz, uint16,
+				 DirectFunctionCall1(date_timestamptz,
+									 DateADTGetDatum((DateADT) v - CH_EPOCH_DAYS)))
+
+/*
+ * DateTime is an absolute point in time. For timestamp without time zone it
+ * is shown in the session time zone, as a cast from timestamptz would do.
+ */
+DEFINE_CONVERTER(ch_datetime_timestamptz, uint32,
+				 TimestampTzGetDatum(((TimestampTz) v - CH_EPOCH_SECS) * USECS_PER_SEC))
+DEFINE_CONVERTER(ch_datetime_timestamp, uint32,
+				 DirectFunctionCall1(timestamptz_timestamp,
+									 TimestampTzGetDatum(((TimestampTz) v - CH_EPOCH_SECS) * USECS_PER_SEC)))
+
+/* DateTime64 counts ticks of 10^-scale seconds, finer ones are truncated */
+static inline TimestampTz
+ch_datetime64_at(CHReadCtx *ctx, size_t col)
+{
+	int64		v = CH_VALUE(ctx, col, int64);
+	int			i;
+
+	for (i = ctx->columns[col].scale; i < 6; i++)
+		v *= 10;
+	for (i = 6; i < ctx->columns[col].scale; i++)
+		v /= 10;
+
+	return (TimestampTz) v - CH_EPOCH_SECS * USECS_PER_SEC;
+}
+
+static Datum
+ch_datetime64_timestamptz(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	return TimestampTzGetDatum(ch_datetime64_at(ctx, col));
+}
+
+static Datum
+ch_datetime64_timestamp(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	return DirectFunctionCall1(timestamptz_timestamp,
+							   TimestampTzGetDatum(ch_datetime64_at(ctx, col)));
+}
+
+static Datum
+ch_uint64_numeric_text(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	char		buf[32];
+
+	snprintf(buf, sizeof(buf), UINT64_FORMAT, CH_VALUE(ctx, col, uint64));
+	return DirectFunctionCall3(numeric_in, CStringGetDatum(buf),
+							   ObjectIdGetDatum(InvalidOid),
+							   Int32GetDatum(conv->typmod));
+}
+
+static inline const char *
+ch_string_at(CHReadCtx *ctx, size_t col, int *len)
+{
+	const CHColumn *column = &ctx->columns[col];
+	size_t		row = ctx->currentRow;
+	uint64		start = row == 0 ? 0 : column->offsets[row - 1];
+
+	/* the offsets include the terminating zero of each value */
+	*len = (int) (column->offsets[row] - start - 1);
+	return (const char *) column->data + start;
+}
+
+static Datum
+ch_string_text(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	int			len;
+	const char *str = ch_string_at(ctx, col, &len);
+
+	return PointerGetDatum(cstring_to_text_with_len(str, len));
+}
+
+/* bytea has the same varlena layout as text */
+#define ch_string_bytea ch_string_text
+
+/* the value is zero terminated in the column, so it can be fed as it is */
+static Datum
+ch_string_input(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	int			len;
+	const char *str = ch_string_at(ctx, col, &len);
+
+	return InputFunctionCall(&conv->input, (char *) str, conv->typioparam,
+							 conv->typmod);
+}
+
+static Datum
+ch_fixed_string_text(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	const CHColumn *column = &ctx->columns[col];
+	const char *str = (const char *) column->data + column->width * ctx->currentRow;
+	int			len = (int) column->width;
+
+	/* FixedString is padded with zero bytes */
+	while (len > 0 && str[len - 1] == '\0')
+		len--;
+	return PointerGetDatum(cstring_to_text_with_len(str, len));
+}
+
+static Datum
+ch_fixed_string_bytea(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	const CHColumn *column = &ctx->columns[col];
+	const char *str = (const char *) column->data + column->width * ctx->currentRow;
+
+	return PointerGetDatum(cstring_to_text_with_len(str, (int) column->width));
+}
+
+static Datum
+ch_uuid_uuid(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	const uint64 *halves = (const uint64 *) ctx->columns[col].data + 2 * ctx->currentRow;
+	pg_uuid_t  *uuid = palloc(sizeof(pg_uuid_t));
+	int			i;
+
+	/* UInt128 keeps the low half first, the text form starts with the high one */
+	for (i = 0; i < 8; i++)
+	{
+		uuid->data[i] = (unsigned char) (halves[1] >> (56 - 8 * i));
+		uuid->data[8 + i] = (unsigned char) (halves[0] >> (56 - 8 * i));
+	}
+	return UUIDPGetDatum(uuid);
+}
+
+#ifdef HAVE_INT128
+typedef uint128 ch_decimal_magnitude;
+#else
+typedef uint64 ch_decimal_magnitude;
+#endif
+
+/*
+ * Build a numeric from the scaled integer of a ClickHouse Decimal. Digits are
+ * written right to left, with at least one digit before the decimal point.
+ */
+static Datum
+ch_make_numeric(ChConverter *conv, bool negative,
+				ch_decimal_magnitude magnitude, int scale)
+{
+	char		buf[64];
+	char	   *p = buf + sizeof(buf);
+	int			digits = 0;
+
+	*--p = '\0';
+	do
+	{
+		*--p = '0' + (int) (magnitude % 10);
+		magnitude /= 10;
+		if (++digits == scale)
+			*--p = '.';
+	} while (magnitude > 0 || digits <= scale);
+
+	if (negative)
+		*--p = '-';
+
+	return DirectFunctionCall3(numeric_in, CStringGetDatum(p),
+							   ObjectIdGetDatum(InvalidOid),
+							   Int32GetDatum(conv->typmod));
+}
+
+static Datum
+ch_decimal32_numeric(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	int64		v = CH_VALUE(ctx, col, int32);
+
+	return ch_make_numeric(conv, v < 0, (ch_decimal_magnitude) (v < 0 ? -v : v),
+						   ctx->columns[col].scale);
+}
+
+static Datum
+ch_decimal64_numeric(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	int64		v = CH_VALUE(ctx, col, int64);
+	uint64		magnitude = v < 0 ? (uint64) 0 - (uint64) v : (uint64) v;
+
+	return ch_make_numeric(conv, v < 0, magnitude, ctx->columns[col].scale);
+}
+
+#ifdef HAVE_INT128
+static Datum
+ch_decimal128_numeric(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	const uint64 *halves = (const uint64 *) ctx->columns[col].data + 2 * ctx->currentRow;
+	int128		v = (int128) (((uint128) halves[1] << 64) | halves[0]);
+	uint128		magnitude = v < 0 ? (uint128) 0 - (uint128) v : (uint128) v;
+
+	return ch_make_numeric(conv, v < 0, magnitude, ctx->columns[col].scale);
+}
+#endif
+
+/* any other combination: text form of the value and the type input function */
+static Datum
+ch_text_input(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	const char *str = ch_column_text(ctx, col);
+
+	if (str == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("clickhouse_fdw: %s", ch_last_error())));
+
+	return InputFunctionCall(&conv->input, (char *) str, conv->typioparam,
+							 conv->typmod);
+}
+
+/*
+ * Arrays come in ClickHouse's text form, [1,2] or ['a','b'], which is
+ * rewritten into an array literal for the input function of the type.
+ */
+static Datum
+ch_array_input(ChConverter *conv, CHReadCtx *ctx, size_t col)
+{
+	const char *str = ch_column_text(ctx, col);
+	StringInfoData buf;
+	const char *p;
+
+	if (str == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("clickhouse_fdw: %s", ch_last_error())));
+
+	initStringInfo(&buf);
+	for (p = str; *p; p++)
+	{
+		if (*p == '[')
+			appendStringInfoChar(&buf, '{');
+		else if (*p == ']')
+			appendStringInfoChar(&buf, '}');
+		else if (*p != '\'')
+			appendStringInfoChar(&buf, *p);
+		else
+		{
+			/* a quoted element, with backslash escapes in both forms */
+			appendStringInfoChar(&buf, '"');
+			for (p++; *p && *p != '\''; p++)
+			{
+				char		c = *p;
+
+				if (c == '\\' && p[1])
+				{
+					c = *++p;
+					switch (c)
+					{
+						case 'n': c = '\n'; break;
+						case 't': c = '\t'; break;
+						case 'r': c = '\r'; break;
+						case 'b': c = '\b'; break;
+						case 'f': c = '\f'; break;
+					}
+				}
+				if (c == '"' || c == '\\')
+					appendStringInfoChar(&buf, '\\');
+				appendStringInfoChar(&buf, c);
+			}
+			appendStringInfoChar(&buf, '"');
+			if (*p == '\0')
+				break;
+		}
+	}
+
+	return InputFunctionCall(&conv->input, buf.data, conv->typioparam,
+							 conv->typmod);
+}
+
+#define INT_CONVERTERS(prefix) \
+	switch (typid) \
+	{ \
+		case INT2OID: return prefix##_int2; \
+		case INT4OID: return prefix##_int4; \
+		case INT8OID: return prefix##_int8; \
+		case FLOAT4OID: return prefix##_float4; \
+		case FLOAT8OID: return prefix##_float8; \
+		case NUMERICOID: return prefix##_numeric; \
+		case BOOLOID: return prefix##_bool; \
+	} \
+	break
+
+/*
+ * Pick the direct conversion for a ClickHouse column kind and a PostgreSQL
+ * type, or NULL if the value has to go through its text form.
+ */
+static ChConvertFunc
+ch_direct_converter(CHColumnKind kind, Oid typid, int32 typmod)
+{
+	switch (kind)
+	{
+		case CH_INT8:
+			INT_CONVERTERS(ch_int8);
+		case CH_INT16:
+			INT_CONVERTERS(ch_int16);
+		case CH_INT32:
+			INT_CONVERTERS(ch_int32);
+		case CH_INT64:
+			INT_CONVERTERS(ch_int64);
+		case CH_UINT8:
+			INT_CONVERTERS(ch_uint8);
+		case CH_UINT16:
+			INT_CONVERTERS(ch_uint16);
+		case CH_UINT32:
+			INT_CONVERTERS(ch_uint32);
+		case CH_UINT64:
+			if (typid == NUMERICOID)
+				return ch_uint64_numeric_text;
+			INT_CONVERTERS(ch_uint64);
+		case CH_FLOAT32:
+			if (typid == FLOAT4OID)
+				return ch_float32_float4;
+			if (typid == FLOAT8OID)
+				return ch_float32_float8;
+			break;
+		case CH_FLOAT64:
+			if (typid == FLOAT4OID)
+				return ch_float64_float4;
+			if (typid == FLOAT8OID)
+				return ch_float64_float8;
+			break;
+		case CH_DATE:
+			if (typid == DATEOID)
+				return ch_date_date;
+			if (typid == TIMESTAMPOID)
+				return ch_date_timestamp;
+			if (typid == TIMESTAMPTZOID)
+				return ch_date_timestamptz;
+			break;
+		case CH_DATETIME:
+			if (typid == TIMESTAMPTZOID)
+				return ch_datetime_timestamptz;
+			if (typid == TIMESTAMPOID)
+				return ch_datetime_timestamp;
+			break;
+		case CH_DATETIME64:
+			if (typid == TIMESTAMPTZOID)
+				return ch_datetime64_timestamptz;
+			if (typid == TIMESTAMPOID)
+				return ch_datetime64_timestamp;
+			break;
+		case CH_STRING:
+			/* varchar(n) needs its input function to check the length */
+			if (typid == TEXTOID || (typid == VARCHAROID && typmod < 0))
+				return ch_string_text;
+			if (typid == BYTEAOID)
+				return ch_string_bytea;
+			return ch_string_input;
+		case CH_FIXED_STRING:
+			if (typid == TEXTOID || (typid == VARCHAROID && typmod < 0))
+				return ch_fixed_string_text;
+			if (typid == BYTEAOID)
+				return ch_fixed_string_bytea;
+			break;
+		case CH_DECIMAL32:
+			if (typid == NUMERICOID)
+				return ch_decimal32_numeric;
+			break;
+		case CH_DECIMAL64:
+			if (typid == NUMERICOID)
+				return ch_decimal64_numeric;
+			break;
+		case CH_DECIMAL128:
+#ifdef HAVE_INT128
+			if (typid == NUMERICOID)
+				return ch_decimal128_numeric;
+#endif
+			break;
+		case CH_UUID:
+			if (typid == UUIDOID)
+				return ch_uuid_uuid;
+			break;
+		case CH_UNSUPPORTED:
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Choose the conversion of every column of the result, once the first block
+ * has described the column kinds. retrieved_attrs lists the attribute numbers
+ * the result columns go to; NIL means the result has the attributes of
+ * tupdesc in order.
+ */
+ChConverter *
+chfdw_prepare_converters(CHReadCtx *ctx, TupleDesc tupdesc, List *retrieved_attrs)
+{
+	ChConverter *convs = palloc0(sizeof(ChConverter) * ctx->natts);
+	size_t		i;
+
+	for (i = 0; i < ctx->natts; i++)
+	{
+		ChConverter *conv = &convs[i];
+		Form_pg_attribute attr;
+
+		conv->attindex = retrieved_attrs != NIL
+			? list_nth_int(retrieved_attrs, (int) i) - 1
+			: (int) i;
+		attr = TupleDescAttr(tupdesc, conv->attindex);
+		conv->typid = attr->atttypid;
+		conv->typmod = attr->atttypmod;
+
+		conv->func = ch_direct_converter(ctx->columns[i].kind, conv->typid,
+										 conv->typmod);
+		if (conv->func == NULL)
+			conv->func = OidIsValid(get_element_type(conv->typid))
+				? ch_array_input : ch_text_input;
+
+		if (conv->func == ch_text_input || conv->func == ch_string_input ||
+			conv->func == ch_array_input)
+		{
+			Oid			input;
+
+			getTypeInputInfo(conv->typid, &input, &conv->typioparam);
+			fmgr_info(input, &conv->input);
+		}
+	}
+
+	return convs;
+}
+
+/*
+ * Convert the current row of the result. Attributes that are not retrieved
+ * are left untouched, the caller sets them to NULL.
+ */
+void
+chfdw_convert_row(CHReadCtx *ctx, ChConverter *convs, Datum *values, bool *nulls)
+{
+	size_t		i;
+
+	for (i = 0; i < ctx->natts; i++)
+	{
+		const CHColumn *column = &ctx->columns[i];
+		ChConverter *conv = &convs[i];
+
+		if (column->nullmap && column->nullmap[ctx->currentRow])
+		{
+			values[conv->attindex] = (Datum) 0;
+			nulls[conv->attindex] = true;
+			continue;
+		}
+
+		values[conv->attindex] = conv->func(conv, ctx, i);
+		nulls[conv->attindex] = false;
+	}
+}
+
+/*
+ * Conversions for INSERT: PostgreSQL values are written into the memory
+ * layout of the ClickHouse column, or in their text form for ClickHouse to
+ * parse.
+ */
+
+static inline void
+ch_put_value(CHInsertCtx *ctx, size_t col, const void *data, size_t len)
+{
+	if (ch_insert_value(ctx, col, data, len) < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("clickhouse_fdw: %s", ch_last_error())));
+}
+
+static inline void
+ch_put_text(CHInsertCtx *ctx, size_t col, const char *text)
+{
+	if (ch_insert_text(ctx, col, text) < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("clickhouse_fdw: %s", ch_last_error())));
+}
+
+#define CH_PUT_INT(ctype, lo, hi) \
+	do { \
+		ctype		x = (ctype) v; \
+		if (v < (lo) || v > (hi)) \
+			goto out_of_range; \
+		ch_put_value(ctx, col, &x, sizeof(x)); \
+		return; \
+	} while (0)
+
+/* store an integer in any integer column, checking its range */
+static void
+ch_put_int(CHInsertCtx *ctx, size_t col, int64 v)
+{
+	switch (ctx->columns[col].kind)
+	{
+		case CH_INT8:
+			CH_PUT_INT(int8, PG_INT8_MIN, PG_INT8_MAX);
+		case CH_INT16:
+			CH_PUT_INT(int16, PG_INT16_MIN, PG_INT16_MAX);
+		case CH_INT32:
+			CH_PUT_INT(int32, PG_INT32_MIN, PG_INT32_MAX);
+		case CH_INT64:
+			CH_PUT_INT(int64, PG_INT64_MIN, PG_INT64_MAX);
+		case CH_UINT8:
+			CH_PUT_INT(uint8, 0, PG_UINT8_MAX);
+		case CH_UINT16:
+			CH_PUT_INT(uint16, 0, PG_UINT16_MAX);
+		case CH_UINT32:
+			CH_PUT_INT(uint32, 0, PG_UINT32_MAX);
+		case CH_UINT64:
+			CH_PUT_INT(uint64, 0, PG_INT64_MAX);
+		default:
+			elog(ERROR, "ClickHouse column %d is not an integer", (int) col);
+	}
+
+out_of_range:
+	ereport(ERROR,
+			(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+			 errmsg("value " INT64_FORMAT " is out of range for the ClickHouse column",
+					v)));
+}
+
+static void
+pg_int2_ch_int(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	ch_put_int(ctx, col, DatumGetInt16(value));
+}
+
+static void
+pg_int4_ch_int(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	ch_put_int(ctx, col, DatumGetInt32(value));
+}
+
+static void
+pg_int8_ch_int(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	ch_put_int(ctx, col, DatumGetInt64(value));
+}
+
+static void
+pg_bool_ch_int(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	ch_put_int(ctx, col, DatumGetBool(value) ? 1 : 0);
+}
+
+static inline void
+ch_put_float(CHInsertCtx *ctx, size_t col, double v)
+{
+	if (ctx->columns[col].kind == CH_FLOAT32)
+	{
+		float		x = (float) v;
+
+		ch_put_value(ctx, col, &x, sizeof(x));
+	}
+	else
+		ch_put_value(ctx, col, &v, sizeof(v));
+}
+
+static void
+pg_float4_ch_float(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	ch_put_float(ctx, col, DatumGetFloat4(value));
+}
+
+static void
+pg_float8_ch_float(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	ch_put_float(ctx, col, DatumGetFloat8(value));
+}
+
+static void
+pg_date_ch_date(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	int64		days = (int64) DatumGetDateADT(value) + CH_EPOCH_DAYS;
+	uint16		x = (uint16) days;
+
+	if (days < 0 || days > PG_UINT16_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("date out of range for ClickHouse Date")));
+	ch_put_value(ctx, col, &x, sizeof(x));
+}
+
+/* DateTime and DateTime64 are points in time, like timestamptz */
+static void
+ch_put_timestamptz(CHInsertCtx *ctx, size_t col, TimestampTz ts)
+{
+	int64		usecs;
+
+	if (TIMESTAMP_NOT_FINITE(ts))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("infinite timestamps cannot be stored in ClickHouse")));
+
+	usecs = ts + CH_EPOCH_SECS * USECS_PER_SEC;
+
+	if (ctx->columns[col].kind == CH_DATETIME)
+	{
+		int64		secs = usecs >= 0 ? usecs / USECS_PER_SEC
+			: -((-usecs + USECS_PER_SEC - 1) / USECS_PER_SEC);
+		uint32		x = (uint32) secs;
+
+		if (secs < 0 || secs > PG_UINT32_MAX)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+					 errmsg("timestamp out of range for ClickHouse DateTime")));
+		ch_put_value(ctx, col, &x, sizeof(x));
+	}
+	else
+	{
+		int64		ticks = usecs;
+		int			i;
+
+		for (i = ctx->columns[col].scale; i < 6; i++)
+			ticks /= 10;
+		for (i = 6; i < ctx->columns[col].scale; i++)
+			ticks *= 10;
+		ch_put_value(ctx, col, &ticks, sizeof(ticks));
+	}
+}
+
+static void
+pg_timestamptz_ch_datetime(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	ch_put_timestamptz(ctx, col, DatumGetTimestampTz(value));
+}
+
+/* timestamp without time zone is taken in the session time zone, as on read */
+static void
+pg_timestamp_ch_datetime(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	if (TIMESTAMP_NOT_FINITE(DatumGetTimestamp(value)))
+		ch_put_timestamptz(ctx, col, DatumGetTimestamp(value));
+	else
+		ch_put_timestamptz(ctx, col,
+						   DatumGetTimestampTz(DirectFunctionCall1(timestamp_timestamptz,
+																   value)));
+}
+
+/* text, varchar, bpchar and bytea give their bytes as they are */
+static void
+pg_varlena_ch_string(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	struct varlena *v = pg_detoast_datum_packed((struct varlena *) DatumGetPointer(value));
+
+	if (ctx->columns[col].kind == CH_FIXED_STRING &&
+		VARSIZE_ANY_EXHDR(v) > ctx->columns[col].width)
+		ereport(ERROR,
+				(errcode(ERRCODE_STRING_DATA_RIGHT_TRUNCATION),
+				 errmsg("value too long for ClickHouse FixedString(%d)",
+						(int) ctx->columns[col].width)));
+	ch_put_value(ctx, col, VARDATA_ANY(v), VARSIZE_ANY_EXHDR(v));
+}
+
+/* any other type goes to a String in its text form */
+static void
+pg_output_ch_string(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	char	   *str = OutputFunctionCall(&ins->output, value);
+
+	ch_put_value(ctx, col, str, strlen(str));
+}
+
+static void
+pg_uuid_ch_uuid(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	pg_uuid_t  *uuid = DatumGetUUIDP(value);
+	uint64		halves[2] = {0, 0};
+	int			i;
+
+	/* the low half of the UInt128 comes first, see ch_uuid_uuid */
+	for (i = 0; i < 8; i++)
+	{
+		halves[1] = (halves[1] << 8) | uuid->data[i];
+		halves[0] = (halves[0] << 8) | uuid->data[8 + i];
+	}
+	ch_put_value(ctx, col, halves, sizeof(halves));
+}
+
+/* any other combination: text form of the value, parsed by ClickHouse */
+static void
+pg_text_output(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	ch_put_text(ctx, col, OutputFunctionCall(&ins->output, value));
+}
+
+/*
+ * Arrays are rewritten from an array literal into ClickHouse's text form,
+ * the reverse of ch_array_input. Elements of types other than numbers are
+ * quoted.
+ */
+static void
+pg_array_output(ChInserter *ins, CHInsertCtx *ctx, size_t col, Datum value)
+{
+	char	   *str = OutputFunctionCall(&ins->output, value);
+	StringInfoData buf;
+	StringInfoData elem;
+	const char *p;
+
+	/* an array with other lower bounds than 1 starts with its dimensions */
+	if (*str == '[')
+	{
+		p = strchr(str, '=');
+		if (p != NULL)
+			str = (char *) p + 1;
+	}
+
+	initStringInfo(&buf);
+	initStringInfo(&elem);
+	for (p = str; *p; p++)
+	{
+		bool		quoted;
+		const char *c;
+
+		if (*p == '{')
+		{
+			appendStringInfoChar(&buf, '[');
+			continue;
+		}
+		if (*p == '}')
+		{
+			appendStringInfoChar(&buf, ']');
+			continue;
+		}
+		if (*p == ',')
+		{
+			appendStringInfoChar(&buf, ',');
+			continue;
+		}
+
+		/* an element, double quoted with backslash escapes or bare */
+		resetStringInfo(&elem);
+		quoted = *p == '"';
+		if (quoted)
+		{
+			for (p++; *p && *p != '"'; p++)
+			{
+				if (*p == '\\' && p[1])
+					p++;
+				appendStringInfoChar(&elem, *p);
+			}
+			if (*p == '\0')
+				p--;
+		}
+		else
+		{
+			for (; *p && *p != ',' && *p != '}'; p++)
+				appendStringInfoChar(&elem, *p);
+			p--;
+		}
+
+		if ((!quoted && pg_strcasecmp(elem.data, "NULL") == 0) ||
+			!ins->quote_elements)
+		{
+			appendStringInfoString(&buf, elem.data);
+			continue;
+		}
+
+		appendStringInfoChar(&buf, '\'');
+		for (c = elem.data; *c; c++)
+		{
+			if (*c == '\'' || *c == '\\')
+				appendStringInfoChar(&buf, '\\');
+			appendStringInfoChar(&buf, *c);
+		}
+		appendStringInfoChar(&buf, '\'');
+	}
+
+	ch_put_text(ctx, col, buf.data);
+}
+
+/*
+ * Pick the direct conversion of a PostgreSQL type to a ClickHouse column
+ * kind, or NULL if the value has to go in its text form.
+ */
+static ChInsertFunc
+ch_direct_inserter(CHColumnKind kind, Oid typid)
+{
+	switch (kind)
+	{
+		case CH_INT8:
+		case CH_INT16:
+		case CH_INT32:
+		case CH_INT64:
+		case CH_UINT8:
+		case CH_UINT16:
+		case CH_UINT32:
+		case CH_UINT64:
+			switch (typid)
+			{
+				case INT2OID: return pg_int2_ch_int;
+				case INT4OID: return pg_int4_ch_int;
+				case INT8OID: return pg_int8_ch_int;
+				case BOOLOID: return pg_bool_ch_int;
+			}
+			break;
+		case CH_FLOAT32:
+		case CH_FLOAT64:
+			if (typid == FLOAT4OID)
+				return pg_float4_ch_float;
+			if (typid == FLOAT8OID)
+				return pg_float8_ch_float;
+			break;
+		case CH_DATE:
+			if (typid == DATEOID)
+				return pg_date_ch_date;
+			break;
+		case CH_DATETIME:
+		case CH_DATETIME64:
+			if (typid == TIMESTAMPTZOID)
+				return pg_timestamptz_ch_datetime;
+			if (typid == TIMESTAMPOID)
+				return pg_timestamp_ch_datetime;
+			break;
+		case CH_STRING:
+		case CH_FIXED_STRING:
+			/* text parsing would interpret backslashes, strings go as bytes */
+			if (typid == TEXTOID || typid == VARCHAROID ||
+				typid == BPCHAROID || typid == BYTEAOID)
+				return pg_varlena_ch_string;
+			return pg_output_ch_string;
+		case CH_UUID:
+			if (typid == UUIDOID)
+				return pg_uuid_ch_uuid;
+			break;
+		default:
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Choose the conversion of every column of an INSERT, once ClickHouse has
+ * described the column kinds. target_attrs lists the attribute numbers the
+ * columns are taken from.
+ */
+ChInserter *
+chfdw_prepare_inserters(CHInsertCtx *ctx, TupleDesc tupdesc, List *target_attrs)
+{
+	ChInserter *inserters = palloc0(sizeof(ChInserter) * ctx->natts);
+	size_t		i;
+
+	for (i = 0; i < ctx->natts; i++)
+	{
+		ChInserter *ins = &inserters[i];
+		Form_pg_attribute attr;
+		Oid			elemtype;
+
+		ins->attindex = list_nth_int(target_attrs, (int) i) - 1;
+		attr = TupleDescAttr(tupdesc, ins->attindex);
+		ins->attname = pstrdup(NameStr(attr->attname));
+
+		ins->func = ch_direct_inserter(ctx->columns[i].kind, attr->atttypid);
+		elemtype = get_element_type(attr->atttypid);
+		if (ins->func == NULL)
+			ins->func = OidIsValid(elemtype) ? pg_array_output : pg_text_output;
+
+		if (ins->func == pg_array_output)
+		{
+			char		category;
+			bool		preferred;
+
+			get_type_category_preferred(elemtype, &category, &preferred);
+			ins->quote_elements = category != TYPCATEGORY_NUMERIC;
+		}
+
+		if (ins->func == pg_text_output || ins->func == pg_array_output ||
+			ins->func == pg_output_ch_string)
+		{
+			Oid			output;
+			bool		isvarlena;
+
+			getTypeOutputInfo(attr->atttypid, &output, &isvarlena);
+			fmgr_info(output, &ins->output);
+		}
+	}
+
+	return inserters;
+}
+
+/*
+ * Append a value to a column of the INSERT. A NULL can only go to a Nullable
+ * column; ClickHouse would store the default of any other one.
+ */
+static inline void
+ch_insert_datum(CHInsertCtx *ctx, ChInserter *ins, size_t col, Datum value,
+				bool isnull)
+{
+	if (!isnull)
+	{
+		ins->func(ins, ctx, col, value);
+		return;
+	}
+
+	if (!ctx->columns[col].nullable)
+		ereport(ERROR,
+				(errcode(ERRCODE_NOT_NULL_VIOLATION),
+				 errmsg("null value in column \"%s\" cannot be stored in ClickHouse",
+						ins->attname),
+				 errdetail("The ClickHouse column is not Nullable.")));
+	if (ch_insert_null(ctx, col) < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_ERROR),
+				 errmsg("clickhouse_fdw: %s", ch_last_error())));
+}
+
+/*
+ * Append the rows of a batch of slots to the block of the INSERT, one column
+ * at a time, so that each pass stays with one conversion and one column of
+ * the block.
+ */
+void
+chfdw_insert_slots(CHInsertCtx *ctx, ChInserter *inserters,
+				   TupleTableSlot **slots, int nslots)
+{
+	size_t		i;
+	int			j;
+
+	for (j = 0; j < nslots; j++)
+		slot_getallattrs(slots[j]);
+
+	for (i = 0; i < ctx->natts; i++)
+	{
+		ChInserter *ins = &inserters[i];
+
+		for (j = 0; j < nslots; j++)
+			ch_insert_datum(ctx, ins, i, slots[j]->tts_values[ins->attindex],
+							slots[j]->tts_isnull[ins->attindex]);
+	}
+
+	ctx->blockRows += nslots;
+}
@@ -0,0 +1,1953 @@
+/*-------------------------------------------------------------------------
+ *
+ * Clickhouse Foreign Data Wrapper for PostgreSQL
+ *
+ * Construction of the queries sent to ClickHouse.
+ *
+ * This software is released under the PostgreSQL Licence
+ *
+ * IDENTIFICATION
+ *		  clickhouse_fdw/src/deparse.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/stratnum.h"
+#include "access/sysattr.h"
+#include "access/transam.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/tlist.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#else
+#include "optimizer/var.h"
+#endif
+#include "parser/parsetree.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/lsyscache.h"
+#include "utils/pg_locale.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+
+#include "clickhouse_fdw.h"
+
+/* objects created by initdb, as opposed to extensions and users */
+#ifdef FirstGenbkiObjectId
+#define is_builtin(oid)		((oid) < FirstGenbkiObjectId)
+#else
+#define is_builtin(oid)		((oid) < FirstBootstrapObjectId)
+#endif
+
+#if PG_VERSION_NUM < 110000
+#define get_attname(relid, attnum, missing_ok) get_relid_attribute_name(relid, attnum)
+#endif
+
+#if PG_VERSION_NUM >= 180000
+#define collate_is_c(collid) (pg_newlocale_from_collation(collid)->collate_is_c)
+#else
+#define collate_is_c(collid) lc_collate_is_c(collid)
+#endif
+
+/* seconds between the PostgreSQL and the Unix epoch */
+#define CH_EPOCH_SECS \
+	((int64) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY)
+
+/* range of a ClickHouse DateTime, an unsigned 32-bit number of seconds */
+#define CH_DATETIME_MAX		((int64) PG_UINT32_MAX)
+
+/*
+ * range of a ClickHouse Date, an unsigned 16-bit number of days since the
+ * Unix epoch (1970-01-01 to 2149-06-06), as a PostgreSQL date
+ */
+#define CH_DATE_MIN		((DateADT) (UNIX_EPOCH_JDATE - POSTGRES_EPOCH_JDATE))
+#define CH_DATE_MAX		((DateADT) (CH_DATE_MIN + PG_UINT16_MAX))
+
+/* digits a ClickHouse Decimal128 holds */
+#define CH_DECIMAL_MAX_PRECISION	38
+
+/*
+ * Context for the walk checking whether an expression can run on ClickHouse.
+ */
+typedef struct foreign_glob_cxt
+{
+	PlannerInfo *root;
+	RelOptInfo *foreignrel;		/* the foreign relation being planned */
+	Relids		relids;			/* relids of the tables it scans */
+} foreign_glob_cxt;
+
+/*
+ * Context for deparsing an expression.
+ */
+typedef struct deparse_expr_cxt
+{
+	PlannerInfo *root;
+	RelOptInfo *foreignrel;
+	RelOptInfo *scanrel;		/* the table or join of the FROM clause */
+	bool		qualify_col;	/* columns are rN.col, as there is a join */
+	StringInfo	buf;
+} deparse_expr_cxt;
+
+static bool foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt);
+static void deparseExpr(Expr *node, deparse_expr_cxt *context);
+
+/*
+ * Value of an option of a foreign table, NULL if it is not set.
+ */
+static const char *
+get_table_option(Relation rel, const char *name)
+{
+	ForeignTable *table = GetForeignTable(RelationGetRelid(rel));
+	ListCell   *lc;
+
+	foreach(lc, table->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, name) == 0)
+			return defGetString(def);
+	}
+
+	return NULL;
+}
+
+/*
+ * ClickHouse database of a foreign table, NULL for the current database of
+ * the connection.
+ */
+static const char *
+get_remote_database(Relation rel)
+{
+	return get_table_option(rel, "database");
+}
+
+/*
+ * ClickHouse table of a foreign table, by default of the same name.
+ */
+static const char *
+get_remote_table(Relation rel)
+{
+	const char *table = get_table_option(rel, "table");
+
+	return table ? table : RelationGetRelationName(rel);
+}
+
+/*
+ * Name of the remote table of a foreign table.
+ */
+static void
+deparseRelation(StringInfo buf, Relation rel)
+{
+	const char *database = get_remote_database(rel);
+
+	if (database != NULL)
+		appendStringInfo(buf, "%s.", quote_identifier(database));
+	appendStringInfoString(buf, quote_identifier(get_remote_table(rel)));
+}
+
+/*
+ * Name of the remote column of an attribute.
+ */
+static void
+deparseColumnRef(StringInfo buf, Relation rel, int attnum)
+{
+	Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel), attnum - 1);
+
+	appendStringInfoString(buf, quote_identifier(NameStr(attr->attname)));
+}
+
+/*
+ * Select list fetching the attributes in attrs_used, or every attribute for
+ * a whole-row reference. The attribute numbers the result columns go to are
+ * returned in *retrieved_attrs.
+ */
+static void
+deparseTargetList(StringInfo buf, Relation rel, Bitmapset *attrs_used,
+				  List **retrieved_attrs)
+{
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	bool		have_wholerow;
+	bool		first = true;
+	int			i;
+
+	have_wholerow = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber,
+								  attrs_used);
+
+	*retrieved_attrs = NIL;
+	for (i = 1; i <= tupdesc->natts; i++)
+	{
+		if (TupleDescAttr(tupdesc, i - 1)->attisdropped)
+			continue;
+
+		if (!have_wholerow &&
+			!bms_is_member(i - FirstLowInvalidHeapAttributeNumber, attrs_used))
+			continue;
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		deparseColumnRef(buf, rel, i);
+		*retrieved_attrs = lappend_int(*retrieved_attrs, i);
+	}
+
+	/* ClickHouse needs something to select even when no column is used */
+	if (first)
+		appendStringInfoString(buf, "1");
+}
+
+/*
+ * Types whose values compare and print the same way in ClickHouse. Values of
+ * other types, and expressions producing them, are never shipped.
+ */
+static bool
+is_shippable_type(Oid type)
+{
+	switch (type)
+	{
+		case BOOLOID:
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case NUMERICOID:
+		case TEXTOID:
+		case VARCHAROID:
+		case DATEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+		case UUIDOID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool
+is_numeric_type(Oid type)
+{
+	return type == INT2OID || type == INT4OID || type == INT8OID ||
+		type == FLOAT4OID || type == FLOAT8OID || type == NUMERICOID;
+}
+
+static bool
+is_arithmetic_operator(const char *opname)
+{
+	return strcmp(opname, "+") == 0 || strcmp(opname, "-") == 0 ||
+		strcmp(opname, "*") == 0 || strcmp(opname, "%") == 0;
+}
+
+/*
+ * ClickHouse spelling of a built-in operator, or NULL when it has none with
+ * the same meaning. Division is left out: ClickHouse divides integers into
+ * a Float64.
+ */
+static const char *
+ch_operator_name(Oid opno, Oid collid, int nargs)
+{
+	char	   *opname;
+
+	if (!is_builtin(opno))
+		return NULL;
+
+	opname = get_opname(opno);
+	if (opname == NULL)
+		return NULL;
+
+	if (nargs == 1)
+		return strcmp(opname, "-") == 0 ? "-" : NULL;
+
+	if (strcmp(opname, "=") == 0)
+		return "=";
+	if (strcmp(opname, "<>") == 0)
+		return "!=";
+	if (strcmp(opname, "<") == 0 || strcmp(opname, "<=") == 0 ||
+		strcmp(opname, ">") == 0 || strcmp(opname, ">=") == 0)
+	{
+		Oid			lefttype;
+		Oid			righttype;
+
+		/* ClickHouse orders strings bytewise, as the C collation does */
+		if (OidIsValid(collid) && !collate_is_c(collid))
+			return NULL;
+
+		/* but UUIDs by their halves as integers, not bytewise */
+		op_input_types(opno, &lefttype, &righttype);
+		if (lefttype == UUIDOID || righttype == UUIDOID)
+			return NULL;
+		return opname;
+	}
+	if (strcmp(opname, "+") == 0 || strcmp(opname, "-") == 0 ||
+		strcmp(opname, "*") == 0 || strcmp(opname, "%") == 0)
+		return opname;
+	if (strcmp(opname, "~~") == 0)
+		return "LIKE";
+	if (strcmp(opname, "!~~") == 0)
+		return "NOT LIKE";
+
+	return NULL;
+}
+
+/*
+ * ClickHouse name of an aggregate, or NULL when it cannot be computed there.
+ * count, sum, min, max and avg exist on both sides; DISTINCT is only taken
+ * for count. avg is only shipped for floats: PostgreSQL averages integers
+ * and numerics exactly, ClickHouse always in a Float64. Ordered, filtered
+ * and partial aggregates stay local.
+ */
+static const char *
+ch_aggregate_name(Aggref *agg)
+{
+	char	   *name;
+
+	if (!is_builtin(agg->aggfnoid) || agg->aggkind != AGGKIND_NORMAL ||
+		agg->aggfilter != NULL || agg->aggorder != NIL || agg->aggvariadic)
+		return NULL;
+#if PG_VERSION_NUM >= 90600
+	if (agg->aggsplit != AGGSPLIT_SIMPLE)
+		return NULL;
+#endif
+
+	name = get_func_name(agg->aggfnoid);
+	if (name == NULL)
+		return NULL;
+
+	if (strcmp(name, "count") == 0)
+	{
+		if (agg->aggdistinct != NIL && list_length(agg->args) != 1)
+			return NULL;
+		return "count";
+	}
+
+	if (agg->aggdistinct != NIL)
+		return NULL;
+
+	if (strcmp(name, "sum") == 0)
+		return "sum";
+	if (strcmp(name, "avg") == 0)
+	{
+		Oid			argtype = exprType((Node *) ((TargetEntry *)
+												 linitial(agg->args))->expr);
+
+		if (argtype != FLOAT4OID && argtype != FLOAT8OID)
+			return NULL;
+		return "avg";
+	}
+	if (strcmp(name, "min") == 0 || strcmp(name, "max") == 0)
+	{
+		/* ClickHouse orders strings bytewise, as the C collation does */
+		if (OidIsValid(agg->inputcollid) && !collate_is_c(agg->inputcollid))
+			return NULL;
+		return strcmp(name, "min") == 0 ? "min" : "max";
+	}
+
+	return NULL;
+}
+
+/*
+ * Digits of the text form of a numeric, and how many of them follow the
+ * decimal point.
+ */
+static void
+numeric_digits(const char *val, int *precision, int *scale)
+{
+	const char *point = strchr(val, '.');
+	const char *p;
+
+	*precision = 0;
+	for (p = val; *p; p++)
+	{
+		if (isdigit((unsigned char) *p))
+			(*precision)++;
+	}
+	*scale = point ? (int) strlen(point + 1) : 0;
+}
+
+/*
+ * Constants deparseConst can print. Timestamps must fall into the range of
+ * a DateTime and be whole seconds, dates into the range of a Date, floats
+ * must be numbers, numerics must fit into a Decimal128.
+ */
+static bool
+is_shippable_const(Const *node)
+{
+	if (node->constisnull)
+		return true;
+
+	switch (node->consttype)
+	{
+		case FLOAT4OID:
+			return !isnan(DatumGetFloat4(node->constvalue)) &&
+				!isinf(DatumGetFloat4(node->constvalue));
+		case FLOAT8OID:
+			return !isnan(DatumGetFloat8(node->constvalue)) &&
+				!isinf(DatumGetFloat8(node->constvalue));
+		case NUMERICOID:
+			{
+				char	   *val = DatumGetCString(DirectFunctionCall1(numeric_out,
+																	  node->constvalue));
+				int			precision;
+				int			scale;
+
+				if (strcmp(val, "NaN") == 0 || strstr(val, "Infinity") != NULL)
+					return false;
+				numeric_digits(val, &precision, &scale);
+				return precision <= CH_DECIMAL_MAX_PRECISION;
+			}
+		case DATEOID:
+			{
+				DateADT		date = DatumGetDateADT(node->constvalue);
+
+				return !DATE_NOT_FINITE(date) &&
+					date >= CH_DATE_MIN && date <= CH_DATE_MAX;
+			}
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			{
+				TimestampTz ts = DatumGetTimestampTz(node->constvalue);
+				int64		secs;
+
+				if (TIMESTAMP_NOT_FINITE(ts))
+					return false;
+				if (node->consttype == TIMESTAMPOID)
+					ts = DatumGetTimestampTz(DirectFunctionCall1(timestamp_timestamptz,
+																 node->constvalue));
+				if (ts % USECS_PER_SEC != 0)
+					return false;
+				secs = ts / USECS_PER_SEC + CH_EPOCH_SECS;
+				return secs >= 0 && secs <= CH_DATETIME_MAX;
+			}
+		default:
+			return true;
+	}
+}
+
+/*
+ * Whether a LIKE pattern means the same in ClickHouse. ClickHouse matches
+ * "_" against a single byte rather than a single character, so only
+ * patterns without it are shipped.
+ */
+static bool
+is_shippable_pattern(Node *pattern)
+{
+	if (IsA(pattern, RelabelType))
+		pattern = (Node *) ((RelabelType *) pattern)->arg;
+
+	if (!IsA(pattern, Const))
+		return false;
+	if (((Const *) pattern)->constisnull)
+		return true;
+
+	return strchr(TextDatumGetCString(((Const *) pattern)->constvalue), '_') == NULL;
+}
+
+/*
+ * Check whether an expression can be evaluated by ClickHouse with the same
+ * result it would have in PostgreSQL.
+ */
+static bool
+foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt)
+{
+	if (node == NULL)
+		return true;
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			{
+				Var		   *var = (Var *) node;
+
+				/* columns of the foreign table only, no system columns */
+				if (!bms_is_member(var->varno, glob_cxt->relids) ||
+					var->varlevelsup != 0 || var->varattno <= 0)
+					return false;
+			}
+			break;
+		case T_Const:
+			if (!is_shippable_const((Const *) node))
+				return false;
+			break;
+		case T_OpExpr:
+			{
+				OpExpr	   *oe = (OpExpr *) node;
+				const char *opname;
+
+				opname = ch_operator_name(oe->opno, oe->inputcollid,
+										  list_length(oe->args));
+				if (opname == NULL)
+					return false;
+
+				if (strstr(opname, "LIKE") != NULL)
+				{
+					if (!is_shippable_pattern(lsecond(oe->args)))
+						return false;
+				}
+				else if (is_arithmetic_operator(opname))
+				{
+					ListCell   *arg;
+
+					/* date and time arithmetic differs, keep it local */
+					foreach(arg, oe->args)
+					{
+						if (!is_numeric_type(exprType(lfirst(arg))))
+							return false;
+					}
+				}
+
+				if (!foreign_expr_walker((Node *) oe->args, glob_cxt))
+					return false;
+			}
+			break;
+		case T_ScalarArrayOpExpr:
+			{
+				ScalarArrayOpExpr *oe = (ScalarArrayOpExpr *) node;
+				const char *opname;
+				Node	   *array = lsecond(oe->args);
+
+				opname = ch_operator_name(oe->opno, oe->inputcollid, 2);
+				if (opname == NULL ||
+					!(oe->useOr ? strcmp(opname, "=") == 0 :
+					  strcmp(opname, "!=") == 0))
+					return false;
+
+				/* x IN (...) and x NOT IN (...) need the list of values */
+				if (IsA(array, Const))
+				{
+					Const	   *c = (Const *) array;
+					ArrayType  *arr;
+					Datum	   *elems;
+					bool	   *elemnulls;
+					int			nelems;
+					int16		typlen;
+					bool		typbyval;
+					char		typalign;
+					Oid			elemtype;
+					int			i;
+
+					if (c->constisnull)
+						return false;
+
+					arr = DatumGetArrayTypeP(c->constvalue);
+					elemtype = ARR_ELEMTYPE(arr);
+					if (!is_shippable_type(elemtype) || ARR_NDIM(arr) > 1)
+						return false;
+
+					get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+					deconstruct_array(arr, elemtype, typlen, typbyval, typalign,
+									  &elems, &elemnulls, &nelems);
+					if (nelems == 0)
+						return false;
+					for (i = 0; i < nelems; i++)
+					{
+						Const	   *elem;
+
+						if (elemnulls[i])
+							return false;
+						elem = makeConst(elemtype, -1, InvalidOid, typlen,
+										 elems[i], false, typbyval);
+						if (!is_shippable_const(elem))
+							return false;
+					}
+				}
+				else if (IsA(array, ArrayExpr))
+				{
+					ArrayExpr  *ae = (ArrayExpr *) array;
+					ListCell   *lc;
+
+					if (ae->multidims || ae->elements == NIL ||
+						!is_shippable_type(ae->element_typeid) ||
+						!foreign_expr_walker((Node *) ae->elements, glob_cxt))
+						return false;
+
+					/*
+					 * ClickHouse skips NULLs of the list where PostgreSQL
+					 * makes the result NULL, values that may be NULL stay
+					 * local.
+					 */
+					foreach(lc, ae->elements)
+					{
+						Node	   *elem = (Node *) lfirst(lc);
+
+						if (IsA(elem, RelabelType))
+							elem = (Node *) ((RelabelType *) elem)->arg;
+						if (!IsA(elem, Const) || ((Const *) elem)->constisnull)
+							return false;
+					}
+				}
+				else
+					return false;
+
+				if (!foreign_expr_walker(linitial(oe->args), glob_cxt))
+					return false;
+
+				/* the array itself is not a shippable type */
+				return true;
+			}
+		case T_Aggref:
+			{
+				Aggref	   *agg = (Aggref *) node;
+				ListCell   *lc;
+
+				/* aggregates only in the select list of an aggregation */
+				if (!IS_UPPER_REL(glob_cxt->foreignrel) ||
+					ch_aggregate_name(agg) == NULL)
+					return false;
+
+				foreach(lc, agg->args)
+				{
+					TargetEntry *tle = (TargetEntry *) lfirst(lc);
+
+					if (!foreign_expr_walker((Node *) tle->expr, glob_cxt))
+						return false;
+				}
+			}
+			break;
+		case T_RelabelType:
+			if (!foreign_expr_walker((Node *) ((RelabelType *) node)->arg,
+									 glob_cxt))
+				return false;
+			break;
+		case T_FuncExpr:
+			{
+				FuncExpr   *fe = (FuncExpr *) node;
+
+				/* only implicit widening of numbers, as in int4col = 1::int8 */
+				if (fe->funcformat != COERCE_IMPLICIT_CAST ||
+					list_length(fe->args) != 1 ||
+					!is_numeric_type(fe->funcresulttype) ||
+					!is_numeric_type(exprType(linitial(fe->args))))
+					return false;
+
+				if (!foreign_expr_walker((Node *) fe->args, glob_cxt))
+					return false;
+			}
+			break;
+		case T_BoolExpr:
+			if (!foreign_expr_walker((Node *) ((BoolExpr *) node)->args,
+									 glob_cxt))
+				return false;
+			break;
+		case T_NullTest:
+			{
+				NullTest   *nt = (NullTest *) node;
+
+				if (nt->argisrow ||
+					!foreign_expr_walker((Node *) nt->arg, glob_cxt))
+					return false;
+			}
+			break;
+		case T_List:
+			{
+				ListCell   *lc;
+
+				foreach(lc, (List *) node)
+				{
+					if (!foreign_expr_walker((Node *) lfirst(lc), glob_cxt))
+						return false;
+				}
+			}
+			return true;
+		default:
+			return false;
+	}
+
+	return is_shippable_type(exprType(node));
+}
+
+/*
+ * Returns true if the expression is safe to evaluate on ClickHouse.
+ */
+bool
+chfdw_is_foreign_expr(PlannerInfo *root, RelOptInfo *baserel, Expr *expr)
+{
+	foreign_glob_cxt glob_cxt;
+
+	glob_cxt.root = root;
+	glob_cxt.foreignrel = baserel;
+
+	/* the columns of an aggregation belong to the relation it reads */
+	if (IS_UPPER_REL(baserel))
+		glob_cxt.relids =
+			((ClickhouseFdwPlanState *) baserel->fdw_private)->outerrel->relids;
+	else
+		glob_cxt.relids = baserel->relids;
+
+	return foreign_expr_walker((Node *) expr, &glob_cxt);
+}
+
+/*
+ * Split the restriction clauses into those ClickHouse can evaluate and
+ * those PostgreSQL has to check locally.
+ */
+void
+chfdw_classify_conditions(PlannerInfo *root, RelOptInfo *baserel,
+						  List *input_conds,
+						  List **remote_conds, List **local_conds)
+{
+	ListCell   *lc;
+
+	*remote_conds = NIL;
+	*local_conds = NIL;
+
+	foreach(lc, input_conds)
+	{
+		RestrictInfo *ri = (RestrictInfo *) lfirst(lc);
+
+		if (chfdw_is_foreign_expr(root, baserel, ri->clause))
+			*remote_conds = lappend(*remote_conds, ri);
+		else
+			*local_conds = lappend(*local_conds, ri);
+	}
+}
+
+/*
+ * Print a string literal, with ClickHouse's backslash escapes.
+ */
+static void
+deparseStringLiteral(StringInfo buf, const char *val)
+{
+	const char *p;
+
+	appendStringInfoChar(buf, '\'');
+	for (p = val; *p; p++)
+	{
+		if (*p == '\'' || *p == '\\')
+			appendStringInfoChar(buf, '\\');
+		appendStringInfoChar(buf, *p);
+	}
+	appendStringInfoChar(buf, '\'');
+}
+
+/*
+ * The database of the remote table of a foreign table, in a query of the
+ * system tables.
+ */
+static void
+deparseDatabase(StringInfo buf, Relation rel)
+{
+	const char *database = get_remote_database(rel);
+
+	if (database != NULL)
+		deparseStringLiteral(buf, database);
+	else
+		appendStringInfoString(buf, "currentDatabase()");
+}
+
+/*
+ * Print a constant. Dates and timestamps are written so that they do not
+ * depend on the time zone of the ClickHouse server: a date by its calendar
+ * day, a timestamp as seconds since the epoch. A numeric is made a
+ * Decimal128 of its scale, ClickHouse would read the literal as a Float64.
+ */
+static void
+deparseConstValue(StringInfo buf, Oid type, Datum value)
+{
+	switch (type)
+	{
+		case BOOLOID:
+			appendStringInfoString(buf, DatumGetBool(value) ? "1" : "0");
+			break;
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+			{
+				Oid			typoutput;
+				bool		typvarlena;
+				char	   *extval;
+
+				getTypeOutputInfo(type, &typoutput, &typvarlena);
+				extval = OidOutputFunctionCall(typoutput, value);
+
+				/* keep "- -1" from becoming a comment */
+				if (extval[0] == '-')
+					appendStringInfo(buf, "(%s)", extval);
+				else
+					appendStringInfoString(buf, extval);
+			}
+			break;
+		case NUMERICOID:
+			{
+				char	   *extval = DatumGetCString(DirectFunctionCall1(numeric_out,
+																		 value));
+				int			precision;
+				int			scale;
+
+				numeric_digits(extval, &precision, &scale);
+				appendStringInfoString(buf, "toDecimal128(");
+				deparseStringLiteral(buf, extval);
+				appendStringInfo(buf, ", %d)", scale);
+			}
+			break;
+		case TEXTOID:
+		case VARCHAROID:
+			deparseStringLiteral(buf, TextDatumGetCString(value));
+			break;
+		case DATEOID:
+			{
+				int			year,
+							month,
+							day;
+
+				j2date(DatumGetDateADT(value) + POSTGRES_EPOCH_JDATE,
+					   &year, &month, &day);
+				appendStringInfo(buf, "toDate('%04d-%02d-%02d')",
+								 year, month, day);
+			}
+			break;
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			{
+				TimestampTz ts = DatumGetTimestampTz(value);
+
+				if (type == TIMESTAMPOID)
+					ts = DatumGetTimestampTz(DirectFunctionCall1(timestamp_timestamptz,
+																 value));
+				appendStringInfo(buf, "toDateTime(" INT64_FORMAT ")",
+								 ts / USECS_PER_SEC + CH_EPOCH_SECS);
+			}
+			break;
+		case UUIDOID:
+			appendStringInfoString(buf, "toUUID(");
+			deparseStringLiteral(buf,
+								 DatumGetCString(DirectFunctionCall1(uuid_out,
+																	 value)));
+			appendStringInfoChar(buf, ')');
+			break;
+		default:
+			elog(ERROR, "unexpected constant of type %u", type);
+	}
+}
+
+static void
+deparseConst(Const *node, deparse_expr_cxt *context)
+{
+	if (node->constisnull)
+		appendStringInfoString(context->buf, "NULL");
+	else
+		deparseConstValue(context->buf, node->consttype, node->constvalue);
+}
+
+static void
+deparseVar(Var *node, deparse_expr_cxt *context)
+{
+	RangeTblEntry *rte = planner_rt_fetch(node->varno, context->root);
+
+	if (context->qualify_col)
+		appendStringInfo(context->buf, "r%d.", node->varno);
+	appendStringInfoString(context->buf,
+						   quote_identifier(get_attname(rte->relid,
+														node->varattno,
+														false)));
+}
+
+static void
+deparseOpExpr(OpExpr *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	const char *opname = ch_operator_name(node->opno, node->inputcollid,
+										  list_length(node->args));
+
+	appendStringInfoChar(buf, '(');
+	if (list_length(node->args) == 1)
+	{
+		appendStringInfo(buf, "%s ", opname);
+		deparseExpr(linitial(node->args), context);
+	}
+	else
+	{
+		deparseExpr(linitial(node->args), context);
+		appendStringInfo(buf, " %s ", opname);
+		deparseExpr(lsecond(node->args), context);
+	}
+	appendStringInfoChar(buf, ')');
+}
+
+/*
+ * Print x IN (...) or x NOT IN (...). ClickHouse answers IN for a NULL x
+ * with 0 (and NOT IN with 1) where PostgreSQL gives NULL, so a NULL x is
+ * tested first.
+ */
+static void
+deparseScalarArrayOpExpr(ScalarArrayOpExpr *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	Node	   *array = lsecond(node->args);
+	bool		first = true;
+
+	appendStringInfoString(buf, "if(isNull(");
+	deparseExpr(linitial(node->args), context);
+	appendStringInfoString(buf, "), NULL, ");
+	deparseExpr(linitial(node->args), context);
+	appendStringInfoString(buf, node->useOr ? " IN (" : " NOT IN (");
+
+	if (IsA(array, Const))
+	{
+		ArrayType  *arr = DatumGetArrayTypeP(((Const *) array)->constvalue);
+		Oid			elemtype = ARR_ELEMTYPE(arr);
+		Datum	   *elems;
+		int			nelems;
+		int16		typlen;
+		bool		typbyval;
+		char		typalign;
+		int			i;
+
+		get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+		deconstruct_array(arr, elemtype, typlen, typbyval, typalign,
+						  &elems, NULL, &nelems);
+		for (i = 0; i < nelems; i++)
+		{
+			if (!first)
+				appendStringInfoString(buf, ", ");
+			first = false;
+			deparseConstValue(buf, elemtype, elems[i]);
+		}
+	}
+	else
+	{
+		ListCell   *lc;
+
+		foreach(lc, ((ArrayExpr *) array)->elements)
+		{
+			if (!first)
+				appendStringInfoString(buf, ", ");
+			first = false;
+			deparseExpr(lfirst(lc), context);
+		}
+	}
+
+	appendStringInfoString(buf, "))");
+}
+
+/*
+ * Print an aggregate. ClickHouse aggregates an empty input to a single row
+ * of default values where PostgreSQL returns NULL, so without GROUP BY
+ * everything but count is made NULL for no rows.
+ */
+static void
+deparseAggref(Aggref *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	const char *name = ch_aggregate_name(node);
+	bool		null_if_empty;
+	bool		first = true;
+	ListCell   *lc;
+
+	null_if_empty = context->root->parse->groupClause == NIL &&
+		strcmp(name, "count") != 0;
+
+	if (null_if_empty)
+		appendStringInfoString(buf, "if(count() = 0, NULL, ");
+
+	appendStringInfo(buf, "%s(", name);
+	if (node->aggdistinct != NIL)
+		appendStringInfoString(buf, "DISTINCT ");
+
+	/* count(*) has no arguments */
+	foreach(lc, node->args)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		/*
+		 * ClickHouse sums an Int64 into an Int64 that wraps around, where
+		 * PostgreSQL sums it into a numeric; a Decimal128 sum raises an
+		 * error on overflow instead.
+		 */
+		if (strcmp(name, "sum") == 0 && exprType((Node *) tle->expr) == INT8OID)
+		{
+			appendStringInfoString(buf, "toDecimal128(");
+			deparseExpr(tle->expr, context);
+			appendStringInfoString(buf, ", 0)");
+		}
+		else
+			deparseExpr(tle->expr, context);
+	}
+	appendStringInfoChar(buf, ')');
+
+	if (null_if_empty)
+		appendStringInfoChar(buf, ')');
+}
+
+static void
+deparseBoolExpr(BoolExpr *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	const char *op = NULL;
+	bool		first = true;
+	ListCell   *lc;
+
+	switch (node->boolop)
+	{
+		case AND_EXPR:
+			op = "AND";
+			break;
+		case OR_EXPR:
+			op = "OR";
+			break;
+		case NOT_EXPR:
+			appendStringInfoString(buf, "(NOT ");
+			deparseExpr(linitial(node->args), context);
+			appendStringInfoChar(buf, ')');
+			return;
+	}
+
+	appendStringInfoChar(buf, '(');
+	foreach(lc, node->args)
+	{
+		if (!first)
+			appendStringInfo(buf, " %s ", op);
+		deparseExpr((Expr *) lfirst(lc), context);
+		first = false;
+	}
+	appendStringInfoChar(buf, ')');
+}
+
+static void
+deparseNullTest(NullTest *node, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+
+	appendStringInfoString(buf, node->nulltesttype == IS_NULL ?
+						   "isNull(" : "isNotNull(");
+	deparseExpr(node->arg, context);
+	appendStringInfoChar(buf, ')');
+}
+
+/*
+ * Print an expression accepted by foreign_expr_walker.
+ */
+static void
+deparseExpr(Expr *node, deparse_expr_cxt *context)
+{
+	if (node == NULL)
+		return;
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			deparseVar((Var *) node, context);
+			break;
+		case T_Const:
+			deparseConst((Const *) node, context);
+			break;
+		case T_OpExpr:
+			deparseOpExpr((OpExpr *) node, context);
+			break;
+		case T_ScalarArrayOpExpr:
+			deparseScalarArrayOpExpr((ScalarArrayOpExpr *) node, context);
+			break;
+		case T_RelabelType:
+			deparseExpr(((RelabelType *) node)->arg, context);
+			break;
+		case T_FuncExpr:
+			/* an implicit cast between numbers, ClickHouse converts itself */
+			deparseExpr(linitial(((FuncExpr *) node)->args), context);
+			break;
+		case T_BoolExpr:
+			deparseBoolExpr((BoolExpr *) node, context);
+			break;
+		case T_NullTest:
+			deparseNullTest((NullTest *) node, context);
+			break;
+		case T_Aggref:
+			deparseAggref((Aggref *) node, context);
+			break;
+		default:
+			elog(ERROR, "unsupported expression type for deparse: %d",
+				 (int) nodeTag(node));
+			break;
+	}
+}
+
+/*
+ * An expression of the equivalence class that ClickHouse can compute for
+ * the relation. For an aggregation it has to be one of the sort expressions
+ * of the output, since the remote query can only order its result by those.
+ */
+Expr *
+chfdw_find_em_expr(PlannerInfo *root, EquivalenceClass *ec, RelOptInfo *rel)
+{
+	ListCell   *lc;
+
+	if (IS_UPPER_REL(rel))
+	{
+		PathTarget *target = rel->reltarget;
+		int			i = 0;
+
+		foreach(lc, target->exprs)
+		{
+			Expr	   *expr = (Expr *) lfirst(lc);
+			Index		sgref = get_pathtarget_sortgroupref(target, i);
+			ListCell   *lc2;
+
+			i++;
+			if (sgref == 0 ||
+				get_sortgroupref_clause_noerr(sgref,
+											  root->parse->sortClause) == NULL)
+				continue;
+
+			while (expr && IsA(expr, RelabelType))
+				expr = ((RelabelType *) expr)->arg;
+
+			foreach(lc2, ec->ec_members)
+			{
+				EquivalenceMember *em = (EquivalenceMember *) lfirst(lc2);
+				Expr	   *em_expr = em->em_expr;
+
+				if (em->em_is_const || em->em_is_child)
+					continue;
+
+				while (em_expr && IsA(em_expr, RelabelType))
+					em_expr = ((RelabelType *) em_expr)->arg;
+
+				if (equal(em_expr, expr) &&
+					chfdw_is_foreign_expr(root, rel, em->em_expr))
+					return em->em_expr;
+			}
+		}
+
+		return NULL;
+	}
+
+	foreach(lc, ec->ec_members)
+	{
+		EquivalenceMember *em = (EquivalenceMember *) lfirst(lc);
+
+		if (bms_is_subset(em->em_relids, rel->relids) &&
+			!bms_is_empty(em->em_relids) &&
+			chfdw_is_foreign_expr(root, rel, em->em_expr))
+			return em->em_expr;
+	}
+
+	return NULL;
+}
+
+/*
+ * Whether ClickHouse can sort the relation by the pathkey: a built-in sort
+ * order over an expression it computes, strings in the C collation only,
+ * no UUIDs.
+ */
+bool
+chfdw_is_foreign_pathkey(PlannerInfo *root, RelOptInfo *rel, PathKey *pathkey)
+{
+	EquivalenceClass *ec = pathkey->pk_eclass;
+	Expr	   *em_expr;
+
+	if (ec->ec_has_volatile || !is_builtin(pathkey->pk_opfamily))
+		return false;
+
+	if (OidIsValid(ec->ec_collation) && !collate_is_c(ec->ec_collation))
+		return false;
+
+	/* ClickHouse sorts UUIDs in another order */
+	em_expr = chfdw_find_em_expr(root, ec, rel);
+	return em_expr != NULL && exprType((Node *) em_expr) != UUIDOID;
+}
+
+/*
+ * Whether a join condition can be a key of a ClickHouse JOIN: an equality
+ * between an expression over one side and an expression over the other.
+ */
+bool
+chfdw_is_join_equality(PlannerInfo *root, Expr *expr,
+					   Relids outer_relids, Relids inner_relids)
+{
+	OpExpr	   *oe = (OpExpr *) expr;
+	const char *opname;
+	Relids		left;
+	Relids		right;
+
+	if (!IsA(expr, OpExpr) || list_length(oe->args) != 2)
+		return false;
+
+	opname = ch_operator_name(oe->opno, oe->inputcollid, 2);
+	if (opname == NULL || strcmp(opname, "=") != 0)
+		return false;
+
+#if PG_VERSION_NUM >= 140000
+	left = pull_varnos(root, linitial(oe->args));
+	right = pull_varnos(root, lsecond(oe->args));
+#else
+	left = pull_varnos(linitial(oe->args));
+	right = pull_varnos(lsecond(oe->args));
+#endif
+
+	if (bms_is_empty(left) || bms_is_empty(right))
+		return false;
+
+	return (bms_is_subset(left, outer_relids) &&
+			bms_is_subset(right, inner_relids)) ||
+		(bms_is_subset(left, inner_relids) &&
+		 bms_is_subset(right, outer_relids));
+}
+
+/*
+ * Conditions, given as RestrictInfos or bare expressions, ANDed together.
+ */
+static void
+appendConditions(List *exprs, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	bool		first = true;
+	ListCell   *lc;
+
+	foreach(lc, exprs)
+	{
+		Expr	   *expr = (Expr *) lfirst(lc);
+
+		if (IsA(expr, RestrictInfo))
+			expr = ((RestrictInfo *) expr)->clause;
+
+		if (!first)
+			appendStringInfoString(buf, " AND ");
+		first = false;
+		deparseExpr(expr, context);
+	}
+}
+
+/*
+ * Select list of a join or an aggregation, the expressions of tlist. Result column
+ * i goes to attribute i of the scan tuple.
+ */
+static void
+deparseExplicitTargetList(List *tlist, List **retrieved_attrs,
+						  deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	ListCell   *lc;
+	int			i = 0;
+
+	*retrieved_attrs = NIL;
+	foreach(lc, tlist)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+
+		if (i > 0)
+			appendStringInfoString(buf, ", ");
+		deparseExpr(tle->expr, context);
+		*retrieved_attrs = lappend_int(*retrieved_attrs, ++i);
+	}
+
+	if (i == 0)
+		appendStringInfoString(buf, "1");
+}
+
+static const char *
+get_jointype_name(JoinType jointype)
+{
+	switch (jointype)
+	{
+		case JOIN_INNER:
+			return "INNER";
+		case JOIN_LEFT:
+			return "LEFT";
+		case JOIN_RIGHT:
+			return "RIGHT";
+		case JOIN_FULL:
+			return "FULL";
+		default:
+			elog(ERROR, "unsupported join type %d", jointype);
+			return NULL;
+	}
+}
+
+/*
+ * Whether the relation has an outer join, whose result ClickHouse fills
+ * with defaults rather than NULLs unless told otherwise.
+ */
+static bool
+has_outer_join(RelOptInfo *rel)
+{
+	ClickhouseFdwPlanState *fpinfo = (ClickhouseFdwPlanState *) rel->fdw_private;
+
+	if (!IS_JOIN_REL(rel))
+		return false;
+
+	return fpinfo->jointype != JOIN_INNER || has_outer_join(fpinfo->outerrel);
+}
+
+/*
+ * FROM clause item for a table or a join. ClickHouse does not nest joins in
+ * parentheses, a join is printed as a chain of joins with tables, each
+ * table aliased rN after its range table index. A table whose conditions
+ * must hold before an outer join becomes a subquery.
+ */
+static void
+deparseFromExpr(RelOptInfo *rel, bool make_subquery, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	ClickhouseFdwPlanState *fpinfo = (ClickhouseFdwPlanState *) rel->fdw_private;
+	RangeTblEntry *rte;
+	Relation	relation;
+
+	if (IS_JOIN_REL(rel))
+	{
+		deparseFromExpr(fpinfo->outerrel, fpinfo->make_outerrel_subquery,
+						context);
+
+		/* an inner join without equalities is a product filtered by WHERE */
+		if (fpinfo->joinclauses == NIL)
+		{
+			Assert(fpinfo->jointype == JOIN_INNER);
+			appendStringInfoString(buf, " CROSS JOIN ");
+			deparseFromExpr(fpinfo->innerrel, false, context);
+			return;
+		}
+
+		appendStringInfo(buf, " ALL %s JOIN ",
+						 get_jointype_name(fpinfo->jointype));
+		deparseFromExpr(fpinfo->innerrel, fpinfo->make_innerrel_subquery,
+						context);
+		appendStringInfoString(buf, " ON ");
+		appendConditions(fpinfo->joinclauses, context);
+		return;
+	}
+
+	/* the planner already holds a lock on the relation */
+	rte = planner_rt_fetch(rel->relid, context->root);
+	relation = table_open(rte->relid, NoLock);
+
+	if (make_subquery)
+	{
+		appendStringInfoString(buf, "(SELECT * FROM ");
+		deparseRelation(buf, relation);
+		appendStringInfo(buf, " AS r%d WHERE ", rel->relid);
+		appendConditions(fpinfo->remote_conds, context);
+		appendStringInfoChar(buf, ')');
+	}
+	else
+		deparseRelation(buf, relation);
+
+	if (context->qualify_col)
+		appendStringInfo(buf, " AS r%d", rel->relid);
+
+	table_close(relation, NoLock);
+}
+
+/*
+ * GROUP BY clause of an aggregation, the grouping expressions of tlist.
+ */
+static void
+appendGroupByClause(List *tlist, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	Query	   *query = context->root->parse;
+	bool		first = true;
+	ListCell   *lc;
+
+	if (query->groupClause == NIL)
+		return;
+
+	appendStringInfoString(buf, " GROUP BY ");
+	foreach(lc, query->groupClause)
+	{
+		SortGroupClause *grp = (SortGroupClause *) lfirst(lc);
+		TargetEntry *tle = get_sortgroupref_tle(grp->tleSortGroupRef, tlist);
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+		deparseExpr(tle->expr, context);
+	}
+}
+
+/*
+ * ORDER BY clause for the pathkeys. NULLS FIRST and LAST are always given:
+ * ClickHouse puts NULLs last in either direction.
+ */
+static void
+appendOrderByClause(List *pathkeys, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	bool		first = true;
+	ListCell   *lc;
+
+	appendStringInfoString(buf, " ORDER BY ");
+	foreach(lc, pathkeys)
+	{
+		PathKey    *pathkey = (PathKey *) lfirst(lc);
+		Expr	   *em_expr = chfdw_find_em_expr(context->root,
+												 pathkey->pk_eclass,
+												 context->foreignrel);
+		bool		desc;
+
+		Assert(em_expr != NULL);
+
+#if PG_VERSION_NUM >= 180000
+		desc = pathkey->pk_cmptype == COMPARE_GT;
+#else
+		desc = pathkey->pk_strategy == BTGreaterStrategyNumber;
+#endif
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		deparseExpr(em_expr, context);
+		appendStringInfoString(buf, desc ? " DESC" : " ASC");
+		appendStringInfoString(buf, pathkey->pk_nulls_first ?
+							   " NULLS FIRST" : " NULLS LAST");
+	}
+}
+
+/*
+ * LIMIT clause of the query, in the "LIMIT offset, count" form every
+ * ClickHouse version understands. The values are constants, checked when
+ * the path was built; a missing count is the largest one ClickHouse takes.
+ */
+static void
+appendLimitClause(deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	Query	   *query = context->root->parse;
+	Const	   *offset = (Const *) query->limitOffset;
+	Const	   *count = (Const *) query->limitCount;
+
+	appendStringInfoString(buf, " LIMIT ");
+	if (offset != NULL && !offset->constisnull)
+		appendStringInfo(buf, INT64_FORMAT ", ",
+						 DatumGetInt64(offset->constvalue));
+	if (count != NULL && !count->constisnull)
+		appendStringInfo(buf, INT64_FORMAT, DatumGetInt64(count->constvalue));
+	else
+		appendStringInfoString(buf, "18446744073709551615");
+}
+
+/*
+ * SELECT statement computing a relation on ClickHouse. For a foreign table
+ * it fetches the attributes the query uses, filtered by remote_conds. A join
+ * returns the expressions of tlist, remote_conds are its WHERE conditions.
+ * An aggregation returns the expressions of tlist too, grouped as the query
+ * says, and remote_conds are its HAVING conditions. The result is sorted by
+ * pathkeys, and limited as the query says when has_limit is set.
+ */
+void
+chfdw_deparse_select_sql(StringInfo buf, PlannerInfo *root, RelOptInfo *rel,
+						 List *tlist, List *remote_conds, List *pathkeys,
+						 bool has_limit, List **retrieved_attrs)
+{
+	ClickhouseFdwPlanState *fpinfo = (ClickhouseFdwPlanState *) rel->fdw_private;
+	RelOptInfo *scanrel = IS_UPPER_REL(rel) ? fpinfo->outerrel : rel;
+	deparse_expr_cxt context;
+
+	context.root = root;
+	context.foreignrel = rel;
+	context.scanrel = scanrel;
+	context.qualify_col = IS_JOIN_REL(scanrel);
+	context.buf = buf;
+
+	appendStringInfoString(buf, "SELECT ");
+	if (IS_SIMPLE_REL(rel))
+	{
+		RangeTblEntry *rte = planner_rt_fetch(rel->relid, root);
+		Relation	relation;
+
+		/* the planner already holds a lock on the relation */
+		relation = table_open(rte->relid, NoLock);
+		deparseTargetList(buf, relation, fpinfo->attrs_used, retrieved_attrs);
+		table_close(relation, NoLock);
+	}
+	else
+		deparseExplicitTargetList(tlist, retrieved_attrs, &context);
+
+	appendStringInfoString(buf, " FROM ");
+	deparseFromExpr(scanrel, false, &context);
+
+	if (IS_UPPER_REL(rel))
+	{
+		ClickhouseFdwPlanState *ofpinfo =
+			(ClickhouseFdwPlanState *) scanrel->fdw_private;
+
+		if (ofpinfo->remote_conds != NIL)
+		{
+			appendStringInfoString(buf, " WHERE ");
+			appendConditions(ofpinfo->remote_conds, &context);
+		}
+
+		appendGroupByClause(tlist, &context);
+
+		if (remote_conds != NIL)
+		{
+			appendStringInfoString(buf, " HAVING ");
+			appendConditions(remote_conds, &context);
+		}
+	}
+	else if (remote_conds != NIL)
+	{
+		appendStringInfoString(buf, " WHERE ");
+		appendConditions(remote_conds, &context);
+	}
+
+	if (pathkeys != NIL)
+		appendOrderByClause(pathkeys, &context);
+
+	if (has_limit)
+		appendLimitClause(&context);
+
+	if (has_outer_join(scanrel))
+		appendStringInfoString(buf, " SETTINGS join_use_nulls = 1");
+}
+
+/*
+ * SELECT statement reading chunk of nchunks disjoint chunks of a foreign
+ * table for a parallel scan, otherwise as chfdw_deparse_select_sql does. A
+ * table with a sampling key is split with SAMPLE, so that every chunk reads
+ * its own range of the table. Any other one is split by a hash of the
+ * fetched columns, each chunk reading the whole table.
+ */
+void
+chfdw_deparse_chunk_sql(StringInfo buf, PlannerInfo *root, RelOptInfo *rel,
+						List *remote_conds, bool sampled, int chunk,
+						int nchunks)
+{
+	ClickhouseFdwPlanState *fpinfo = (ClickhouseFdwPlanState *) rel->fdw_private;
+	RangeTblEntry *rte = planner_rt_fetch(rel->relid, root);
+	Relation	relation;
+	List	   *retrieved_attrs;
+	deparse_expr_cxt context;
+	ListCell   *lc;
+
+	context.root = root;
+	context.foreignrel = rel;
+	context.scanrel = rel;
+	context.qualify_col = false;
+	context.buf = buf;
+
+	/* the planner already holds a lock on the relation */
+	relation = table_open(rte->relid, NoLock);
+
+	appendStringInfoString(buf, "SELECT ");
+	deparseTargetList(buf, relation, fpinfo->attrs_used, &retrieved_attrs);
+	appendStringInfoString(buf, " FROM ");
+	deparseRelation(buf, relation);
+
+	if (sampled)
+	{
+		appendStringInfo(buf, " SAMPLE 1/%d OFFSET %d/%d",
+						 nchunks, chunk, nchunks);
+		if (remote_conds != NIL)
+		{
+			appendStringInfoString(buf, " WHERE ");
+			appendConditions(remote_conds, &context);
+		}
+	}
+	else
+	{
+		/* NULLs hash to NULL, their rows go to the first chunk */
+		appendStringInfoString(buf, " WHERE ifNull(cityHash64(");
+		foreach(lc, retrieved_attrs)
+		{
+			if (lc != list_head(retrieved_attrs))
+				appendStringInfoString(buf, ", ");
+			deparseColumnRef(buf, relation, lfirst_int(lc));
+		}
+		appendStringInfo(buf, "), 0) %% %d = %d", nchunks, chunk);
+		if (remote_conds != NIL)
+		{
+			appendStringInfoString(buf, " AND ");
+			appendConditions(remote_conds, &context);
+		}
+	}
+
+	table_close(relation, NoLock);
+}
+
+/*
+ * Query for the size of the remote table of a foreign table: a row for
+ * each of its columns with the name and the uncompressed bytes of the
+ * column, the row count of the table and its sampling key.
+ */
+void
+chfdw_deparse_table_size_sql(StringInfo buf, Relation rel)
+{
+	const char *relname = get_remote_table(rel);
+
+	appendStringInfoString(buf,
+						   "SELECT name, data_uncompressed_bytes, "
+						   "(SELECT sum(rows) FROM system.parts "
+						   "WHERE active AND database = ");
+	deparseDatabase(buf, rel);
+	appendStringInfoString(buf, " AND table = ");
+	deparseStringLiteral(buf, relname);
+	appendStringInfoString(buf,
+						   "), (SELECT sampling_key FROM system.tables "
+						   "WHERE database = ");
+	deparseDatabase(buf, rel);
+	appendStringInfoString(buf, " AND name = ");
+	deparseStringLiteral(buf, relname);
+	appendStringInfoString(buf,
+						   ") FROM system.columns WHERE database = ");
+	deparseDatabase(buf, rel);
+	appendStringInfoString(buf, " AND table = ");
+	deparseStringLiteral(buf, relname);
+}
+
+/*
+ * Query for what ANALYZE needs to know about the remote table of a foreign
+ * table before sampling it: its row count and its sampling key, empty if it
+ * has none.
+ */
+void
+chfdw_deparse_analyze_info_sql(StringInfo buf, Relation rel)
+{
+	appendStringInfoString(buf, "SELECT (SELECT count() FROM ");
+	deparseRelation(buf, rel);
+	appendStringInfoString(buf,
+						   "), (SELECT sampling_key FROM system.tables "
+						   "WHERE database = ");
+	deparseDatabase(buf, rel);
+	appendStringInfoString(buf, " AND name = ");
+	deparseStringLiteral(buf, get_remote_table(rel));
+	appendStringInfoChar(buf, ')');
+}
+
+/*
+ * Query fetching a random sample of at most targrows rows of the attributes
+ * in attrs_used. A table with a sampling key is read with SAMPLE, which
+ * reads only the part of the table the sampling key selects; any other one
+ * is shuffled by ClickHouse. A table of no more than targrows rows is read
+ * as a whole.
+ */
+void
+chfdw_deparse_analyze_sql(StringInfo buf, Relation rel, Bitmapset *attrs_used,
+						  double totalrows, bool has_sampling_key,
+						  int targrows, List **retrieved_attrs)
+{
+	appendStringInfoString(buf, "SELECT ");
+	deparseTargetList(buf, rel, attrs_used, retrieved_attrs);
+	appendStringInfoString(buf, " FROM ");
+	deparseRelation(buf, rel);
+
+	if (totalrows > targrows)
+	{
+		if (has_sampling_key)
+			appendStringInfo(buf, " SAMPLE %d/%.0f", targrows, totalrows);
+		else
+			appendStringInfoString(buf, " ORDER BY rand()");
+	}
+
+	appendStringInfo(buf, " LIMIT %d", targrows);
+}
+
+/*
+ * Query computing, in one pass, the row count of the remote table of a
+ * foreign table and, for each ChColumnStats in columns, the number of its
+ * non-NULL values, an estimate of its distinct values, the average length
+ * of its values in text form and the nvalues most common values as topK
+ * estimates them. These come as one string of the hex text forms, each
+ * behind an "x", so that any value can be told apart; an empty string when
+ * nvalues is 0.
+ */
+void
+chfdw_deparse_column_stats_sql(StringInfo buf, Relation rel, List *columns)
+{
+	ListCell   *lc;
+
+	appendStringInfoString(buf, "SELECT count()");
+	foreach(lc, columns)
+	{
+		ChColumnStats *cs = (ChColumnStats *) lfirst(lc);
+
+		appendStringInfoString(buf, ", count(");
+		deparseColumnRef(buf, rel, cs->attnum);
+		appendStringInfoString(buf, "), uniq(");
+		deparseColumnRef(buf, rel, cs->attnum);
+		appendStringInfoString(buf, "), avg(length(toString(");
+		deparseColumnRef(buf, rel, cs->attnum);
+		appendStringInfoString(buf, ")))");
+
+		if (cs->nvalues > 0)
+		{
+			appendStringInfo(buf,
+							 ", arrayStringConcat(arrayMap(x -> concat('x', hex(toString(x))), topK(%d)(",
+							 cs->nvalues);
+			deparseColumnRef(buf, rel, cs->attnum);
+			appendStringInfoString(buf, ")))");
+		}
+		else
+			appendStringInfoString(buf, ", ''");
+	}
+	appendStringInfoString(buf, " FROM ");
+	deparseRelation(buf, rel);
+}
+
+/*
+ * The most common values of an attribute as a list of literals.
+ */
+static void
+deparseValueList(StringInfo buf, List *values)
+{
+	ListCell   *lc;
+
+	appendStringInfoChar(buf, '(');
+	foreach(lc, values)
+	{
+		if (lc != list_head(values))
+			appendStringInfoString(buf, ", ");
+		deparseStringLiteral(buf, (const char *) lfirst(lc));
+	}
+	appendStringInfoChar(buf, ')');
+}
+
+/*
+ * Query computing, in one pass, for each ChColumnStats in columns the
+ * number of rows holding each of its most common values, and nbounds values
+ * that split its other values into equal parts, in ascending order and
+ * separated by spaces. ClickHouse computes quantiles as floats, is_integer
+ * rounds them. The literals are the text forms ClickHouse returned, which
+ * it converts back to the type of the column.
+ */
+void
+chfdw_deparse_value_stats_sql(StringInfo buf, Relation rel, List *columns)
+{
+	ListCell   *lc;
+	ListCell   *lc2;
+	bool		first = true;
+	int			i;
+
+	appendStringInfoString(buf, "SELECT ");
+	foreach(lc, columns)
+	{
+		ChColumnStats *cs = (ChColumnStats *) lfirst(lc);
+
+		foreach(lc2, cs->mcvs)
+		{
+			if (!first)
+				appendStringInfoString(buf, ", ");
+			first = false;
+
+			appendStringInfoString(buf, "countIf(");
+			deparseColumnRef(buf, rel, cs->attnum);
+			appendStringInfoString(buf, " = ");
+			deparseStringLiteral(buf, (const char *) lfirst(lc2));
+			appendStringInfoChar(buf, ')');
+		}
+
+		if (cs->nbounds < 2)
+			continue;
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		appendStringInfo(buf, "arrayStringConcat(arrayMap(x -> toString(%s), quantilesIf(",
+						 cs->is_integer ? "round(x)" : "x");
+		for (i = 0; i < cs->nbounds; i++)
+			appendStringInfo(buf, "%s%g", i > 0 ? ", " : "",
+							 (double) i / (cs->nbounds - 1));
+		appendStringInfoString(buf, ")(");
+		deparseColumnRef(buf, rel, cs->attnum);
+		appendStringInfoString(buf, ", ");
+		if (cs->mcvs != NIL)
+		{
+			deparseColumnRef(buf, rel, cs->attnum);
+			appendStringInfoString(buf, " NOT IN ");
+			deparseValueList(buf, cs->mcvs);
+		}
+		else
+			appendStringInfoChar(buf, '1');
+		appendStringInfoString(buf, ")), ' ')");
+	}
+	appendStringInfoString(buf, " FROM ");
+	deparseRelation(buf, rel);
+}
+
+/*
+ * INSERT of the attributes in target_attrs, without the data, which follows
+ * in blocks of the native protocol.
+ */
+void
+chfdw_deparse_insert_sql(StringInfo buf, Relation rel, List *target_attrs)
+{
+	ListCell   *lc;
+
+	appendStringInfoString(buf, "INSERT INTO ");
+	deparseRelation(buf, rel);
+	appendStringInfoString(buf, " (");
+	foreach(lc, target_attrs)
+	{
+		if (lc != list_head(target_attrs))
+			appendStringInfoString(buf, ", ");
+		deparseColumnRef(buf, rel, lfirst_int(lc));
+	}
+	appendStringInfoString(buf, ") VALUES");
+}
+
+/*
+ * INSERT of the attributes in target_attrs whose rows are computed on
+ * ClickHouse by select_sql, which returns them in this order.
+ */
+void
+chfdw_deparse_insert_select_sql(StringInfo buf, Relation rel,
+								List *target_attrs, const char *select_sql)
+{
+	ListCell   *lc;
+
+	appendStringInfoString(buf, "INSERT INTO ");
+	deparseRelation(buf, rel);
+	appendStringInfoString(buf, " (");
+	foreach(lc, target_attrs)
+	{
+		if (lc != list_head(target_attrs))
+			appendStringInfoString(buf, ", ");
+		deparseColumnRef(buf, rel, lfirst_int(lc));
+	}
+	appendStringInfo(buf, ") %s", select_sql);
+}
+
+/*
+ * Mutation running an UPDATE or DELETE of a foreign table on ClickHouse:
+ * ALTER TABLE ... UPDATE or ALTER TABLE ... DELETE with the remote
+ * conditions of the table. For UPDATE, target_exprs are the new values of
+ * the attributes in target_attrs.
+ */
+void
+chfdw_deparse_direct_modify_sql(StringInfo buf, PlannerInfo *root,
+								RelOptInfo *foreignrel, Relation rel,
+								CmdType operation, List *target_attrs,
+								List *target_exprs, List *remote_conds)
+{
+	deparse_expr_cxt context;
+	ListCell   *lc,
+			   *lc2;
+
+	context.root = root;
+	context.foreignrel = foreignrel;
+	context.scanrel = foreignrel;
+	context.qualify_col = false;
+	context.buf = buf;
+
+	appendStringInfoString(buf, "ALTER TABLE ");
+	deparseRelation(buf, rel);
+
+	if (operation == CMD_UPDATE)
+	{
+		appendStringInfoString(buf, " UPDATE ");
+		forboth(lc, target_attrs, lc2, target_exprs)
+		{
+			if (lc != list_head(target_attrs))
+				appendStringInfoString(buf, ", ");
+			deparseColumnRef(buf, rel, lfirst_int(lc));
+			appendStringInfoString(buf, " = ");
+			deparseExpr((Expr *) lfirst(lc2), &context);
+		}
+	}
+	else
+		appendStringInfoString(buf, " DELETE");
+
+	/* a mutation must have a WHERE clause */
+	appendStringInfoString(buf, " WHERE ");
+	if (remote_conds != NIL)
+		appendConditions(remote_conds, &context);
+	else
+		appendStringInfoChar(buf, '1');
+}
+
+/*
+ * TRUNCATE of the remote table of a foreign table.
+ */
+void
+chfdw_deparse_truncate_sql(StringInfo buf, Relation rel)
+{
+	appendStringInfoString(buf, "TRUNCATE TABLE ");
+	deparseRelation(buf, rel);
+}
+
+/*
+ * Query for the partition key of the remote table of a foreign table, empty
+ * for a table without one.
+ */
+void
+chfdw_deparse_partition_key_sql(StringInfo buf, Relation rel)
+{
+	appendStringInfoString(buf,
+						   "SELECT partition_key FROM system.tables "
+						   "WHERE database = ");
+	deparseDatabase(buf, rel);
+	appendStringInfoString(buf, " AND name = ");
+	deparseStringLiteral(buf, get_remote_table(rel));
+}
+
+/*
+ * Query for the columns of the remote table of a foreign table: the name,
+ * the type and the kind of default of each.
+ */
+void
+chfdw_deparse_columns_sql(StringInfo buf, Relation rel)
+{
+	appendStringInfoString(buf,
+						   "SELECT name, type, default_kind FROM system.columns "
+						   "WHERE database = ");
+	deparseDatabase(buf, rel);
+	appendStringInfoString(buf, " AND table = ");
+	deparseStringLiteral(buf, get_remote_table(rel));
+}
+
+/*
+ * Query describing the tables of a ClickHouse database for IMPORT FOREIGN
+ * SCHEMA: a row for every column with the table name, the column name and
+ * type, and the sorting key of the table, sorted by table and by the
+ * position of the column. Only the tables in table_names are listed, or all
+ * but them when except is set, or all tables when table_names is NIL.
+ */
+void
+chfdw_deparse_import_sql(StringInfo buf, const char *database,
+						 List *table_names, bool except)
+{
+	ListCell   *lc;
+
+	/* the columns are streamed through a hash table of the tables */
+	appendStringInfoString(buf,
+						   "SELECT c.table, c.name, c.type, t.sorting_key "
+						   "FROM system.columns AS c "
+						   "ALL INNER JOIN system.tables AS t "
+						   "ON c.database = t.database AND c.table = t.name "
+						   "WHERE c.database = ");
+	deparseStringLiteral(buf, database);
+
+	/* inner tables of materialized views are theirs to manage */
+	appendStringInfoString(buf,
+						   " AND NOT t.is_temporary"
+						   " AND NOT startsWith(t.name, '.inner')");
+
+	/*
+	 * ALIAS columns are not stored and MATERIALIZED ones cannot be inserted
+	 * into, neither is part of what SELECT * returns.
+	 */
+	appendStringInfoString(buf,
+						   " AND c.default_kind NOT IN ('ALIAS', 'MATERIALIZED')");
+
+	if (table_names != NIL)
+	{
+		appendStringInfo(buf, " AND c.table %sIN (", except ? "NOT " : "");
+		foreach(lc, table_names)
+		{
+			if (lc != list_head(table_names))
+				appendStringInfoString(buf, ", ");
+			deparseStringLiteral(buf, (const char *) lfirst(lc));
+		}
+		appendStringInfoChar(buf, ')');
+	}
+
+	appendStringInfoString(buf, " ORDER BY c.table, c.position");
+}
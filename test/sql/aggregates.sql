@@ -0,0 +1,25 @@
+--
+-- aggregations computed by ClickHouse
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER aggregates_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER aggregates_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS aggregates_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE aggregates_t (k String, a Int32, n Int64, f Float64) ENGINE = MergeTree ORDER BY a', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO aggregates_t VALUES (''x'', 1, 9223372036854775807, 0.5), (''x'', 2, 1, 1.5), (''y'', 4, 5, 4)', '') AS t(x int);
+CREATE FOREIGN TABLE t (k text, a int, n bigint, f float8) SERVER aggregates_server OPTIONS (table 'aggregates_t');
+-- no rows give NULL rather than the defaults of ClickHouse
+EXPLAIN (VERBOSE, COSTS OFF) SELECT count(*), sum(a), max(f), avg(f) FROM t;
+SELECT count(*), sum(a), max(f), avg(f) FROM t;
+SELECT count(*), sum(a), max(f), avg(f) FROM t WHERE a > 100;
+-- a sum of bigints does not wrap around
+EXPLAIN (VERBOSE, COSTS OFF) SELECT k, sum(n) FROM t GROUP BY k;
+SELECT k, sum(n) FROM t GROUP BY k ORDER BY k;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT k, count(*) FROM t GROUP BY k HAVING sum(a) > 3;
+SELECT k, count(*) FROM t GROUP BY k HAVING sum(a) > 3;
+-- the average of integers is exact, ClickHouse would give a Float64
+SELECT avg(a) FROM t;
+DROP FOREIGN TABLE t;
+DROP USER MAPPING FOR CURRENT_USER SERVER aggregates_server;
+DROP SERVER aggregates_server;
+SELECT * FROM ch_execute('DROP TABLE aggregates_t', '') AS t(x int);
@@ -0,0 +1,30 @@
+--
+-- ANALYZE with a sample picked by ClickHouse
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER analyze_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER analyze_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS analyze_t', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS analyze_sampled_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE analyze_t (id UInt64, k UInt8, name String) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO analyze_t SELECT number, number % 10, toString(number) FROM numbers(1000)', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE analyze_sampled_t (id UInt64, k UInt8) ENGINE = MergeTree ORDER BY intHash32(id) SAMPLE BY intHash32(id)', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO analyze_sampled_t SELECT number, number % 10 FROM numbers(100000)', '') AS t(x int);
+CREATE FOREIGN TABLE analyze_ft (id bigint, k int, name text) SERVER analyze_server OPTIONS (table 'analyze_t');
+CREATE FOREIGN TABLE analyze_sampled_ft (id bigint, k int) SERVER analyze_server OPTIONS (table 'analyze_sampled_t');
+-- columns without statistics are not fetched
+ALTER FOREIGN TABLE analyze_ft ALTER COLUMN name SET STATISTICS 0;
+ANALYZE VERBOSE analyze_ft;
+SELECT reltuples FROM pg_class WHERE relname = 'analyze_ft';
+SELECT attname, n_distinct FROM pg_stats WHERE tablename = 'analyze_ft' ORDER BY attname;
+-- a table with a sampling key is read with SAMPLE
+SET default_statistics_target = 1;
+ANALYZE analyze_sampled_ft;
+SELECT reltuples FROM pg_class WHERE relname = 'analyze_sampled_ft';
+RESET default_statistics_target;
+DROP FOREIGN TABLE analyze_ft;
+DROP FOREIGN TABLE analyze_sampled_ft;
+DROP USER MAPPING FOR CURRENT_USER SERVER analyze_server;
+DROP SERVER analyze_server;
+SELECT * FROM ch_execute('DROP TABLE analyze_t', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE analyze_sampled_t', '') AS t(x int);
@@ -0,0 +1,28 @@
+--
+-- foreign partitions of an Append are scanned asynchronously
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER async_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER async_server;
+ALTER SERVER async_server OPTIONS (ADD async_capable 'true');
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS async_p1', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS async_p2', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE async_p1 (id Int32, v Int32) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE async_p2 (id Int32, v Int32) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO async_p1 SELECT number, number % 7 FROM numbers(500)', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO async_p2 SELECT number + 500, (number + 500) % 7 FROM numbers(500)', '') AS t(x int);
+CREATE TABLE pt (id int, v int) PARTITION BY RANGE (id);
+CREATE FOREIGN TABLE p1 PARTITION OF pt FOR VALUES FROM (0) TO (500) SERVER async_server OPTIONS (table 'async_p1');
+CREATE FOREIGN TABLE p2 PARTITION OF pt FOR VALUES FROM (500) TO (1000) SERVER async_server OPTIONS (table 'async_p2');
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, v FROM pt;
+-- the rows of both partitions arrive, each partition is read on a stream of its own
+SELECT tableoid::regclass AS part, count(*), sum(v) FROM pt GROUP BY 1 ORDER BY 1;
+-- the table option overrides the one of the server
+ALTER FOREIGN TABLE p2 OPTIONS (ADD async_capable 'false');
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, v FROM pt;
+SELECT count(*), sum(v) FROM pt;
+DROP TABLE pt;
+DROP USER MAPPING FOR CURRENT_USER SERVER async_server;
+DROP SERVER async_server;
+SELECT * FROM ch_execute('DROP TABLE async_p1', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE async_p2', '') AS t(x int);
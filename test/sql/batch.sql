@@ -0,0 +1,24 @@
+--
+-- batch inserts
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER batch_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER batch_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS batch_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE batch_t (id Int32, name Nullable(String)) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+-- the last batch is not full
+CREATE FOREIGN TABLE batch_ft (id int, name text) SERVER batch_server OPTIONS (table 'batch_t', batch_size '7');
+INSERT INTO batch_ft SELECT g, CASE WHEN g % 3 <> 0 THEN 'n' || g END FROM generate_series(1, 100) g;
+SELECT count(*), count(name), sum(id) FROM batch_ft;
+SELECT * FROM batch_ft WHERE id IN (6, 7, 8, 99, 100) ORDER BY id;
+-- row triggers get the rows one at a time
+CREATE FUNCTION batch_notice() RETURNS trigger LANGUAGE plpgsql AS $$ BEGIN RAISE NOTICE 'inserted %', NEW.id; RETURN NEW; END $$;
+CREATE TRIGGER batch_notice AFTER INSERT ON batch_ft FOR EACH ROW EXECUTE PROCEDURE batch_notice();
+INSERT INTO batch_ft VALUES (101, 'x'), (102, NULL);
+SELECT count(*), count(name), sum(id) FROM batch_ft;
+DROP TRIGGER batch_notice ON batch_ft;
+DROP FUNCTION batch_notice();
+DROP FOREIGN TABLE batch_ft;
+DROP USER MAPPING FOR CURRENT_USER SERVER batch_server;
+DROP SERVER batch_server;
+SELECT * FROM ch_execute('DROP TABLE batch_t', '') AS t(x int);
@@ -0,0 +1,28 @@
+--
+-- only the columns a scan references are fetched
+--
+SET datestyle = 'ISO, MDY';
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER columns_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER columns_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS columns_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE columns_t (a Int32, b String, c String, d Date) ENGINE = MergeTree ORDER BY a', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO columns_t VALUES (1, ''one'', ''x'', ''2020-01-02''), (2, ''two'', ''y'', ''1970-01-01'')', '') AS t(x int);
+CREATE FOREIGN TABLE t (a int, b text, c text, d date) SERVER columns_server OPTIONS (table 'columns_t');
+EXPLAIN (VERBOSE, COSTS OFF) SELECT b FROM t;
+-- columns of the remote conditions are not fetched
+EXPLAIN (VERBOSE, COSTS OFF) SELECT b FROM t WHERE a = 1;
+SELECT b FROM t WHERE a = 1;
+-- columns of the local conditions are
+EXPLAIN (VERBOSE, COSTS OFF) SELECT b FROM t WHERE d > '1900-01-01';
+SELECT b FROM t WHERE d > '1900-01-01' ORDER BY b;
+-- no column at all
+EXPLAIN (VERBOSE, COSTS OFF) SELECT 1 FROM t;
+SELECT 1 AS one FROM t;
+-- a whole-row reference needs every column
+EXPLAIN (VERBOSE, COSTS OFF) SELECT t FROM t;
+SELECT t FROM t ORDER BY a;
+DROP FOREIGN TABLE t;
+DROP USER MAPPING FOR CURRENT_USER SERVER columns_server;
+DROP SERVER columns_server;
+SELECT * FROM ch_execute('DROP TABLE columns_t', '') AS t(x int);
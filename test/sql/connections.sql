@@ -0,0 +1,26 @@
+--
+-- cached connections
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER connections_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER connections_server;
+CREATE FOREIGN TABLE one (dummy int) SERVER connections_server OPTIONS (database 'system', table 'one');
+SELECT dummy FROM one;
+-- altering the server drops its cached connections
+ALTER SERVER connections_server OPTIONS (ADD port '1');
+\set VERBOSITY terse
+SELECT dummy FROM one;
+-- planning does without the server
+ALTER FOREIGN TABLE one OPTIONS (ADD use_remote_estimate 'true');
+EXPLAIN (COSTS OFF) SELECT dummy FROM one WHERE dummy = 0;
+\set VERBOSITY default
+ALTER SERVER connections_server OPTIONS (DROP port);
+SELECT dummy FROM one WHERE dummy = 0;
+-- idle connections are closed after clickhouse_fdw.idle_timeout
+SHOW clickhouse_fdw.idle_timeout;
+SET clickhouse_fdw.idle_timeout = 0;
+SELECT dummy FROM one;
+RESET clickhouse_fdw.idle_timeout;
+DROP FOREIGN TABLE one;
+DROP USER MAPPING FOR CURRENT_USER SERVER connections_server;
+DROP SERVER connections_server;
@@ -0,0 +1,21 @@
+--
+-- ClickHouse columns converted to the types of the foreign table
+--
+SET datestyle = 'ISO, MDY';
+SET timezone = 'UTC';
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER conversions_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER conversions_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS conversions_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE conversions_t (id Int32, i8 Int8, i16 Int16, i32 Int32, i64 Int64, u8 UInt8, u16 UInt16, u32 UInt32, u64 UInt64, f32 Float32, f64 Float64, d Date, dt DateTime, s String, fs FixedString(3), dec Decimal(10, 2), u UUID, n Nullable(Int32)) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO conversions_t VALUES (1, -128, -32768, -2147483648, -9223372036854775808, 255, 65535, 4294967295, 18446744073709551615, 0.5, -1.25, ''2020-01-02'', 1577934245, ''hello'', ''abc'', 12.34, ''a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'', NULL), (2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ''1970-01-01'', 0, '''', ''x'', 0, ''00000000-0000-0000-0000-000000000000'', 7)', '') AS t(x int);
+CREATE FOREIGN TABLE conversions (id int, i8 smallint, i16 smallint, i32 int, i64 bigint, u8 smallint, u16 int, u32 bigint, u64 numeric, f32 real, f64 float8, d date, dt timestamptz, s text, fs text, dec numeric, u uuid, n int) SERVER conversions_server OPTIONS (table 'conversions_t');
+SELECT id, i8, i16, i32, i64, u8, u16, u32, u64 FROM conversions ORDER BY id;
+-- FixedString loses its zero padding
+SELECT id, f32, f64, d, dt, s, fs, length(fs) AS fs_len, dec, u, n FROM conversions ORDER BY id;
+-- the same through ch_execute
+SELECT * FROM ch_execute('SELECT u64, d, u FROM conversions_t ORDER BY id', '') AS t(u64 numeric, d date, u uuid);
+DROP FOREIGN TABLE conversions;
+DROP USER MAPPING FOR CURRENT_USER SERVER conversions_server;
+DROP SERVER conversions_server;
+SELECT * FROM ch_execute('DROP TABLE conversions_t', '') AS t(x int);
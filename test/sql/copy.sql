@@ -0,0 +1,36 @@
+--
+-- COPY FROM and tuple routing into ClickHouse foreign tables
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER copy_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER copy_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS copy_t', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS copy_part_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE copy_t (id Int32, name Nullable(String)) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE copy_part_t (id Int32, v String) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+CREATE FOREIGN TABLE copy_ft (id int, name text) SERVER copy_server OPTIONS (table 'copy_t');
+COPY copy_ft FROM stdin;
+1	one
+2	two
+\.
+-- columns left out are NULL
+COPY copy_ft (id) FROM stdin;
+3
+\.
+SELECT * FROM copy_ft ORDER BY id;
+-- a partition on ClickHouse next to a local one
+CREATE TABLE copy_p (id int, v text) PARTITION BY RANGE (id);
+CREATE FOREIGN TABLE copy_p_ch PARTITION OF copy_p FOR VALUES FROM (0) TO (100) SERVER copy_server OPTIONS (table 'copy_part_t');
+CREATE TABLE copy_p_local PARTITION OF copy_p FOR VALUES FROM (100) TO (200);
+INSERT INTO copy_p VALUES (1, 'a'), (150, 'b'), (2, 'c');
+COPY copy_p FROM stdin;
+3	d
+151	e
+\.
+SELECT tableoid::regclass AS part, * FROM copy_p ORDER BY id;
+DROP TABLE copy_p;
+DROP FOREIGN TABLE copy_ft;
+DROP USER MAPPING FOR CURRENT_USER SERVER copy_server;
+DROP SERVER copy_server;
+SELECT * FROM ch_execute('DROP TABLE copy_t', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE copy_part_t', '') AS t(x int);
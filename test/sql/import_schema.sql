@@ -0,0 +1,21 @@
+--
+-- IMPORT FOREIGN SCHEMA maps ClickHouse types to PostgreSQL ones
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER import_schema_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER import_schema_server;
+SELECT * FROM ch_execute('DROP DATABASE IF EXISTS import_schema_db', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE DATABASE import_schema_db', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE import_schema_db.types_t (a Int32, b UInt8, c UInt64, d Nullable(Float64), e LowCardinality(String), f Array(Nullable(Int64)), g Decimal(10, 2), h DateTime(''UTC''), i DateTime64(3), j Enum8(''x'' = 1), k UUID, l Date, m Int32 ALIAS a + 1, n Int32 MATERIALIZED a * 2) ENGINE = MergeTree ORDER BY a', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE import_schema_db.other_t (a Int32) ENGINE = Memory', '') AS t(x int);
+CREATE SCHEMA import_schema_local;
+IMPORT FOREIGN SCHEMA import_schema_db FROM SERVER import_schema_server INTO import_schema_local OPTIONS (foo 'bar');
+IMPORT FOREIGN SCHEMA import_schema_db LIMIT TO (types_t) FROM SERVER import_schema_server INTO import_schema_local;
+SELECT relname FROM pg_class WHERE relnamespace = 'import_schema_local'::regnamespace ORDER BY relname;
+-- ALIAS and MATERIALIZED columns are left out
+SELECT attname, format_type(atttypid, atttypmod), attnotnull FROM pg_attribute WHERE attrelid = 'import_schema_local.types_t'::regclass AND attnum > 0 ORDER BY attnum;
+SELECT ftoptions FROM pg_foreign_table WHERE ftrelid = 'import_schema_local.types_t'::regclass;
+DROP SCHEMA import_schema_local CASCADE;
+DROP USER MAPPING FOR CURRENT_USER SERVER import_schema_server;
+DROP SERVER import_schema_server;
+SELECT * FROM ch_execute('DROP DATABASE import_schema_db', '') AS t(x int);
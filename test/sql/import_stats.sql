@@ -0,0 +1,19 @@
+--
+-- statistics computed by ClickHouse over the whole table
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER import_stats_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER import_stats_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS import_stats_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE import_stats_t (id Int64, k Int32, s Nullable(String)) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO import_stats_t SELECT number, if(number < 500, 0, if(number < 800, 1, 2)), if(number % 10 = 0, NULL, ''x'') FROM numbers(1000)', '') AS t(x int);
+CREATE FOREIGN TABLE import_stats_ft (id bigint, k int, s text) SERVER import_stats_server OPTIONS (table 'import_stats_t');
+SELECT clickhouse_import_stats('import_stats_ft');
+SELECT reltuples FROM pg_class WHERE relname = 'import_stats_ft';
+SELECT attname, null_frac, avg_width, n_distinct FROM pg_stats WHERE tablename = 'import_stats_ft' ORDER BY attname;
+SELECT attname, most_common_vals, most_common_freqs FROM pg_stats WHERE tablename = 'import_stats_ft' AND attname IN ('k', 's') ORDER BY attname;
+SELECT clickhouse_import_stats('pg_class');
+DROP FOREIGN TABLE import_stats_ft;
+DROP USER MAPPING FOR CURRENT_USER SERVER import_stats_server;
+DROP SERVER import_stats_server;
+SELECT * FROM ch_execute('DROP TABLE import_stats_t', '') AS t(x int);
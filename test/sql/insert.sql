@@ -0,0 +1,22 @@
+--
+-- INSERT into a ClickHouse table in native blocks
+--
+SET datestyle = 'ISO, MDY';
+SET timezone = 'UTC';
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER insert_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER insert_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS insert_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE insert_t (id Int32, name Nullable(String), d Date, ts DateTime, price Decimal(10, 2), u UUID) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+CREATE FOREIGN TABLE t (id int, name text, d date, ts timestamptz, price numeric, u uuid) SERVER insert_server OPTIONS (table 'insert_t');
+EXPLAIN (VERBOSE, COSTS OFF) INSERT INTO t VALUES (1, 'one', '2020-01-02', '2020-01-02 03:04:05+00', 12.34, 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11');
+INSERT INTO t VALUES (1, 'one', '2020-01-02', '2020-01-02 03:04:05+00', 12.34, 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'), (2, NULL, '1970-01-01', '1970-01-01 00:00:00+00', -1.5, '00000000-0000-0000-0000-000000000001');
+SELECT * FROM t ORDER BY id;
+-- rows from a local query, sent in blocks of 100 rows
+ALTER FOREIGN TABLE t OPTIONS (ADD max_block_size '100');
+INSERT INTO t SELECT g, 'n' || g, '2020-01-01'::date + g, '2020-01-01 00:00:00+00'::timestamptz + g * interval '1 second', g, md5(g::text)::uuid FROM generate_series(3, 1000) g;
+SELECT count(*), sum(id), max(d) FROM t;
+DROP FOREIGN TABLE t;
+DROP USER MAPPING FOR CURRENT_USER SERVER insert_server;
+DROP SERVER insert_server;
+SELECT * FROM ch_execute('DROP TABLE insert_t', '') AS t(x int);
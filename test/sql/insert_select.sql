@@ -0,0 +1,24 @@
+--
+-- INSERT ... SELECT between tables of one server runs on ClickHouse
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER insert_select_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER insert_select_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS insert_select_src', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS insert_select_dst', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE insert_select_src (id Int32, v Int32) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE insert_select_dst (id Int32, v Int32, note Nullable(String)) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO insert_select_src VALUES (1, 10), (2, 20), (3, 30)', '') AS t(x int);
+CREATE FOREIGN TABLE src (id int, v int) SERVER insert_select_server OPTIONS (table 'insert_select_src');
+CREATE FOREIGN TABLE dst (id int, v int, note text) SERVER insert_select_server OPTIONS (table 'insert_select_dst');
+-- the scan of the source becomes the INSERT, a column left out stays NULL
+EXPLAIN (VERBOSE, COSTS OFF) INSERT INTO dst (id, v) SELECT id, v FROM src WHERE id > 1;
+-- the row count is the one ClickHouse reports written
+DO $$ DECLARE n bigint; BEGIN INSERT INTO dst (id, v) SELECT id, v FROM src WHERE id > 1; GET DIAGNOSTICS n = ROW_COUNT; RAISE NOTICE 'inserted % rows', n; END $$;
+SELECT * FROM dst ORDER BY id;
+DROP FOREIGN TABLE src;
+DROP FOREIGN TABLE dst;
+DROP USER MAPPING FOR CURRENT_USER SERVER insert_select_server;
+DROP SERVER insert_select_server;
+SELECT * FROM ch_execute('DROP TABLE insert_select_src', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE insert_select_dst', '') AS t(x int);
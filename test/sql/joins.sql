@@ -0,0 +1,25 @@
+--
+-- joins computed by ClickHouse
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER joins_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER joins_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS joins_t1', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS joins_t2', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE joins_t1 (id Int32, name String) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE joins_t2 (id Int32, v Int32) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO joins_t1 VALUES (1, ''a''), (2, ''b''), (3, ''c'')', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO joins_t2 VALUES (1, 5), (2, 20), (4, 40)', '') AS t(x int);
+CREATE FOREIGN TABLE t1 (id int, name text) SERVER joins_server OPTIONS (table 'joins_t1');
+CREATE FOREIGN TABLE t2 (id int, v int) SERVER joins_server OPTIONS (table 'joins_t2');
+EXPLAIN (VERBOSE, COSTS OFF) SELECT t1.id, t2.v FROM t1 JOIN t2 ON t1.id = t2.id;
+SELECT t1.id, t2.v FROM t1 JOIN t2 ON t1.id = t2.id ORDER BY t1.id;
+-- conditions on the nullable side are applied before the join
+EXPLAIN (VERBOSE, COSTS OFF) SELECT t1.id, t2.v FROM t1 LEFT JOIN t2 ON t1.id = t2.id AND t2.v > 10;
+SELECT t1.id, t2.v FROM t1 LEFT JOIN t2 ON t1.id = t2.id AND t2.v > 10 ORDER BY t1.id;
+DROP FOREIGN TABLE t1;
+DROP FOREIGN TABLE t2;
+DROP USER MAPPING FOR CURRENT_USER SERVER joins_server;
+DROP SERVER joins_server;
+SELECT * FROM ch_execute('DROP TABLE joins_t1', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE joins_t2', '') AS t(x int);
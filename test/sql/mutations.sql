@@ -0,0 +1,26 @@
+--
+-- UPDATE and DELETE run as mutations of the ClickHouse table
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER mutations_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER mutations_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS mutations_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE mutations_t (id Int32, v Int32, d Date) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO mutations_t VALUES (1, 10, ''2020-01-01''), (2, 20, ''2020-01-02''), (3, 30, ''2020-01-03'')', '') AS t(x int);
+CREATE FOREIGN TABLE mutations_ft (id int, v int, d date) SERVER mutations_server OPTIONS (table 'mutations_t');
+EXPLAIN (VERBOSE, COSTS OFF) UPDATE mutations_ft SET v = v + 1 WHERE id = 1;
+UPDATE mutations_ft SET v = v + 1 WHERE id = 1;
+EXPLAIN (VERBOSE, COSTS OFF) DELETE FROM mutations_ft WHERE id = 2;
+DELETE FROM mutations_ft WHERE id = 2;
+-- the mutations are applied when the statements return
+SELECT id, v FROM mutations_ft ORDER BY id;
+-- rows cannot be modified one by one
+DELETE FROM mutations_ft WHERE d > '1900-01-01';
+UPDATE mutations_ft SET v = 0 WHERE id = 1 RETURNING id;
+EXPLAIN (VERBOSE, COSTS OFF) DELETE FROM mutations_ft;
+DELETE FROM mutations_ft;
+SELECT count(*) FROM mutations_ft;
+DROP FOREIGN TABLE mutations_ft;
+DROP USER MAPPING FOR CURRENT_USER SERVER mutations_server;
+DROP SERVER mutations_server;
+SELECT * FROM ch_execute('DROP TABLE mutations_t', '') AS t(x int);
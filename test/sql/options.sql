@@ -0,0 +1,20 @@
+--
+-- validation of the options of servers, user mappings and tables
+--
+CREATE SERVER options_server FOREIGN DATA WRAPPER clickhouse_fdw OPTIONS (host 'localhost', port '9000', database 'default', compression 'true', connect_timeout '5', receive_timeout '30', send_timeout '30', fetch_size '10000', max_block_bytes '1048576', batch_size '100', use_remote_estimate 'false', async_capable 'true');
+CREATE SERVER options_bad FOREIGN DATA WRAPPER clickhouse_fdw OPTIONS (foo 'bar');
+ALTER SERVER options_server OPTIONS (SET port '0');
+ALTER SERVER options_server OPTIONS (SET port '70000');
+ALTER SERVER options_server OPTIONS (SET fetch_size '10k');
+ALTER SERVER options_server OPTIONS (SET compression 'maybe');
+ALTER SERVER options_server OPTIONS (SET port '9001');
+CREATE USER MAPPING FOR CURRENT_USER SERVER options_server OPTIONS (user 'default', password '');
+ALTER USER MAPPING FOR CURRENT_USER SERVER options_server OPTIONS (ADD host 'localhost');
+CREATE FOREIGN TABLE options_ft (a int) SERVER options_server OPTIONS (database 'db', table 'remote_t', fetch_size '500', batch_size '10', use_remote_estimate 'true', async_capable 'false');
+ALTER FOREIGN TABLE options_ft OPTIONS (ADD host 'localhost');
+ALTER FOREIGN TABLE options_ft OPTIONS (SET batch_size '-1');
+ALTER FOREIGN TABLE options_ft OPTIONS (SET use_remote_estimate '2');
+SELECT ftoptions FROM pg_foreign_table WHERE ftrelid = 'options_ft'::regclass;
+DROP FOREIGN TABLE options_ft;
+DROP USER MAPPING FOR CURRENT_USER SERVER options_server;
+DROP SERVER options_server;
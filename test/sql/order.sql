@@ -0,0 +1,23 @@
+--
+-- ORDER BY and LIMIT computed by ClickHouse
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER order_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER order_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS order_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE order_t (id Int32, u UUID, n Nullable(Int32)) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO order_t VALUES (1, ''a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'', NULL), (2, ''00000000-0000-0000-0000-000000000001'', 20), (3, ''00000000-0000-0000-0001-000000000000'', 10)', '') AS t(x int);
+CREATE FOREIGN TABLE t (id int, u uuid, n int) SERVER order_server OPTIONS (table 'order_t');
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, n FROM t ORDER BY n LIMIT 2;
+SELECT id, n FROM t ORDER BY n LIMIT 2;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, n FROM t ORDER BY n DESC LIMIT 2 OFFSET 1;
+SELECT id, n FROM t ORDER BY n DESC LIMIT 2 OFFSET 1;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM t LIMIT 2;
+SELECT count(*) FROM (SELECT id FROM t LIMIT 2) s;
+-- ClickHouse orders UUIDs differently
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM t ORDER BY u;
+SELECT id FROM t ORDER BY u;
+DROP FOREIGN TABLE t;
+DROP USER MAPPING FOR CURRENT_USER SERVER order_server;
+DROP SERVER order_server;
+SELECT * FROM ch_execute('DROP TABLE order_t', '') AS t(x int);
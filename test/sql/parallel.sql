@@ -0,0 +1,34 @@
+--
+-- parallel scans read a foreign table in chunks, one at a time per participant
+--
+CREATE SERVER parallel_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER parallel_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS parallel_t', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS parallel_s', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE parallel_t (id Int32, v Int32) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE parallel_s (id Int32, v Int32) ENGINE = MergeTree ORDER BY intHash32(id) SAMPLE BY intHash32(id)', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO parallel_t SELECT number, number % 7 FROM numbers(1000)', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO parallel_s SELECT number, number % 7 FROM numbers(1000)', '') AS t(x int);
+CREATE FOREIGN TABLE t (id int, v int) SERVER parallel_server OPTIONS (table 'parallel_t');
+CREATE FOREIGN TABLE s (id int, v int) SERVER parallel_server OPTIONS (table 'parallel_s');
+SET max_parallel_workers_per_gather = 2;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+-- chunks split by a hash of the fetched columns
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, v FROM t;
+-- every row is read once, whichever participant reads its chunk
+SELECT count(*), count(DISTINCT id), sum(v) FROM (SELECT id, v FROM t OFFSET 0) q;
+-- chunks split by SAMPLE ... OFFSET on a table with a sampling key
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, v FROM s;
+SELECT count(*), count(DISTINCT id), sum(v) FROM (SELECT id, v FROM s OFFSET 0) q;
+RESET max_parallel_workers_per_gather;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+DROP FOREIGN TABLE t;
+DROP FOREIGN TABLE s;
+DROP USER MAPPING FOR CURRENT_USER SERVER parallel_server;
+DROP SERVER parallel_server;
+SELECT * FROM ch_execute('DROP TABLE parallel_t', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE parallel_s', '') AS t(x int);
@@ -0,0 +1,19 @@
+--
+-- inserted rows are sent in a block per partition of the ClickHouse table
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER partitions_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER partitions_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS partitions_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE partitions_t (id Int32, v String) ENGINE = MergeTree PARTITION BY id % 5 ORDER BY id', '') AS t(x int);
+-- ClickHouse rejects a single block spanning more partitions
+CREATE FOREIGN TABLE partitions_ft (id int, v text) SERVER partitions_server OPTIONS (table 'partitions_t', settings 'max_partitions_per_insert_block=2');
+INSERT INTO partitions_ft SELECT g, 'v' || g FROM generate_series(1, 100) g;
+CREATE FOREIGN TABLE partitions_parts ("table" text, partition text, rows bigint, active int) SERVER partitions_server OPTIONS (database 'system', table 'parts');
+SELECT partition, count(*), sum(rows) FROM partitions_parts WHERE "table" = 'partitions_t' AND active = 1 GROUP BY partition ORDER BY partition;
+SELECT count(*), sum(id) FROM partitions_ft;
+DROP FOREIGN TABLE partitions_ft;
+DROP FOREIGN TABLE partitions_parts;
+DROP USER MAPPING FOR CURRENT_USER SERVER partitions_server;
+DROP SERVER partitions_server;
+SELECT * FROM ch_execute('DROP TABLE partitions_t', '') AS t(x int);
@@ -0,0 +1,22 @@
+--
+-- ClickHouse settings of servers, tables and the session
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER settings_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER settings_server;
+\set VERBOSITY terse
+ALTER SERVER settings_server OPTIONS (ADD settings 'no_such_setting=1');
+ALTER SERVER settings_server OPTIONS (ADD settings 'max_threads');
+SET clickhouse_fdw.settings = 'no_such_setting=1';
+\set VERBOSITY default
+ALTER SERVER settings_server OPTIONS (ADD settings 'max_threads=3, max_execution_time=100');
+-- system.settings shows the settings of the query reading it
+CREATE FOREIGN TABLE settings_ft (name text, value text) SERVER settings_server OPTIONS (database 'system', table 'settings', settings 'max_threads=2');
+SELECT name, value FROM settings_ft WHERE name IN ('max_threads', 'max_execution_time') ORDER BY name;
+SET clickhouse_fdw.settings = 'max_threads=1';
+SELECT name, value FROM settings_ft WHERE name IN ('max_threads', 'max_execution_time') ORDER BY name;
+RESET clickhouse_fdw.settings;
+SELECT name, value FROM settings_ft WHERE name IN ('max_threads', 'max_execution_time') ORDER BY name;
+DROP FOREIGN TABLE settings_ft;
+DROP USER MAPPING FOR CURRENT_USER SERVER settings_server;
+DROP SERVER settings_server;
@@ -0,0 +1,18 @@
+--
+-- results streamed block by block, LIMIT and cancellation
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER streaming_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER streaming_server;
+-- system.numbers never ends, only what is read is fetched
+CREATE FOREIGN TABLE numbers (number bigint) SERVER streaming_server OPTIONS (database 'system', table 'numbers');
+EXPLAIN (VERBOSE, COSTS OFF) SELECT number FROM numbers WHERE random() >= 0 LIMIT 3;
+SELECT number FROM numbers WHERE random() >= 0 LIMIT 3;
+-- an interrupt cancels the remote query
+SET statement_timeout = '1s';
+SELECT count(*) FROM numbers WHERE random() >= 0;
+RESET statement_timeout;
+SELECT number FROM numbers WHERE random() >= 0 LIMIT 1;
+DROP FOREIGN TABLE numbers;
+DROP USER MAPPING FOR CURRENT_USER SERVER streaming_server;
+DROP SERVER streaming_server;
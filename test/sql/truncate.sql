@@ -0,0 +1,29 @@
+--
+-- TRUNCATE of foreign tables empties their ClickHouse tables
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER truncate_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER truncate_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS truncate_t1', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS truncate_t2', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE truncate_t1 (id Int32) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE truncate_t2 (id Int32) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO truncate_t1 SELECT number FROM numbers(10)', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO truncate_t2 SELECT number FROM numbers(20)', '') AS t(x int);
+CREATE FOREIGN TABLE t1 (id int) SERVER truncate_server OPTIONS (table 'truncate_t1');
+CREATE FOREIGN TABLE t2 (id int) SERVER truncate_server OPTIONS (table 'truncate_t2');
+SELECT (SELECT count(*) FROM t1) AS t1, (SELECT count(*) FROM t2) AS t2;
+TRUNCATE t1;
+SELECT (SELECT count(*) FROM t1) AS t1, (SELECT count(*) FROM t2) AS t2;
+-- several tables of one server in one statement, CASCADE makes no difference
+SELECT * FROM ch_execute('INSERT INTO truncate_t1 SELECT number FROM numbers(5)', '') AS t(x int);
+TRUNCATE t1, t2 CASCADE;
+SELECT (SELECT count(*) FROM t1) AS t1, (SELECT count(*) FROM t2) AS t2;
+INSERT INTO t1 VALUES (1), (2);
+SELECT id FROM t1 ORDER BY id;
+DROP FOREIGN TABLE t1;
+DROP FOREIGN TABLE t2;
+DROP USER MAPPING FOR CURRENT_USER SERVER truncate_server;
+DROP SERVER truncate_server;
+SELECT * FROM ch_execute('DROP TABLE truncate_t1', '') AS t(x int);
+SELECT * FROM ch_execute('DROP TABLE truncate_t2', '') AS t(x int);
@@ -0,0 +1,33 @@
+--
+-- restriction clauses evaluated by ClickHouse
+--
+SET max_parallel_workers_per_gather = 0;
+CREATE SERVER where_server FOREIGN DATA WRAPPER clickhouse_fdw;
+CREATE USER MAPPING FOR CURRENT_USER SERVER where_server;
+SELECT * FROM ch_execute('DROP TABLE IF EXISTS where_t', '') AS t(x int);
+SELECT * FROM ch_execute('CREATE TABLE where_t (id Int32, name String, price Decimal(18, 4), d Date, u UUID, n Nullable(Int64)) ENGINE = MergeTree ORDER BY id', '') AS t(x int);
+SELECT * FROM ch_execute('INSERT INTO where_t VALUES (1, ''one'', 1.5, ''2020-01-02'', ''a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'', NULL), (2, ''two'', -12345.6789, ''1970-01-01'', ''00000000-0000-0000-0000-000000000001'', 9223372036854775807), (3, ''three'', 2.25, ''2100-12-31'', ''00000000-0000-0000-0001-000000000000'', 1)', '') AS t(x int);
+CREATE FOREIGN TABLE t (id int, name text, price numeric, d date, u uuid, n bigint) SERVER where_server OPTIONS (table 'where_t');
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id, name FROM t WHERE id = 1 AND name = 'one';
+SELECT id, name FROM t WHERE id = 1 AND name = 'one';
+-- a NULL operand of IN and NOT IN gives NULL
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM t WHERE n NOT IN (1, 2);
+SELECT id FROM t WHERE n NOT IN (1, 2) ORDER BY id;
+SELECT id FROM t WHERE n IN (1, 2) ORDER BY id;
+-- numeric constants are compared as decimals
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM t WHERE price > 1.5;
+SELECT id FROM t WHERE price > 1.5 ORDER BY id;
+-- more digits than a Decimal128 holds
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM t WHERE price = 1234567890123456789012345678901234567890.5;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM t WHERE d = '2020-01-02';
+-- outside the range of a ClickHouse Date
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM t WHERE d > '1900-01-01';
+SELECT id FROM t WHERE d > '1900-01-01' ORDER BY id;
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM t WHERE u = 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11';
+-- ClickHouse orders UUIDs differently
+EXPLAIN (VERBOSE, COSTS OFF) SELECT id FROM t WHERE u > '00000000-0000-0000-0000-000000000001';
+SELECT id FROM t WHERE u > '00000000-0000-0000-0000-000000000001' ORDER BY id;
+DROP FOREIGN TABLE t;
+DROP USER MAPPING FOR CURRENT_USER SERVER where_server;
+DROP SERVER where_server;
+SELECT * FROM ch_execute('DROP TABLE where_t', '') AS t(x int);